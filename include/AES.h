@@ -16,6 +16,8 @@ void KeyExpansion(uint8_t *key, uint32_t *w, int nk, int num_round_keys);
 uint8_t char_to_hex(char c);
 void uint32_to_digits(uint32_t value, uint8_t *digits);
 int getRoundKeys(uint32_t *expandedKey, int num_round_keys, unsigned char ***round_keys);
+int key_setup(const char *key, unsigned char ***round_keys, size_t *num_round_keys);
+int key_setup_bytes(const uint8_t *key, size_t key_bytes, unsigned char ***round_keys, size_t *num_round_keys);
 int AES_cipher(unsigned char *block, unsigned char **roundkey, unsigned char *cipher, size_t Nr);
 int AES_decipher(unsigned char *block, unsigned char **roundkey, unsigned char *cipher, size_t Nr);
 #endif /* AES_H */
\ No newline at end of file
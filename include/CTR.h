@@ -0,0 +1,12 @@
+#ifndef CTR_H
+#define CTR_H
+#include "more.h"
+
+#define CTR_BATCH_BLOCKS 64 // Keystream blocks generated per batch
+
+void CTR_increment(unsigned char *counter, size_t n);
+void CTR_keystream(unsigned char **key, size_t Nr, unsigned char *counter, unsigned char *keystream, size_t num_blocks);
+int CTR_cipher(unsigned char **key, unsigned char **blocks, size_t num_blocks, unsigned char **cipher, size_t *num_cipher, size_t Nr, unsigned char *vector_init);
+int CTR_decipher(unsigned char **key, unsigned char **blocks, size_t num_blocks, unsigned char **cipher, size_t *num_cipher, size_t Nr, unsigned char *vector_init);
+
+#endif /* CTR_H */
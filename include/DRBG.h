@@ -0,0 +1,33 @@
+#ifndef DRBG_H
+#define DRBG_H
+#include <stdio.h>
+#include <stdint.h>
+#include "more.h"
+
+// CTR_DRBG with AES-256 and no derivation function (NIST SP 800-90A, 10.2.1).
+#define DRBG_KEY_LEN 32
+#define DRBG_SEED_LEN (DRBG_KEY_LEN + BLOCK_SIZE)
+#define DRBG_MAX_REQUEST 65536                       // 2^19 bits per generate call
+#define DRBG_RESEED_INTERVAL ((uint64_t)1 << 48)     // Generate calls allowed between reseeds
+#define DRBG_THREAD_RESEED ((uint64_t)1 << 16)       // Buffer refills between reseeds from the OS
+#define DRBG_BUFFER_SIZE DRBG_MAX_REQUEST            // Per-thread output buffer
+
+typedef struct
+{
+    unsigned char **round_keys;
+    size_t Nr;
+    unsigned char V[BLOCK_SIZE];
+    uint64_t reseed_counter;
+} drbg_state;
+
+int drbg_instantiate(drbg_state *state, const uint8_t *entropy, size_t entropy_len, const uint8_t *personalization, size_t personalization_len);
+int drbg_reseed(drbg_state *state, const uint8_t *entropy, size_t entropy_len, const uint8_t *additional, size_t additional_len);
+int drbg_generate(drbg_state *state, uint8_t *out, size_t len, const uint8_t *additional, size_t additional_len);
+void drbg_uninstantiate(drbg_state *state);
+
+int drbg_set_seed(const char *seed);
+int drbg_random_bytes(uint8_t *out, size_t len);
+void drbg_thread_cleanup(void);
+int drbg_write_random(FILE *file, unsigned long long num_bytes);
+
+#endif /* DRBG_H */
@@ -0,0 +1,22 @@
+#ifndef AESFILE_H
+#define AESFILE_H
+#include <sys/types.h>
+#include "stream.h"
+
+#define AESFILE_BATCH_BLOCKS STREAM_BATCH_BLOCKS // Blocks read and ciphered at once
+
+// An encrypted file read (ECB, CBC, CFB, CTR) and written (ECB, CTR) at any offset.
+// CTR overwrites reuse the keystream of the old data, see aes_pwrite.
+typedef struct
+{
+    int fd;
+    stream_ctx ctx; // Mode, round keys and IV of the whole file
+} aes_file;
+
+aes_file *aes_file_open(const char *path, bool writable, const char *mode, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init);
+aes_file *aes_file_fdopen(int fd, const char *mode, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init);
+ssize_t aes_pread(aes_file *file, void *buffer, size_t length, off_t offset);
+ssize_t aes_pwrite(aes_file *file, const void *buffer, size_t length, off_t offset);
+int aes_file_close(aes_file *file);
+
+#endif /* AESFILE_H */
@@ -0,0 +1,18 @@
+#ifndef APPENDLOG_H
+#define APPENDLOG_H
+#include "stream.h"
+
+/*
+ * Append-only log layout: the ciphertext of all records, its last block
+ * zero-padded in ECB and CBC (CFB and CTR logs are not padded), then a
+ * trailer (little-endian):
+ *   "AESLOG1\0", mode, 7 reserved bytes, data length (8 bytes),
+ *   chaining state before the last block (16 bytes), 8 reserved bytes
+ */
+#define APPENDLOG_MAGIC "AESLOG1"
+#define APPENDLOG_TRAILER_SIZE 48
+
+int append_log_write(const stream_ctx *ctx, int in_fd, int log_fd, size_t chunk_size, unsigned long long *bytes_out);
+int append_log_read(const stream_ctx *ctx, int log_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out);
+
+#endif /* APPENDLOG_H */
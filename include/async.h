@@ -0,0 +1,47 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+#include <stddef.h>
+#include "keycache.h"
+
+#define ASYNC_QUEUE_SIZE 4096 // Jobs submitted and not yet taken by a worker
+#define ASYNC_BATCH_JOBS 64   // Jobs a worker takes from the queue at once
+#define ASYNC_SMALL_JOB 4096  // ECB and CTR jobs up to this size share cipher calls
+
+typedef struct aes_job aes_job;
+typedef void (*aes_job_callback)(aes_job *job, void *arg);
+
+// A buffer to encrypt or decrypt; owned by the caller until its callback has run.
+struct aes_job
+{
+    stream_mode mode;
+    bool encrypt;
+    const key_schedule *key;      // Must stay valid until completion
+    unsigned char iv[BLOCK_SIZE]; // IV or initial counter, unused in ECB
+    const unsigned char *in;
+    unsigned char *out;           // May be equal to in
+    size_t length;                // A multiple of BLOCK_SIZE
+    aes_job_callback callback;    // Run by aes_poll, may be NULL
+    void *arg;
+    int status;                   // Set on completion: EXIT_SUCCESS or EXIT_FAILURE
+    aes_job *next;                // Internal
+};
+
+typedef struct aes_async aes_async;
+
+// A buffer for aes_batch, with the key id and key its schedule comes from.
+typedef struct
+{
+    uint32_t key_id;          // 0: the key is not cached
+    const unsigned char *key; // NULL: use the cached key of key_id (or of another item of the batch)
+    size_t key_length;
+    aes_job job;              // The key is filled in by aes_batch, the callback is not used
+} aes_batch_item;
+
+aes_async *aes_async_create(int num_workers);
+int aes_async_fd(const aes_async *engine);
+int aes_submit(aes_async *engine, aes_job *job);
+int aes_poll(aes_async *engine);
+void aes_async_destroy(aes_async *engine);
+int aes_batch(keycache *cache, aes_batch_item *items, size_t count);
+
+#endif /* ASYNC_H */
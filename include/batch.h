@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include "stream.h"
+
+#define BATCH_SPLIT_CHUNKS 4 // Files larger than this many chunks are split (parallel modes)
+
+int batch_run(const stream_ctx *ctx, const char *list, const char *output_dir, size_t chunk_size, int num_workers, bool verbose);
+
+#endif /* BATCH_H */
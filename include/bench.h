@@ -0,0 +1,40 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include "stream.h"
+
+/*
+ * In-memory throughput benchmark of the cipher engines. Each case (engine,
+ * mode, direction, key size, input size) is first warmed up while the
+ * number of operations per sample is doubled until a sample lasts
+ * BENCH_SAMPLE_SECONDS; the timed samples follow. The input sizes go from
+ * BENCH_MIN_SIZE to the maximum size, BENCH_SIZE_STEP times larger each.
+ * With counters, the timed samples of each case are also counted with the
+ * hardware performance counters that are available.
+ */
+#define BENCH_MIN_SIZE 16
+#define BENCH_SIZE_STEP 16
+#define BENCH_DEFAULT_MAX_SIZE (1 << 20)
+#define BENCH_DEFAULT_REPETITIONS 11
+#define BENCH_SAMPLE_SECONDS 0.01
+#define BENCH_MODES 4
+
+typedef enum
+{
+    BENCH_STREAM, // stream_update on contiguous buffers
+    BENCH_BLOCKS  // The mode functions on an array of block pointers
+} bench_engine;
+
+typedef struct
+{
+    stream_mode modes[BENCH_MODES];
+    int num_modes;
+    unsigned long long max_size;
+    int repetitions;
+    const char *json_file; // NULL: no JSON, "-": stdout
+    bool quiet;            // No table on stdout
+    bool counters;         // Hardware counters per case, see perfctr.h
+} bench_options;
+
+int bench_run(const bench_options *options);
+
+#endif /* BENCH_H */
@@ -0,0 +1,19 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "stream.h"
+
+/*
+ * Journal layout, all integers little-endian (80 bytes):
+ *   "AESJRN1\0", mode, direction, 6 reserved bytes, input size, input
+ *   modification time (ns), input offset, output offset, chaining state
+ *   (16 bytes), key check value, checksum of the previous 72 bytes
+ */
+#define CHECKPOINT_MAGIC "AESJRN1"
+#define CHECKPOINT_SIZE 80
+#define CHECKPOINT_SUFFIX ".journal"
+#define CHECKPOINT_DEFAULT_INTERVAL (256ULL << 20) // 256 MiB between checkpoints
+
+int checkpoint_stream(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long interval, const char *journal_path, bool resume,
+                      unsigned long long *bytes_out);
+
+#endif /* CHECKPOINT_H */
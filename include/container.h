@@ -0,0 +1,89 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "stream.h"
+#include "manifest.h"
+
+/*
+ * Container layout, all integers little-endian:
+ *   header (64 bytes): "AESC", version, mode, key bits, flags, chunk size,
+ *                      original length, base IV
+ *   chunks:            each chunk encrypted on its own, padded to a block
+ *   index:             one 24-byte entry per chunk (offset, plain and stored length,
+ *                      generation, CRC32C of the stored chunk)
+ *   footer (24 bytes): index offset, number of chunks, "AESCIDX1"
+ * With CONTAINER_FLAG_COMPRESSED, each chunk is compressed (see lz.h) before
+ * it is encrypted: the encrypted payload starts with a 4-byte length of the
+ * data that follows, bit 31 set if the chunk did not compress and is stored
+ * as it is, so the padding after the data is unambiguous.
+ *
+ * An update never writes over what the current version uses: changed chunks
+ * go to free space or past the end of the file, and the switch to the new
+ * version goes through a journal next to the container (CONTAINER_JOURNAL_SUFFIX):
+ *   prefix (32 bytes): "AESCUPD\0", state, 4 reserved bytes, container size,
+ *                      record length
+ *   record:            commit only: the new header, index and footer
+ *   checksum:          8-byte digest of the prefix and the record
+ * While the chunks are written the journal is pending and holds the old size,
+ * which an interrupted update is cut back to; once they are synced it holds
+ * the new version, which is written over the old header and index.
+ */
+#define CONTAINER_MAGIC "AESC"
+#define CONTAINER_FOOTER_MAGIC "AESCIDX1"
+#define CONTAINER_VERSION 1
+#define CONTAINER_HEADER_SIZE 64
+#define CONTAINER_ENTRY_SIZE 24
+#define CONTAINER_FOOTER_SIZE 24
+#define CONTAINER_FLAG_COMPRESSED 1
+#define CONTAINER_FLAG_CRC32C 2 // The index holds a CRC32C of each stored chunk
+#define CONTAINER_CRC_SLICE (64 << 10) // Bytes encrypted before their CRC is taken, while still in cache
+#define CONTAINER_RAW_CHUNK 0x80000000u // In the length prefix of a compressed container chunk
+#define CONTAINER_JOURNAL_MAGIC "AESCUPD"
+#define CONTAINER_JOURNAL_SUFFIX ".update"
+#define CONTAINER_JOURNAL_PREFIX 32
+#define CONTAINER_JOURNAL_PENDING 1 // Chunks are being written: roll back to the old size
+#define CONTAINER_JOURNAL_COMMIT 2  // The new version is in the journal: write it
+#define CONTAINER_COMPACT_RATIO 4   // Compact once more than 1/4 of the chunk area is dead
+
+typedef struct
+{
+    stream_mode mode;
+    unsigned int key_bits;
+    uint32_t flags;
+    uint32_t chunk_size;
+    uint64_t original_length;
+    unsigned char base_iv[BLOCK_SIZE];
+} container_header;
+
+typedef struct
+{
+    uint64_t offset;        // Position of the chunk in the container
+    uint32_t plain_length;  // Plaintext bytes in the chunk
+    uint32_t stored_length; // Bytes stored, a multiple of BLOCK_SIZE
+    uint32_t generation;    // Generation of the update that last rewrote the chunk
+    uint32_t checksum;      // CRC32C of the stored bytes, with CONTAINER_FLAG_CRC32C
+} container_entry;
+
+typedef struct
+{
+    container_header header;
+    container_entry *entries;
+    uint64_t num_chunks;
+    uint64_t index_offset;
+} container_info;
+
+void container_chunk_ctx(const stream_ctx *base, const container_header *header, uint64_t index, uint32_t generation, stream_ctx *chunk_ctx);
+int container_open(int fd, const stream_ctx *ctx, container_info *info);
+void container_close(container_info *info);
+bool container_chunk_size_valid(size_t chunk_size);
+int container_encrypt(const stream_ctx *ctx, const unsigned char *base_iv, int in_fd, int out_fd, size_t chunk_size, uint32_t flags, int num_workers,
+                      container_manifest *manifest, unsigned long long *bytes_out);
+int container_update(const stream_ctx *ctx, int in_fd, int out_fd, int num_workers, const char *journal_path, container_manifest *manifest,
+                     unsigned long long *bytes_out);
+int container_recover(int fd, const char *journal_path);
+int container_decrypt(const stream_ctx *ctx, int in_fd, int out_fd, int num_workers, unsigned long long *bytes_out);
+int container_verify(int fd, unsigned long long *bad_chunks, unsigned long long *bytes_out);
+int container_decrypt_range(const stream_ctx *ctx, int in_fd, int out_fd, uint64_t offset, uint64_t length, unsigned long long *bytes_out);
+
+#endif /* CONTAINER_H */
@@ -0,0 +1,13 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC32C_POLY 0x82f63b78 // Castagnoli, reflected
+#define CRC32C_LONG 8192       // Bytes per lane of the three-way interleaved loop
+#define CRC32C_SHORT 256
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+const char *crc32c_implementation(void);
+
+#endif /* CRC32C_H */
@@ -0,0 +1,53 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+#include <stdint.h>
+#include "stream.h"
+#include "keycache.h"
+
+/*
+ * Request frame, all integers little-endian:
+ *   header (32 bytes): magic "AESQ", operation (0 encrypt, 1 decrypt), mode,
+ *                      key length (0 to use the cached key of the key id),
+ *                      reserved byte, key id, payload length, IV (16 bytes)
+ *   key:               key length bytes
+ *   payload:           payload length bytes, zero-padded to a block by the daemon
+ * Response frame:
+ *   header (16 bytes): magic "AESR", status, payload length, reserved
+ *   payload:           payload length bytes
+ */
+#define DAEMON_REQUEST_MAGIC "AESQ"
+#define DAEMON_RESPONSE_MAGIC "AESR"
+#define DAEMON_REQUEST_SIZE 32
+#define DAEMON_RESPONSE_SIZE 16
+#define DAEMON_MAX_PAYLOAD (16 << 20)
+#define DAEMON_BACKLOG 128
+#define DAEMON_RECEIVE_STEP (64 << 10) // Initial payload buffer of a connection, doubled as the payload arrives
+#define DAEMON_SEND_TIMEOUT 10          // Seconds a worker waits for a client to take its response
+
+typedef enum
+{
+    DAEMON_OK,
+    DAEMON_BAD_REQUEST,
+    DAEMON_UNKNOWN_KEY,
+    DAEMON_TOO_LARGE,
+    DAEMON_FAILED
+} daemon_status;
+
+typedef struct
+{
+    bool encrypt;
+    stream_mode mode;
+    uint32_t key_id;   // 0: the key is not cached
+    size_t key_length; // 0: use the cached key of key_id
+    unsigned char key[32];
+    unsigned char iv[BLOCK_SIZE];
+} daemon_request;
+
+daemon_status daemon_status_from_key(keycache_status status);
+int daemon_serve(const char *socket_path, int num_workers, bool verbose);
+int daemon_connect(const char *socket_path);
+int daemon_call(int fd, const daemon_request *request, const unsigned char *payload, size_t length, unsigned char **response, size_t *response_length,
+                daemon_status *status);
+int daemon_load_test(const char *socket_path, const daemon_request *request, size_t payload_size, int connections, unsigned long requests);
+
+#endif /* DAEMON_H */
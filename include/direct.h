@@ -0,0 +1,9 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+#include "stream.h"
+
+#define DIRECT_ALIGN 4096 // Buffer, offset and length alignment for O_DIRECT
+
+int direct_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out);
+
+#endif /* DIRECT_H */
@@ -0,0 +1,15 @@
+#ifndef IO_H
+#define IO_H
+#include <sys/types.h>
+
+#define IO_UNSUPPORTED 2 // The kernel or the file does not support the requested I/O method
+
+ssize_t read_full(int fd, void *buffer, size_t length);
+int write_all(int fd, const void *buffer, size_t length);
+ssize_t pread_full(int fd, void *buffer, size_t length, off_t offset);
+int pwrite_all(int fd, const void *buffer, size_t length, off_t offset);
+int vmsplice_all(int fd, void *buffer, size_t length);
+void *aligned_buffer_alloc(size_t size, size_t alignment);
+long long page_cache_kb(void);
+
+#endif /* IO_H */
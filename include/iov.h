@@ -0,0 +1,9 @@
+#ifndef IOV_H
+#define IOV_H
+#include <sys/uio.h>
+#include "stream.h"
+
+int aes_encrypt_iov(stream_ctx *ctx, const struct iovec *in, int in_count, const struct iovec *out, int out_count);
+int aes_decrypt_iov(stream_ctx *ctx, const struct iovec *in, int in_count, const struct iovec *out, int out_count);
+
+#endif /* IOV_H */
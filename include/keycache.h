@@ -0,0 +1,72 @@
+#ifndef KEYCACHE_H
+#define KEYCACHE_H
+#include <stdint.h>
+#include <pthread.h>
+#include "stream.h"
+
+#define KEYCACHE_DEFAULT_CAPACITY 1024
+
+// An expanded key schedule, stored flat so it can be copied out of the cache.
+typedef struct
+{
+    uint32_t key_id; // 0: not cached
+    size_t Nr;
+    unsigned char round_keys[AES_MAX_ROUND_KEYS + 1][BLOCK_SIZE];
+} key_schedule;
+
+typedef struct
+{
+    key_schedule schedule;
+    unsigned char key[32];
+    size_t key_length;
+    int32_t newer; // LRU list neighbours, -1 at the ends
+    int32_t older;
+    int32_t chain; // Next entry of the same hash bucket, -1 at the end
+} keycache_entry;
+
+typedef struct
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    double setup_seconds; // Time spent expanding keys
+} keycache_stats;
+
+// Key schedules by key id, bounded, least recently used evicted first.
+typedef struct
+{
+    pthread_mutex_t lock;
+    keycache_entry *entries;
+    size_t capacity;
+    size_t count;
+    int32_t *buckets;
+    size_t bucket_mask;
+    int32_t newest;
+    int32_t oldest;
+    keycache_stats stats;
+} keycache;
+
+// A key to look up: the key id, and the key bytes unless the key id is cached.
+typedef struct
+{
+    uint32_t key_id;           // 0: the key is not cached
+    const unsigned char *key;  // NULL: use the cached key of key_id
+    size_t key_length;         // 16, 24 or 32, 0 without a key
+} keycache_request;
+
+typedef enum
+{
+    KEYCACHE_OK,
+    KEYCACHE_UNKNOWN, // No key given and none cached for the key id
+    KEYCACHE_BAD_KEY
+} keycache_status;
+
+int keycache_init(keycache *cache, size_t capacity);
+void keycache_free(keycache *cache);
+keycache_status keycache_get(keycache *cache, uint32_t key_id, const unsigned char *key, size_t key_length, key_schedule *schedule);
+void keycache_get_many(keycache *cache, const keycache_request *requests, size_t count, key_schedule *schedules, keycache_status *statuses);
+void keycache_get_stats(keycache *cache, keycache_stats *stats);
+void keycache_print_stats(keycache *cache);
+void key_schedule_ctx(const key_schedule *schedule, unsigned char **round_keys, stream_mode mode, bool encrypt, const unsigned char *iv, stream_ctx *ctx);
+
+#endif /* KEYCACHE_H */
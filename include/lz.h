@@ -0,0 +1,19 @@
+#ifndef LZ_H
+#define LZ_H
+#include <stddef.h>
+
+/*
+ * Dependency-free byte-oriented LZ77 compressor in the LZ4 block format:
+ * sequences of a token (literal length, match length), literals and a
+ * 16-bit match offset; the block ends with literals only.
+ */
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // The last 5 bytes are always literals
+#define LZ_MATCH_LIMIT 12  // No match starts in the last 12 bytes
+#define LZ_MAX_OFFSET 65535
+
+size_t lz_compress(const unsigned char *in, size_t length, unsigned char *out, size_t capacity);
+int lz_decompress(const unsigned char *in, size_t length, unsigned char *out, size_t capacity, size_t *out_length);
+
+#endif /* LZ_H */
@@ -0,0 +1,32 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <stdint.h>
+#include "stream.h"
+
+/*
+ * Manifest layout, all integers little-endian:
+ *   header (40 bytes): "AESMAN1\0", chunk size, generation, number of chunks,
+ *                      base IV of the container
+ *   digests:           one 8-byte keyed digest of the plaintext of each chunk
+ */
+#define MANIFEST_MAGIC "AESMAN1"
+#define MANIFEST_HEADER_SIZE 40
+#define MANIFEST_SUFFIX ".manifest"
+
+// Per-chunk plaintext digests of a container, kept next to it.
+typedef struct
+{
+    unsigned char base_iv[BLOCK_SIZE]; // Base IV of the container described
+    uint32_t chunk_size;
+    uint32_t generation; // Generation of the chunks rewritten by the last update
+    uint64_t num_chunks;
+    uint64_t *digests;
+} container_manifest;
+
+uint64_t manifest_seed(const stream_ctx *ctx);
+uint64_t manifest_digest(const void *data, size_t length, uint64_t seed);
+int manifest_load(const char *path, container_manifest *manifest);
+int manifest_save(const char *path, const container_manifest *manifest);
+void manifest_free(container_manifest *manifest);
+
+#endif /* MANIFEST_H */
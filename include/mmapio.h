@@ -0,0 +1,7 @@
+#ifndef MMAPIO_H
+#define MMAPIO_H
+#include "stream.h"
+
+int mmap_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out);
+
+#endif /* MMAPIO_H */
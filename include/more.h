@@ -14,10 +14,14 @@ void free_blocks(unsigned char **blocks, size_t num_blocks);
 void free_blocks2(char **blocks, size_t num_blocks);
 int split_text_into_blocks(char *text, size_t text_length, unsigned char ***blocks, size_t *num_blocks);
 int concatenate_blocks(char *text, size_t *text_length, unsigned char ***blocks, size_t *num_blocks);
+FILE *open_output_file(const char *filename);
 int write_to_file(const char *filename, const char *content, size_t concatenated_text_length);
+void print_result(const char *content, size_t length);
+double monotonic_seconds(void);
 void affichage_result(int result, const char *function_name, unsigned char ***blocks, size_t *num_blocks, bool verbose, bool debug);
 unsigned char mult(unsigned char a, unsigned char b);
 void printBlocks(unsigned char **blocks, size_t num_blocks);
 int vector_init_verif(char *vector_init, int vector_lenght);
+int parse_size(const char *str, unsigned long long *size);
 
 #endif /* MORE_H */
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+#include <stdio.h>
+
+/*
+ * Hardware performance counters through perf_event_open(2), counting the
+ * calling thread and the threads it creates while they run. The counters
+ * are opened as one group, so they count over exactly the same time and
+ * ratios such as the IPC are consistent; if the processor cannot schedule
+ * the whole group at once, they are opened as separate events instead.
+ * The ones the processor, the kernel (perf_event_paranoid) or a virtual
+ * machine do not provide are left out and reported as missing. When the
+ * kernel multiplexes the counters, the counts are scaled by the time each
+ * one actually ran.
+ */
+typedef enum
+{
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_COUNT
+} perfctr_event;
+
+typedef struct
+{
+    int fds[PERFCTR_COUNT]; // -1: not available
+    int num_open;
+    int leader; // fd of the group leader, -1 when the counters are separate events
+} perfctr_set;
+
+typedef struct
+{
+    bool valid[PERFCTR_COUNT];
+    double counts[PERFCTR_COUNT];
+} perfctr_values;
+
+int perfctr_open(perfctr_set *set);
+void perfctr_close(perfctr_set *set);
+void perfctr_start(perfctr_set *set);
+void perfctr_stop(perfctr_set *set, perfctr_values *values);
+void perfctr_print(FILE *file, const char *label, const perfctr_values *values, unsigned long long bytes);
+void perfctr_print_json(FILE *file, const perfctr_values *values, unsigned long long bytes);
+
+#endif /* PERFCTR_H */
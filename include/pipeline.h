@@ -0,0 +1,9 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "stream.h"
+
+#define PIPELINE_MAX_WORKERS 64
+
+int pipeline_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, int num_workers, unsigned long long *bytes_out);
+
+#endif /* PIPELINE_H */
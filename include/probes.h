@@ -0,0 +1,88 @@
+#ifndef PROBES_H
+#define PROBES_H
+#include <stdint.h>
+
+/*
+ * USDT (SystemTap SDT) tracepoints, provider "aes", for bpftrace, perf and
+ * SystemTap on a running process. A probe is one nop in the code plus an
+ * ELF note (.note.stapsdt) giving the tracer its address and where its
+ * arguments are; nothing runs until a tracer attaches. Every argument is a
+ * 64-bit unsigned integer.
+ *
+ *   chunk_start(engine, mode, bytes)   chunk_end(engine, mode, bytes)
+ *   key_setup_start(engine, key_bits)  key_setup_end(engine, key_bits)
+ *   io_submit(engine, op, bytes)       io_complete(engine, op, bytes)
+ *   job_queue(engine, bytes)           job_dequeue(engine, bytes)
+ *
+ * mode is a stream_mode, op is AES_IO_READ or AES_IO_WRITE and
+ * io_complete carries the bytes transferred (0 on failure).
+ * `readelf -n AES` lists the probes, for example
+ *   bpftrace -e 'usdt:./AES:aes:chunk_start { @start[tid] = nsecs; }
+ *                usdt:./AES:aes:chunk_end /@start[tid]/ { @ns[arg0] = hist(nsecs - @start[tid]); }'
+ * The notes come from <sys/sdt.h> when it is installed and are written
+ * directly on x86-64 ELF otherwise; -DAES_NO_PROBES leaves them out.
+ */
+typedef enum
+{
+    AES_ENGINE_BLOCKS,    // The block arrays of the default whole-file path
+    AES_ENGINE_STREAM,    // stream_file
+    AES_ENGINE_MMAP,      // mmap_process
+    AES_ENGINE_URING,     // uring_process
+    AES_ENGINE_DIRECT,    // direct_process
+    AES_ENGINE_PIPELINE,  // pipeline_process
+    AES_ENGINE_CONTAINER, // Container workers
+    AES_ENGINE_DAEMON,    // Socket daemon workers
+    AES_ENGINE_SHM,       // Shared memory workers
+    AES_ENGINE_ASYNC,     // aes_submit and aes_batch
+    AES_ENGINE_KEYCACHE,  // Key schedules expanded by the key cache
+    AES_ENGINE_IO         // read_full, write_all, pread_full, pwrite_all
+} aes_engine;
+
+#define AES_IO_READ 0
+#define AES_IO_WRITE 1
+
+#if !defined(AES_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AES_PROBE2(name, a, b) STAP_PROBE2(aes, name, (uint64_t)(a), (uint64_t)(b))
+#define AES_PROBE3(name, a, b, c) STAP_PROBE3(aes, name, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c))
+#define AES_PROBES_SDT
+#endif
+#endif
+
+#if !defined(AES_PROBES_SDT) && !defined(AES_NO_PROBES) && defined(__x86_64__) && defined(__ELF__)
+// The layout of <sys/sdt.h>: note name "stapsdt", type 3, then the probe
+// address, the .stapsdt.base address (for prelink), no semaphore, the
+// provider, the probe name and the argument locations as "size@operand".
+#define AES_PROBE_ASM(name, args)                                              \
+    "990: nop\n"                                                               \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                              \
+    ".balign 4\n"                                                              \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                         \
+    "991: .asciz \"stapsdt\"\n"                                                \
+    "992: .balign 4\n"                                                         \
+    "993: .8byte 990b\n"                                                       \
+    ".8byte _.stapsdt.base\n"                                                  \
+    ".8byte 0\n"                                                               \
+    ".asciz \"aes\"\n"                                                         \
+    ".asciz \"" #name "\"\n"                                                   \
+    ".asciz \"" args "\"\n"                                                    \
+    "994: .balign 4\n"                                                         \
+    ".popsection\n"                                                            \
+    ".ifndef _.stapsdt.base\n"                                                 \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"   \
+    ".weak _.stapsdt.base\n"                                                   \
+    ".hidden _.stapsdt.base\n"                                                 \
+    "_.stapsdt.base: .space 1\n"                                               \
+    ".size _.stapsdt.base, 1\n"                                                \
+    ".popsection\n"                                                            \
+    ".endif\n"
+#define AES_PROBE2(name, a, b) __asm__ __volatile__(AES_PROBE_ASM(name, "8@%0 8@%1")::"nor"((uint64_t)(a)), "nor"((uint64_t)(b)))
+#define AES_PROBE3(name, a, b, c) \
+    __asm__ __volatile__(AES_PROBE_ASM(name, "8@%0 8@%1 8@%2")::"nor"((uint64_t)(a)), "nor"((uint64_t)(b)), "nor"((uint64_t)(c)))
+#elif !defined(AES_PROBES_SDT)
+#define AES_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define AES_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif /* PROBES_H */
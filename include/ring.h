@@ -0,0 +1,52 @@
+#ifndef RING_H
+#define RING_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+#define RING_SPINS 64 // Polls of a full or empty ring before sleeping on its futex
+
+// A futex word bumped on each signal, and the number of threads sleeping on it.
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t sleepers;
+} ring_event;
+
+// Single-producer single-consumer ring of pointers, lock-free.
+typedef struct
+{
+    void **slots;
+    size_t mask;
+    _Alignas(RING_CACHE_LINE) size_t head; // Next slot to pop, written by the consumer
+    ring_event not_full;                   // Signalled by the consumer, waited on by the producer
+    _Alignas(RING_CACHE_LINE) size_t tail; // Next slot to push, written by the producer
+    ring_event not_empty;                  // Signalled by the producer, waited on by the consumer
+} spsc_ring;
+
+// Bounded multi-producer multi-consumer ring of pointers, lock-free (Vyukov's algorithm).
+typedef struct
+{
+    struct mpmc_cell
+    {
+        size_t sequence;
+        void *item;
+    } *cells;
+    size_t mask;
+    _Alignas(RING_CACHE_LINE) size_t enqueue;
+    _Alignas(RING_CACHE_LINE) size_t dequeue;
+} mpmc_ring;
+
+int spsc_init(spsc_ring *ring, size_t capacity);
+void spsc_free(spsc_ring *ring);
+bool spsc_try_push(spsc_ring *ring, void *item);
+bool spsc_try_pop(spsc_ring *ring, void **item);
+void spsc_push(spsc_ring *ring, void *item);
+void *spsc_pop(spsc_ring *ring);
+int mpmc_init(mpmc_ring *ring, size_t capacity);
+void mpmc_free(mpmc_ring *ring);
+bool mpmc_try_push(mpmc_ring *ring, void *item);
+bool mpmc_try_pop(mpmc_ring *ring, void **item);
+
+#endif /* RING_H */
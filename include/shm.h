@@ -0,0 +1,37 @@
+#ifndef SHM_H
+#define SHM_H
+#include <stdint.h>
+#include "daemon.h"
+
+/*
+ * Shared-memory transport to a local encryption service. The region
+ * /dev/shm/<name> holds SHM_SLOTS payload slots of SHM_SLOT_SIZE bytes and
+ * two lock-free multi-producer multi-consumer rings of slot numbers: the
+ * free slots and the submitted ones. A client takes a free slot, writes its
+ * payload and request into it, submits the slot and waits on its state; a
+ * worker encrypts the payload in place and marks the slot done. The payload
+ * never goes through the kernel, and futexes are only used to sleep when a
+ * ring or a slot stays idle.
+ */
+#define SHM_MAGIC "AESSHM1"
+#define SHM_SLOTS 256 // A power of 2
+#define SHM_SLOT_SIZE (64 << 10)
+#define SHM_ACQUIRE_TIMEOUT 30 // Seconds shm_acquire waits for a free slot
+
+typedef struct shm_region shm_region;
+
+typedef struct
+{
+    shm_region *region;
+    size_t size;
+} shm_client;
+
+int shm_serve(const char *name, int num_workers, bool verbose);
+int shm_attach(const char *name, shm_client *client);
+void shm_detach(shm_client *client);
+int shm_acquire(shm_client *client, unsigned char **payload);
+int shm_submit_wait(shm_client *client, int slot, const daemon_request *request, size_t length, size_t *result_length, daemon_status *status);
+void shm_release(shm_client *client, int slot);
+int shm_load_test(const char *name, const daemon_request *request, size_t payload_size, int clients, unsigned long requests);
+
+#endif /* SHM_H */
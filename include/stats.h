@@ -0,0 +1,28 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+
+/*
+ * Per-stage statistics of a run (--stats, --stats-json). Each stage
+ * accumulates its calls, monotonic time and bytes, from any thread. The
+ * stages are recorded once per call or per chunk, never per block, and
+ * stats_begin only tests a flag while statistics are off. The report is
+ * printed when the program exits.
+ */
+typedef enum
+{
+    STATS_READ,        // file_parser, or the reads of a streamed run
+    STATS_SPLIT,       // split_text_into_blocks
+    STATS_KEY_SETUP,   // key_setup and KeyExpansion
+    STATS_CIPHER,      // The mode loop
+    STATS_CONCATENATE, // concatenate_blocks
+    STATS_WRITE,       // write_to_file, or the writes of a streamed run
+    STATS_STAGES
+} stats_stage;
+
+void stats_enable(bool summary, const char *json_file);
+double stats_begin(void);
+void stats_end(stats_stage stage, double start, unsigned long long bytes);
+void stats_set_threads(int threads);
+
+#endif /* STATS_H */
@@ -0,0 +1,32 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include "more.h"
+
+#define STREAM_DEFAULT_CHUNK (1 << 20) // 1 MiB
+#define STREAM_BATCH_BLOCKS 256        // Blocks handed to a mode function at once
+
+typedef enum
+{
+    STREAM_ECB,
+    STREAM_CBC,
+    STREAM_CFB,
+    STREAM_CTR
+} stream_mode;
+
+typedef struct
+{
+    stream_mode mode;
+    bool encrypt;
+    unsigned char **round_keys;
+    size_t Nr;
+    unsigned char chain[BLOCK_SIZE]; // IV, previous ciphertext block or next counter block
+} stream_ctx;
+
+int stream_mode_from_name(const char *name, stream_mode *mode);
+int stream_init(stream_ctx *ctx, const char *mode, bool encrypt, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init);
+int stream_update(stream_ctx *ctx, const unsigned char *in, unsigned char *out, size_t length);
+bool stream_is_parallel(const stream_ctx *ctx);
+void stream_skip(stream_ctx *ctx, const unsigned char *in, size_t length);
+int stream_file(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out);
+
+#endif /* STREAM_H */
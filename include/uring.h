@@ -0,0 +1,9 @@
+#ifndef URING_H
+#define URING_H
+#include "stream.h"
+
+#define URING_BUFFERS 8 // Chunks in flight (reads, encryptions and writes together)
+
+int uring_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out);
+
+#endif /* URING_H */
@@ -6,26 +6,77 @@
 #include <ctype.h>
 #include <time.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../include/AES.h"
 #include "../include/ECB.h"
 #include "../include/CBC.h"
 #include "../include/CFB.h"
+#include "../include/CTR.h"
+#include "../include/DRBG.h"
+#include "../include/stream.h"
+#include "../include/mmapio.h"
+#include "../include/uring.h"
+#include "../include/direct.h"
+#include "../include/pipeline.h"
+#include "../include/container.h"
+#include "../include/crc32c.h"
+#include "../include/aesfile.h"
+#include "../include/appendlog.h"
+#include "../include/checkpoint.h"
+#include "../include/batch.h"
+#include "../include/daemon.h"
+#include "../include/shm.h"
+#include "../include/bench.h"
+#include "../include/perfctr.h"
+#include "../include/stats.h"
+#include "../include/probes.h"
+#include "../include/io.h"
 #include "../include/more.h"
 
 void fhelp()
 {
     printf("Usage: ./AES -i <file_name> -m <mode> [-d | -c] -k <key> [option]\n");
     printf("Options:\n");
-    printf("  -i, --input <file_name>    Input file containing the text to be encrypted or decrypted.\n");
-    printf("  -m, --mode <mode>          Encryption/Decryption mode (ECB, CBC, CFB).\n");
+    printf("  -i, --input <file_name>    Input file containing the text to be encrypted or decrypted (- for stdin).\n");
+    printf("  -m, --mode <mode>          Encryption/Decryption mode (ECB, CBC, CFB, CTR).\n");
     printf("  -d, --decrypt              Decrypt the input text.\n");
     printf("  -c, --encrypt              Encrypt the input text.\n");
     printf("  -k, --key <key>            Encryption/Decryption key.\n");
-    printf("  -o, --output <file_name>   Write the output to the specified file.\n");
+    printf("  -o, --output <file_name>   Write the output to the specified file (- for stdout).\n");
     printf("  -v, --verbose              Verbose mode.\n");
     printf("  -b, --debug                Full Verbose mode, only for debug.\n");
+    printf("  -q, --quiet                Do not print the result on the console.\n");
     printf("  -t, --time <number>        The test program, add the number of times you want to perform the test.\n");
     printf("  -n, --init <init vector>   The initialization vector, then give it.\n");
+    printf("  -r, --random <bytes>       Write <bytes> bytes from the AES CTR_DRBG to the output (K, M, G suffixes allowed).\n");
+    printf("  -e, --seed <hex seed>      Seed the CTR_DRBG for a deterministic output (up to 96 hexadecimal characters).\n");
+    printf("  -s, --stream <chunk size>  Process the file chunk by chunk with constant memory (e.g. 1M).\n");
+    printf("  -p, --mmap                 Memory-map the input and output files (falls back to streaming otherwise).\n");
+    printf("  -u, --uring                Use io_uring with several reads and writes in flight (falls back to read/write).\n");
+    printf("  -D, --direct               Bypass the page cache with O_DIRECT and 4 KiB aligned buffers.\n");
+    printf("  -j, --threads <number>     Stream through a reader / cipher workers / writer pipeline.\n");
+    printf("  -C, --container            Write or read a container of independently encrypted chunks (parallel CBC/CFB, seekable).\n");
+    printf("  -Z, --compress             Compress each chunk of a container before encrypting it (implies -C).\n");
+    printf("  -V, --verify               Check the chunk checksums of the container -i without the key and list the bad chunks.\n");
+    printf("  -R, --range <off>:<len>    Decrypt only <len> bytes from <off> (of a container with -C).\n");
+    printf("  -I, --incremental          Re-encrypt into the container -o only the chunks that changed since the last run.\n");
+    printf("  -K, --checkpoint <bytes>   Save a resumable checkpoint to <output>.journal every <bytes> (default 256M).\n");
+    printf("  -S, --resume               Continue an interrupted job from <output>.journal.\n");
+    printf("  -B, --batch <list | dir>   Process every \"input<TAB>output\" line of <list>, or every file under <dir> into -o.\n");
+    printf("  -L, --serve <socket>       Run as a daemon serving encryption requests on a Unix socket (-j workers).\n");
+    printf("  -Q, --client <socket>      Send the input file to the daemon and write its answer.\n");
+    printf("  -T, --load-test <socket>   Load test the daemon: -j connections, -t requests each, -s bytes per request.\n");
+    printf("  -Y, --key-id <id>          Key id under which the daemon caches the key schedule (without -k, use the cached key).\n");
+    printf("  -H, --shm-serve <name>     Run the daemon on a shared memory region /dev/shm/<name> instead of a socket.\n");
+    printf("  -G, --shm-client <name>    Like --client, through the shared memory region <name>.\n");
+    printf("  -W, --shm-load-test <name> Like --load-test, through the shared memory region <name>.\n");
+    printf("  -A, --append               Append the input to an encrypted log (-o), or decrypt a log with -d.\n");
+    printf("  -X, --bench                Benchmark the engines in memory (-m one mode, -s largest input, -t samples, -o JSON file).\n");
+    printf("  -P, --perf                 Report hardware counters (cycles, instructions, cache and branch misses) per byte.\n");
+    printf("      --stats                Print the time and bytes of each stage, the throughput, peak memory and thread use.\n");
+    printf("      --stats-json <file>    Write the same statistics as JSON to <file> (- for stdout).\n");
     printf("  -h, --help                 Display this help message.\n");
 }
 
@@ -591,6 +642,79 @@ int getRoundKeys(uint32_t *expandedKey, int num_round_keys, unsigned char ***rou
     return 0;
 }
 
+/**
+ * @brief Build the round keys for a key given in hexadecimal.
+ *
+ * This function picks the number of rounds from the key size, then runs
+ * KeyExpansion and getRoundKeys.
+ *
+ * @param key               The key in hexadecimal (32, 48 or 64 characters).
+ * @param round_keys        Pointer to the array of pointers where the round keys will be stored.
+ * @param num_round_keys    Pointer to store the number of round keys (the Nr of AES_cipher).
+ * @return 0 on success, -1 on failure.
+ */
+int key_setup(const char *key, unsigned char ***round_keys, size_t *num_round_keys)
+{
+    int nk;
+    int rounds;
+    switch (strlen(key) * 4)
+    {
+    case 128:
+        rounds = 10;
+        nk = 4;
+        break;
+    case 192:
+        rounds = 12;
+        nk = 6;
+        break;
+    case 256:
+        rounds = 14;
+        nk = 8;
+        break;
+    default:
+        printf("Unsupported key size!\n");
+        return -1;
+    }
+
+    AES_PROBE2(key_setup_start, AES_ENGINE_BLOCKS, nk * 32);
+    uint32_t expandedKey[(AES_MAX_ROUND_KEYS + 1) * 4];
+    KeyExpansion((uint8_t *)key, expandedKey, nk, rounds);
+    if (getRoundKeys(expandedKey, rounds + 1, round_keys) != 0)
+    {
+        return -1;
+    }
+    *num_round_keys = rounds + 1;
+    AES_PROBE2(key_setup_end, AES_ENGINE_BLOCKS, nk * 32);
+    return 0;
+}
+
+/**
+ * @brief Build the round keys for a binary key.
+ *
+ * @param key               The key bytes.
+ * @param key_bytes         The key size in bytes (16, 24 or 32).
+ * @param round_keys        Pointer to the array of pointers where the round keys will be stored.
+ * @param num_round_keys    Pointer to store the number of round keys.
+ * @return 0 on success, -1 on failure.
+ */
+int key_setup_bytes(const uint8_t *key, size_t key_bytes, unsigned char ***round_keys, size_t *num_round_keys)
+{
+    static const char hex[] = "0123456789abcdef";
+    char hex_key[2 * 32 + 1];
+    if (key_bytes != 16 && key_bytes != 24 && key_bytes != 32)
+    {
+        printf("Unsupported key size!\n");
+        return -1;
+    }
+    for (size_t i = 0; i < key_bytes; i++)
+    {
+        hex_key[2 * i] = hex[key[i] >> 4];
+        hex_key[2 * i + 1] = hex[key[i] & 0x0f];
+    }
+    hex_key[2 * key_bytes] = '\0';
+    return key_setup(hex_key, round_keys, num_round_keys);
+}
+
 /**
  * @brief Perform one round of AES encryption on the given blocks.
  *
@@ -652,6 +776,341 @@ int AES_decipher(unsigned char *block, unsigned char **roundkey, unsigned char *
     return 0;
 }
 
+/**
+ * @brief Finishes or rolls back an interrupted update of a container before it is read.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int recover_container(const char *container_file)
+{
+    char journal_file[strlen(container_file) + sizeof(CONTAINER_JOURNAL_SUFFIX)];
+    snprintf(journal_file, sizeof(journal_file), "%s%s", container_file, CONTAINER_JOURNAL_SUFFIX);
+    if (strcmp(container_file, "-") == 0 || access(journal_file, F_OK) != 0)
+    {
+        return EXIT_SUCCESS;
+    }
+    int fd = open(container_file, O_RDWR);
+    int result = fd >= 0 ? container_recover(fd, journal_file) : EXIT_FAILURE;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    else
+    {
+        fprintf(stderr, "Failed to open the file %s to recover its interrupted update.\n", container_file);
+    }
+    return result;
+}
+
+/**
+ * @brief Scans a container and checks the CRC32C of every chunk, reporting the bad ones.
+ *
+ * @return EXIT_SUCCESS if every chunk is intact, EXIT_FAILURE otherwise.
+ */
+static int verify_main(const char *input_file)
+{
+    if (recover_container(input_file) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    int in_fd = strcmp(input_file, "-") == 0 ? STDIN_FILENO : open(input_file, O_RDONLY);
+    if (in_fd < 0)
+    {
+        fprintf(stderr, "Failed to open the input file.\n");
+        return EXIT_FAILURE;
+    }
+    unsigned long long bad_chunks = 0;
+    unsigned long long bytes = 0;
+    double start = monotonic_seconds();
+    int result = container_verify(in_fd, &bad_chunks, &bytes);
+    double elapsed = monotonic_seconds() - start;
+    if (in_fd != STDIN_FILENO)
+    {
+        close(in_fd);
+    }
+    if (result == IO_UNSUPPORTED)
+    {
+        fprintf(stderr, "The container has no chunk checksums.\n");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Verified %llu bytes in %f seconds (%.1f MB/s, CRC32C %s): %llu bad chunk%s\n", bytes, elapsed,
+            elapsed > 0 ? bytes / elapsed / 1e6 : 0.0, crc32c_implementation(), bad_chunks, bad_chunks == 1 ? "" : "s");
+    return result == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief One request through the shared memory service: the input is read straight into a slot.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int shm_client_main(const char *name, const daemon_request *request, const char *input_file, const char *output_file)
+{
+    shm_client client;
+    if (shm_attach(name, &client) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    unsigned char *payload;
+    int slot = shm_acquire(&client, &payload);
+    if (slot < 0)
+    {
+        fprintf(stderr, "No free slot: the shared memory service is gone or all its slots are held.\n");
+        shm_detach(&client);
+        return EXIT_FAILURE;
+    }
+    int in_fd = strcmp(input_file, "-") == 0 ? STDIN_FILENO : open(input_file, O_RDONLY);
+    ssize_t length = in_fd >= 0 ? read_full(in_fd, payload, SHM_SLOT_SIZE) : -1;
+    unsigned char extra;
+    if (length == SHM_SLOT_SIZE && read_full(in_fd, &extra, 1) != 0)
+    {
+        length = -1;
+    }
+    if (in_fd > STDIN_FILENO)
+    {
+        close(in_fd);
+    }
+    int result = EXIT_FAILURE;
+    size_t result_length = 0;
+    daemon_status status = DAEMON_FAILED;
+    if (length < 0)
+    {
+        fprintf(stderr, "Failed to read the input, or it is larger than %d bytes.\n", SHM_SLOT_SIZE);
+    }
+    else if (shm_submit_wait(&client, slot, request, (size_t)length, &result_length, &status) != EXIT_SUCCESS || status != DAEMON_OK)
+    {
+        fprintf(stderr, "The shared memory request failed (status %d).\n", (int)status);
+    }
+    else
+    {
+        FILE *out_file = output_file == NULL || strcmp(output_file, "-") == 0 ? stdout : open_output_file(output_file);
+        result = out_file != NULL && write_all(fileno(out_file), payload, result_length) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (out_file != NULL && out_file != stdout)
+        {
+            fclose(out_file);
+        }
+    }
+    shm_release(&client, slot);
+    shm_detach(&client);
+    return result;
+}
+
+/**
+ * @brief Client side of the daemon: one request with the input file, or a load test.
+ *
+ * The key is sent with the request (and cached by the daemon under key_id
+ * if it is not 0); with a key id and no key, the daemon uses the key it has
+ * cached under that id. The IV follows the same convention as the other modes.
+ * The shm names select the shared memory transport instead of the socket.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int daemon_client_main(const char *client_socket, const char *load_socket, const char *shm_client_name, const char *shm_load_name,
+                              const char *input_file, const char *output_file, const char *mode,
+                              bool encrypt, char *key, char *vector_init, uint32_t key_id, size_t payload_size, int connections, unsigned long requests)
+{
+    daemon_request request;
+    memset(&request, 0, sizeof(request));
+    if (mode == NULL || stream_mode_from_name(mode, &request.mode) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Missing or invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+    if (key == NULL && key_id == 0)
+    {
+        key = DEFAULT_KEY_128;
+    }
+    if (key != NULL && key_verif(key, strlen(key) * 4) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Failed to verify the encryption/decryption key.\n");
+        return EXIT_FAILURE;
+    }
+    request.encrypt = encrypt;
+    request.key_id = key_id;
+    request.key_length = key != NULL ? strlen(key) / 2 : 0; // 0: the cached key of key_id
+    for (size_t i = 0; i < request.key_length; i++)
+    {
+        request.key[i] = (unsigned char)(char_to_hex(key[2 * i]) << 4 | char_to_hex(key[2 * i + 1]));
+    }
+    if (request.mode != STREAM_ECB)
+    {
+        if (vector_init == NULL)
+        {
+            vector_init = DEFAULT_VECTOR_128;
+        }
+        if (vector_init_verif(vector_init, strlen(vector_init) * 4) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Failed to verify the vector input.\n");
+            return EXIT_FAILURE;
+        }
+        memcpy(request.iv, vector_init, BLOCK_SIZE);
+    }
+    if (load_socket != NULL)
+    {
+        return daemon_load_test(load_socket, &request, payload_size, connections, requests > 0 ? requests : 1);
+    }
+    if (shm_load_name != NULL)
+    {
+        return shm_load_test(shm_load_name, &request, payload_size, connections, requests > 0 ? requests : 1);
+    }
+
+    if (input_file == NULL)
+    {
+        fprintf(stderr, "Missing or invalid arguments.\n");
+        return EXIT_FAILURE;
+    }
+    if (shm_client_name != NULL)
+    {
+        return shm_client_main(shm_client_name, &request, input_file, output_file);
+    }
+    int in_fd = strcmp(input_file, "-") == 0 ? STDIN_FILENO : open(input_file, O_RDONLY);
+    unsigned char *payload = (unsigned char *)malloc(DAEMON_MAX_PAYLOAD + 1);
+    ssize_t length = in_fd >= 0 && payload != NULL ? read_full(in_fd, payload, DAEMON_MAX_PAYLOAD + 1) : -1;
+    if (in_fd > STDIN_FILENO)
+    {
+        close(in_fd);
+    }
+    if (length < 0 || length > DAEMON_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "Failed to read the input, or it is larger than %d bytes.\n", DAEMON_MAX_PAYLOAD);
+        free(payload);
+        return EXIT_FAILURE;
+    }
+    int fd = daemon_connect(client_socket);
+    unsigned char *response = NULL;
+    size_t response_length = 0;
+    daemon_status status = DAEMON_FAILED;
+    int result = fd >= 0 ? daemon_call(fd, &request, payload, (size_t)length, &response, &response_length, &status) : EXIT_FAILURE;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(payload);
+    if (result != EXIT_SUCCESS || status != DAEMON_OK)
+    {
+        fprintf(stderr, "The daemon request failed (status %d).\n", result == EXIT_SUCCESS ? (int)status : -1);
+        free(response);
+        return EXIT_FAILURE;
+    }
+    FILE *out_file = output_file == NULL || strcmp(output_file, "-") == 0 ? stdout : open_output_file(output_file);
+    result = out_file != NULL && write_all(fileno(out_file), response, response_length) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (out_file != NULL && out_file != stdout)
+    {
+        fclose(out_file);
+    }
+    free(response);
+    return result;
+}
+
+/**
+ * @brief Brings a container up to date with its plaintext, rewriting only the changed chunks.
+ *
+ * The chunk digests of the last run are kept in <container>.manifest. Without
+ * a manifest matching the container, the whole file is encrypted again with
+ * the given flags and a new manifest is written. That is done under the base
+ * IV of ctx only if the output is empty: over an existing container, the same
+ * base IV would give the new chunks the IVs or counters of the old ones, so a
+ * fresh random base IV is drawn. An update interrupted before is finished or
+ * rolled back first, from <container>.update.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int incremental_encrypt(const stream_ctx *ctx, int in_fd, int out_fd, const char *container_file, size_t chunk_size, uint32_t flags, int workers,
+                               bool verbose, unsigned long long *bytes_out)
+{
+    char manifest_file[strlen(container_file) + sizeof(MANIFEST_SUFFIX)];
+    char journal_file[strlen(container_file) + sizeof(CONTAINER_JOURNAL_SUFFIX)];
+    snprintf(manifest_file, sizeof(manifest_file), "%s%s", container_file, MANIFEST_SUFFIX);
+    snprintf(journal_file, sizeof(journal_file), "%s%s", container_file, CONTAINER_JOURNAL_SUFFIX);
+    if (container_recover(out_fd, journal_file) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    container_manifest manifest;
+    int result = IO_UNSUPPORTED;
+    if (manifest_load(manifest_file, &manifest) == EXIT_SUCCESS)
+    {
+        result = container_update(ctx, in_fd, out_fd, workers, journal_file, &manifest, bytes_out);
+        if (result == EXIT_SUCCESS && verbose)
+        {
+            fprintf(stderr, "Rewrote %llu bytes of changed chunks.\n", *bytes_out);
+        }
+    }
+    if (result == IO_UNSUPPORTED)
+    {
+        unsigned char base_iv[BLOCK_SIZE];
+        struct stat out_st;
+        memcpy(base_iv, ctx->chain, BLOCK_SIZE);
+        if (fstat(out_fd, &out_st) != 0 || (out_st.st_size > 0 && drbg_random_bytes(base_iv, BLOCK_SIZE) != EXIT_SUCCESS))
+        {
+            fprintf(stderr, "Failed to generate the base IV.\n");
+            return EXIT_FAILURE;
+        }
+        if (verbose)
+        {
+            fprintf(stderr, "No manifest matches %s, encrypting the whole file%s.\n", container_file,
+                    out_st.st_size > 0 ? " under a new base IV" : "");
+        }
+        result = container_encrypt(ctx, base_iv, in_fd, out_fd, chunk_size, flags, workers, &manifest, bytes_out);
+    }
+    if (result == EXIT_SUCCESS)
+    {
+        result = manifest_save(manifest_file, &manifest);
+    }
+    manifest_free(&manifest);
+    return result;
+}
+
+/**
+ * @brief Decrypts a byte range of a bare encrypted file with aes_pread.
+ *
+ * Only the blocks covering the range are read and decrypted.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int range_decrypt(int in_fd, int out_fd, const char *mode, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init,
+                         unsigned long long offset, unsigned long long length, unsigned long long *bytes_out)
+{
+    int fd = dup(in_fd);
+    aes_file *file = fd < 0 ? NULL : aes_file_fdopen(fd, mode, round_keys, Nr, vector_init);
+    if (file == NULL)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    unsigned char *buffer = (unsigned char *)malloc(STREAM_DEFAULT_CHUNK);
+    int result = buffer != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    *bytes_out = 0;
+    while (result == EXIT_SUCCESS && length > 0)
+    {
+        size_t want = length < STREAM_DEFAULT_CHUNK ? (size_t)length : STREAM_DEFAULT_CHUNK;
+        ssize_t n = aes_pread(file, buffer, want, (off_t)offset);
+        if (n < 0 || write_all(out_fd, buffer, (size_t)n) != 0)
+        {
+            result = EXIT_FAILURE;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        offset += (unsigned long long)n;
+        length -= (unsigned long long)n;
+        *bytes_out += (unsigned long long)n;
+    }
+    free(buffer);
+    aes_file_close(file);
+    return result;
+}
+
+// Long options without a short form
+enum
+{
+    OPTION_STATS = 256,
+    OPTION_STATS_JSON
+};
+
 int main(int argc, char *argv[])
 {
     clock_t start, end;
@@ -673,8 +1132,43 @@ int main(int argc, char *argv[])
     bool debug = false;
     bool time_flag = false;
     int t = 1;
+    unsigned long long random_bytes = 0;
+    bool random_flag = false;
+    char *seed = NULL;
+    bool stream_flag = false;
+    bool mmap_flag = false;
+    bool uring_flag = false;
+    bool direct_flag = false;
+    int num_threads = 0;
+    bool container_flag = false;
+    uint32_t container_flags = 0;
+    bool verify_flag = false;
+    bool bench_flag = false;
+    bool perf_flag = false;
+    bool stats_flag = false;
+    char *stats_json = NULL;
+    perfctr_set counters;
+    perfctr_values counter_values;
+    bool range_flag = false;
+    bool append_flag = false;
+    bool incremental_flag = false;
+    bool checkpoint_flag = false;
+    char *batch_list = NULL;
+    char *serve_socket = NULL;
+    char *client_socket = NULL;
+    char *load_socket = NULL;
+    char *shm_serve_name = NULL;
+    char *shm_client_name = NULL;
+    char *shm_load_name = NULL;
+    unsigned long key_id = 0;
+    bool resume = false;
+    unsigned long long checkpoint_interval = CHECKPOINT_DEFAULT_INTERVAL;
+    unsigned long long range_offset = 0;
+    unsigned long long range_length = 0;
+    bool quiet = false;
+    unsigned long long chunk_size = STREAM_DEFAULT_CHUNK;
 
-    const char *const short_opts = "i:m:k:o:cdvbht:n:";
+    const char *const short_opts = "i:m:k:o:cdvbqht:n:r:e:s:puDj:CR:AIK:SB:L:Q:T:Y:H:G:W:ZVXP";
     const struct option long_opts[] = {
         {"input", required_argument, 0, 'i'},
         {"mode", required_argument, 0, 'm'},
@@ -684,8 +1178,36 @@ int main(int argc, char *argv[])
         {"decrypt", no_argument, 0, 'd'},
         {"verbose", no_argument, 0, 'v'},
         {"debug", no_argument, 0, 'b'},
+        {"quiet", no_argument, 0, 'q'},
         {"time", required_argument, 0, 't'},
         {"init", required_argument, 0, 'n'},
+        {"random", required_argument, 0, 'r'},
+        {"seed", required_argument, 0, 'e'},
+        {"stream", required_argument, 0, 's'},
+        {"mmap", no_argument, 0, 'p'},
+        {"uring", no_argument, 0, 'u'},
+        {"direct", no_argument, 0, 'D'},
+        {"threads", required_argument, 0, 'j'},
+        {"container", no_argument, 0, 'C'},
+        {"compress", no_argument, 0, 'Z'},
+        {"verify", no_argument, 0, 'V'},
+        {"bench", no_argument, 0, 'X'},
+        {"perf", no_argument, 0, 'P'},
+        {"stats", no_argument, 0, OPTION_STATS},
+        {"stats-json", required_argument, 0, OPTION_STATS_JSON},
+        {"range", required_argument, 0, 'R'},
+        {"append", no_argument, 0, 'A'},
+        {"incremental", no_argument, 0, 'I'},
+        {"checkpoint", required_argument, 0, 'K'},
+        {"resume", no_argument, 0, 'S'},
+        {"batch", required_argument, 0, 'B'},
+        {"serve", required_argument, 0, 'L'},
+        {"client", required_argument, 0, 'Q'},
+        {"load-test", required_argument, 0, 'T'},
+        {"key-id", required_argument, 0, 'Y'},
+        {"shm-serve", required_argument, 0, 'H'},
+        {"shm-client", required_argument, 0, 'G'},
+        {"shm-load-test", required_argument, 0, 'W'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}};
 
@@ -718,6 +1240,9 @@ int main(int argc, char *argv[])
         case 'b':
             debug = true;
             break;
+        case 'q':
+            quiet = true;
+            break;
         case 't':
             t = atoi(optarg);
             time_flag = true;
@@ -725,6 +1250,129 @@ int main(int argc, char *argv[])
         case 'n':
             vector_init = optarg;
             break;
+        case 'r':
+            if (parse_size(optarg, &random_bytes) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Invalid number of random bytes: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            random_flag = true;
+            break;
+        case 'e':
+            seed = optarg;
+            break;
+        case 's':
+            if (parse_size(optarg, &chunk_size) != EXIT_SUCCESS || chunk_size == 0 || chunk_size > SIZE_MAX / 2)
+            {
+                fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            stream_flag = true;
+            break;
+        case 'p':
+            mmap_flag = true;
+            break;
+        case 'u':
+            uring_flag = true;
+            break;
+        case 'D':
+            direct_flag = true;
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            if (num_threads < 1 || num_threads > PIPELINE_MAX_WORKERS)
+            {
+                fprintf(stderr, "The number of threads must be between 1 and %d.\n", PIPELINE_MAX_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            container_flag = true;
+            break;
+        case 'Z':
+            container_flag = true;
+            container_flags |= CONTAINER_FLAG_COMPRESSED;
+            break;
+        case 'V':
+            verify_flag = true;
+            break;
+        case 'X':
+            bench_flag = true;
+            break;
+        case 'P':
+            perf_flag = true;
+            break;
+        case OPTION_STATS:
+            stats_flag = true;
+            break;
+        case OPTION_STATS_JSON:
+            stats_json = optarg;
+            break;
+        case 'R':
+        {
+            char *separator = strchr(optarg, ':');
+            if (separator == NULL)
+            {
+                fprintf(stderr, "Invalid range: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            *separator = '\0';
+            if (parse_size(optarg, &range_offset) != EXIT_SUCCESS || parse_size(separator + 1, &range_length) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Invalid range: %s:%s\n", optarg, separator + 1);
+                exit(EXIT_FAILURE);
+            }
+            range_flag = true;
+            break;
+        }
+        case 'A':
+            append_flag = true;
+            break;
+        case 'I':
+            incremental_flag = true;
+            container_flag = true;
+            break;
+        case 'K':
+            if (parse_size(optarg, &checkpoint_interval) != EXIT_SUCCESS || checkpoint_interval == 0)
+            {
+                fprintf(stderr, "Invalid checkpoint interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            checkpoint_flag = true;
+            break;
+        case 'S':
+            resume = true;
+            checkpoint_flag = true;
+            break;
+        case 'B':
+            batch_list = optarg;
+            break;
+        case 'L':
+            serve_socket = optarg;
+            break;
+        case 'Q':
+            client_socket = optarg;
+            break;
+        case 'T':
+            load_socket = optarg;
+            break;
+        case 'H':
+            shm_serve_name = optarg;
+            break;
+        case 'G':
+            shm_client_name = optarg;
+            break;
+        case 'W':
+            shm_load_name = optarg;
+            break;
+        case 'Y':
+            key_id = strtoul(optarg, NULL, 10);
+            if (key_id > UINT32_MAX)
+            {
+                fprintf(stderr, "Invalid key id: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
             fhelp();
             exit(EXIT_SUCCESS);
@@ -737,33 +1385,117 @@ int main(int argc, char *argv[])
             exit(EXIT_FAILURE);
         }
     }
+    if (stats_flag || stats_json != NULL)
+    {
+        stats_enable(stats_flag, stats_json);
+    }
 
-    if (input_file == NULL || mode == NULL || (encrypt && decrypt) || (!encrypt && !decrypt))
+    // Random generator mode: no input file, no cipher mode.
+    if (random_flag)
     {
-        fprintf(stderr, "Missing or invalid arguments.\n");
-        fhelp();
-        exit(EXIT_FAILURE);
+        if (seed != NULL && drbg_set_seed(seed) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Failed to verify the seed.\n");
+            exit(EXIT_FAILURE);
+        }
+        FILE *random_file = output_specified ? open_output_file(output_file) : stdout;
+        if (random_file == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        start = clock();
+        int result = drbg_write_random(random_file, random_bytes);
+        end = clock();
+        if (random_file != stdout)
+        {
+            fclose(random_file);
+        }
+        if (result != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Failed to generate the random output.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (verbose || time_flag)
+        {
+            cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
+            fprintf(stderr, "Generated %llu random bytes in %f seconds\n", random_bytes, cpu_time_used);
+        }
+        return 0;
     }
 
-    // Parse the input file
-    char *file_content = NULL;
-    if (file_parser(&file_content, input_file, file_length) == EXIT_SUCCESS)
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = num_threads > 0 ? num_threads : (online > 0 ? (int)online : 1);
+
+    // Daemon mode: requests bring their own mode, key and data.
+    if (serve_socket != NULL)
     {
-        if (verbose)
+        return daemon_serve(serve_socket, workers, verbose || time_flag);
+    }
+    if (shm_serve_name != NULL)
+    {
+        return shm_serve(shm_serve_name, workers, verbose || time_flag);
+    }
+    if (client_socket != NULL || load_socket != NULL || shm_client_name != NULL || shm_load_name != NULL)
+    {
+        return daemon_client_main(client_socket, load_socket, shm_client_name, shm_load_name, input_file, output_specified ? output_file : NULL, mode, encrypt, key, vector_init,
+                                  (uint32_t)key_id, stream_flag ? (size_t)chunk_size : 4096, num_threads > 0 ? num_threads : 4, (unsigned long)t);
+    }
+
+    // The benchmark brings its own keys and data.
+    if (bench_flag)
+    {
+        bench_options options;
+        options.num_modes = 0;
+        if (mode != NULL)
         {
-            printf("Content of the file:\n%s\n", file_content);
+            if (stream_mode_from_name(mode, &options.modes[0]) != EXIT_SUCCESS)
+            {
+                exit(EXIT_FAILURE);
+            }
+            options.num_modes = 1;
+        }
+        else
+        {
+            for (int m = STREAM_ECB; m <= STREAM_CTR; m++)
+            {
+                options.modes[options.num_modes++] = (stream_mode)m;
+            }
         }
+        options.max_size = stream_flag ? chunk_size : BENCH_DEFAULT_MAX_SIZE;
+        options.repetitions = time_flag ? t : BENCH_DEFAULT_REPETITIONS;
+        options.json_file = output_specified ? output_file : NULL;
+        options.quiet = quiet;
+        options.counters = perf_flag;
+        return bench_run(&options);
     }
-    else
+
+    // Verification only reads the checksums, it needs neither the mode nor the key.
+    if (verify_flag)
     {
-        fprintf(stderr, "Failed to parse the file.\n");
+        if (input_file == NULL)
+        {
+            fprintf(stderr, "Missing or invalid arguments.\n");
+            fhelp();
+            exit(EXIT_FAILURE);
+        }
+        return verify_main(input_file);
+    }
+
+    if ((input_file == NULL && batch_list == NULL) || mode == NULL || (encrypt && decrypt) || (!encrypt && !decrypt) || (range_flag && !decrypt) ||
+        ((((append_flag || incremental_flag) && encrypt) || checkpoint_flag) && (!output_specified || strcmp(output_file, "-") == 0)) ||
+        (incremental_flag && !encrypt))
+    {
+        fprintf(stderr, "Missing or invalid arguments.\n");
+        fhelp();
+        exit(EXIT_FAILURE);
+    }
+    // Checked before the output is created or truncated.
+    if (container_flag && encrypt && !container_chunk_size_valid((size_t)chunk_size))
+    {
+        fprintf(stderr, "The chunk size must be a multiple of %d below 4 GiB.\n", BLOCK_SIZE);
         exit(EXIT_FAILURE);
     }
 
-    // Split the text into blocks
-    unsigned char **blocks;
-    size_t num_blocks;
-    affichage_result(split_text_into_blocks(file_content, *file_length, &blocks, &num_blocks), "split text", &blocks, &num_blocks, verbose, debug);
     // Verify the encryption/decryption key
     if (key == NULL)
     {
@@ -782,33 +1514,241 @@ int main(int argc, char *argv[])
         printf("Key size used : %d bits\n", key_length);
     }
     // Expansion key
-    size_t num_round_keys;
-    int nk;
-    switch (key_length)
+    size_t num_round_keys = 0;
+    unsigned char **round_keys;
+    double key_start = stats_begin();
+    affichage_result(key_setup(key, &round_keys, &num_round_keys), "Round key", &round_keys, &num_round_keys, verbose, debug);
+    stats_end(STATS_KEY_SETUP, key_start, 0);
+
+    // Streaming mode: the file is processed chunk by chunk in constant memory.
+    // "-" as input or output means stdin or stdout, which always stream.
+    bool read_stdin = input_file != NULL && strcmp(input_file, "-") == 0;
+    bool write_stdout = !output_specified || strcmp(output_file, "-") == 0;
+    if (stream_flag || mmap_flag || uring_flag || direct_flag || num_threads > 0 || container_flag || range_flag || append_flag || checkpoint_flag || batch_list != NULL || read_stdin || (output_specified && write_stdout))
     {
-    case 128:
-        num_round_keys = 10;
-        nk = 4;
-        break;
-    case 192:
-        num_round_keys = 12;
-        nk = 6;
-        break;
-    case 256:
-        num_round_keys = 14;
-        nk = 8;
-        break;
-    default:
-        printf("Unsupported key size!\n");
+        stream_ctx ctx;
+        // A container gets a fresh random base IV unless one is given; on
+        // decryption it comes from the container header.
+        unsigned char base_iv[BLOCK_SIZE];
+        const unsigned char *iv = (const unsigned char *)vector_init;
+        if (container_flag && vector_init == NULL)
+        {
+            if (drbg_random_bytes(base_iv, BLOCK_SIZE) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Failed to generate the base IV.\n");
+                exit(EXIT_FAILURE);
+            }
+            iv = base_iv;
+        }
+        else if (strcmp(mode, "ECB") != 0)
+        {
+            if (vector_init == NULL)
+            {
+                vector_init = DEFAULT_VECTOR_128;
+            }
+            if (vector_init_verif(vector_init, strlen(vector_init) * 4) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Failed to verify the vector input.\n");
+                exit(EXIT_FAILURE);
+            }
+            iv = (const unsigned char *)vector_init;
+        }
+        if (stream_init(&ctx, mode, encrypt, round_keys, num_round_keys, iv) != EXIT_SUCCESS)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (batch_list != NULL)
+        {
+            int result = batch_run(&ctx, batch_list, output_file, (size_t)chunk_size, workers, verbose);
+            free_blocks(round_keys, num_round_keys);
+            return result;
+        }
+        int in_fd = read_stdin ? STDIN_FILENO : open(input_file, O_RDONLY);
+        if (in_fd < 0)
+        {
+            fprintf(stderr, "Failed to open the file %s for reading.\n", input_file);
+            exit(EXIT_FAILURE);
+        }
+        FILE *out_file = NULL;
+        if (((append_flag || incremental_flag) && encrypt) || checkpoint_flag)
+        {
+            // The log, container or resumed output is updated in place, not replaced.
+            int log_fd = open(output_file, O_RDWR | O_CREAT, 0644);
+            out_file = log_fd < 0 ? NULL : fdopen(log_fd, "r+");
+            if (out_file == NULL)
+            {
+                fprintf(stderr, "Failed to open the file %s.\n", output_file);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            out_file = write_stdout ? stdout : open_output_file(output_file);
+        }
+        if (out_file == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        fflush(stdout);
+        unsigned long long bytes_out = 0;
+        long long cache_start = page_cache_kb();
+        perf_flag = perf_flag && perfctr_open(&counters) == EXIT_SUCCESS;
+        if (perf_flag)
+        {
+            perfctr_start(&counters);
+        }
+        double wall_start = monotonic_seconds();
+        start = clock();
+        int result = IO_UNSUPPORTED;
+        if (checkpoint_flag)
+        {
+            char journal_file[strlen(output_file) + sizeof(CHECKPOINT_SUFFIX)];
+            snprintf(journal_file, sizeof(journal_file), "%s%s", output_file, CHECKPOINT_SUFFIX);
+            result = checkpoint_stream(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, checkpoint_interval, journal_file, resume, &bytes_out);
+        }
+        else if (append_flag)
+        {
+            if (encrypt)
+            {
+                result = append_log_write(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+            }
+            else
+            {
+                result = append_log_read(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+            }
+        }
+        else if (container_flag)
+        {
+            if (workers > PIPELINE_MAX_WORKERS)
+            {
+                workers = PIPELINE_MAX_WORKERS;
+            }
+            stats_set_threads(workers);
+            if (incremental_flag)
+            {
+                result = incremental_encrypt(&ctx, in_fd, fileno(out_file), output_file, (size_t)chunk_size, container_flags, workers, verbose,
+                                             &bytes_out);
+            }
+            else if (encrypt)
+            {
+                result = container_encrypt(&ctx, ctx.chain, in_fd, fileno(out_file), (size_t)chunk_size, container_flags, workers, NULL, &bytes_out);
+            }
+            else if (recover_container(input_file) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+            else if (range_flag)
+            {
+                result = container_decrypt_range(&ctx, in_fd, fileno(out_file), range_offset, range_length, &bytes_out);
+            }
+            else
+            {
+                result = container_decrypt(&ctx, in_fd, fileno(out_file), workers, &bytes_out);
+            }
+        }
+        else if (range_flag)
+        {
+            result = range_decrypt(in_fd, fileno(out_file), mode, round_keys, num_round_keys, iv, range_offset, range_length, &bytes_out);
+        }
+        else if (uring_flag)
+        {
+            result = uring_process(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+            if (result == IO_UNSUPPORTED && verbose)
+            {
+                fprintf(stderr, "io_uring is not available for these files, using read/write.\n");
+            }
+        }
+        else if (direct_flag)
+        {
+            result = direct_process(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+            if (result == IO_UNSUPPORTED && verbose)
+            {
+                fprintf(stderr, "O_DIRECT is not supported for these files, using buffered read/write.\n");
+            }
+        }
+        else if (mmap_flag)
+        {
+            result = mmap_process(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+            if (result == IO_UNSUPPORTED && verbose)
+            {
+                fprintf(stderr, "The files cannot be mapped, using read/write.\n");
+            }
+        }
+        if (result == IO_UNSUPPORTED && num_threads > 0)
+        {
+            stats_set_threads(num_threads + 2); // Reader, cipher workers, writer
+            result = pipeline_process(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, num_threads, &bytes_out);
+        }
+        if (result == IO_UNSUPPORTED)
+        {
+            result = stream_file(&ctx, in_fd, fileno(out_file), (size_t)chunk_size, &bytes_out);
+        }
+        end = clock();
+        if (perf_flag)
+        {
+            perfctr_stop(&counters, &counter_values);
+            perfctr_close(&counters);
+        }
+        if (!read_stdin)
+        {
+            close(in_fd);
+        }
+        if (out_file != stdout)
+        {
+            fclose(out_file);
+        }
+        free_blocks(round_keys, num_round_keys);
+        if (result != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Streaming %s failed.\n", encrypt ? "encryption" : "decryption");
+            exit(EXIT_FAILURE);
+        }
+        if (verbose || time_flag)
+        {
+            cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
+            double wall_time = monotonic_seconds() - wall_start;
+            fprintf(stderr, "Streamed %llu bytes in %f seconds (%f seconds CPU, %.1f MB/s)\n",
+                    bytes_out, wall_time, cpu_time_used, wall_time > 0 ? bytes_out / wall_time / 1e6 : 0.0);
+            long long cache_end = page_cache_kb();
+            if (cache_start >= 0 && cache_end >= 0)
+            {
+                fprintf(stderr, "Page cache growth : %lld KiB\n", cache_end - cache_start);
+            }
+        }
+        if (perf_flag)
+        {
+            perfctr_print(stderr, "Hardware counters", &counter_values, bytes_out);
+        }
+        return 0;
     }
 
-    uint8_t temp[(num_round_keys + 1) * 16];
-    uint32_t *expandedKey = (uint32_t *)temp;
-    KeyExpansion((uint8_t *)key, expandedKey, nk, num_round_keys);
-    unsigned char **round_keys;
-    num_round_keys++;
-    affichage_result(getRoundKeys(expandedKey, num_round_keys, &round_keys), "Round key", &round_keys, &num_round_keys, verbose, debug);
+    // Parse the input file
+    char *file_content = NULL;
+    double io_start = monotonic_seconds();
+    int parse_result = file_parser(&file_content, input_file, file_length);
+    double io_time = monotonic_seconds() - io_start;
+    stats_end(STATS_READ, io_start, parse_result == EXIT_SUCCESS ? (unsigned long long)*file_length : 0);
+    if (parse_result == EXIT_SUCCESS)
+    {
+        if (verbose)
+        {
+            printf("Content of the file:\n%s\n", file_content);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Failed to parse the file.\n");
+        exit(EXIT_FAILURE);
+    }
 
+    // Split the text into blocks
+    unsigned char **blocks;
+    size_t num_blocks;
+    double split_start = stats_begin();
+    affichage_result(split_text_into_blocks(file_content, *file_length, &blocks, &num_blocks), "split text", &blocks, &num_blocks, verbose, debug);
+    stats_end(STATS_SPLIT, split_start, (unsigned long long)*file_length);
+
+    bool have_result = false;
     unsigned char **cipher;
     size_t num_cipher;
     unsigned char **decipher;
@@ -866,11 +1806,18 @@ int main(int argc, char *argv[])
         }
     }
 
+    perf_flag = perf_flag && perfctr_open(&counters) == EXIT_SUCCESS;
+    if (perf_flag)
+    {
+        perfctr_start(&counters);
+    }
     if (strcmp(mode, "ECB") == 0)
     {
         if (encrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_ECB, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(ECB_cipher(round_keys, blocks, num_blocks, cipher, &num_cipher, num_round_keys), "encryption", &cipher, &num_cipher, verbose, debug);
@@ -880,23 +1827,18 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_ECB, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
 
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
-            {
-                printf("%c", concatenated_text[i]);
-            }
-            printf("\n");
-            if (time_flag)
-            {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
-            }
+            have_result = true;
         }
         else if (decrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_ECB, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(ECB_decipher(round_keys, blocks, num_blocks, decipher, &num_decipher, num_round_keys), "decryption", &decipher, &num_decipher, verbose, debug);
@@ -906,18 +1848,11 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_ECB, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
-            {
-                printf("%c", concatenated_text[i]);
-            }
-            printf("\n");
-            if (time_flag)
-            {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
-            }
+            have_result = true;
         }
         else
         {
@@ -945,6 +1880,8 @@ int main(int argc, char *argv[])
         if (encrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CBC, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(CBC_cipher(round_keys, blocks, num_blocks, cipher, &num_cipher, num_round_keys, (unsigned char *)vector_init), "encryption", &cipher, &num_cipher, verbose, debug);
@@ -954,22 +1891,17 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CBC, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
-            {
-                printf("%c", concatenated_text[i]);
-            }
-            printf("\n");
-            if (time_flag)
-            {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
-            }
+            have_result = true;
         }
         else if (decrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CBC, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(CBC_decipher(round_keys, blocks, num_blocks, decipher, &num_decipher, num_round_keys, (unsigned char *)vector_init), "decryption", &decipher, &num_decipher, verbose, debug);
@@ -979,18 +1911,11 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CBC, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
-            {
-                printf("%c", concatenated_text[i]);
-            }
-            printf("\n");
-            if (time_flag)
-            {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
-            }
+            have_result = true;
         }
         else
         {
@@ -1018,6 +1943,8 @@ int main(int argc, char *argv[])
         if (encrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CFB, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(CFB_cipher(round_keys, blocks, num_blocks, cipher, &num_cipher, num_round_keys, (unsigned char *)vector_init), "encryption", &cipher, &num_cipher, verbose, debug);
@@ -1027,22 +1954,17 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CFB, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
-            {
-                printf("%c", concatenated_text[i]);
-            }
-            printf("\n");
-            if (time_flag)
-            {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
-            }
+            have_result = true;
         }
         else if (decrypt)
         {
             start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CFB, (uint64_t)num_blocks * BLOCK_SIZE * t);
             for (int i = 0; i < t; i++)
             {
                 affichage_result(CFB_decipher(round_keys, blocks, num_blocks, decipher, &num_decipher, num_round_keys, (unsigned char *)vector_init), "decryption", &decipher, &num_decipher, verbose, debug);
@@ -1052,18 +1974,74 @@ int main(int argc, char *argv[])
                 }
             }
             end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CFB, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
             cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
             concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
-            printf("Result :\n");
-            for (size_t i = 0; i < concatenated_text_length; i++)
+            have_result = true;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid mode specified.\n");
+        }
+    }
+    else if (strcmp(mode, "CTR") == 0)
+    {
+        if (vector_init == NULL)
+        {
+            vector_init = DEFAULT_VECTOR_128;
+        }
+        int vector_lenght = strlen(vector_init) * 4;
+        if (vector_init_verif(vector_init, vector_lenght) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Failed to verify the vector input.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (verbose)
+        {
+            printf("Vector input used : %s\n", vector_init);
+            printf("Vector size used : %d bits\n", vector_lenght);
+        }
+
+        if (encrypt)
+        {
+            start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CTR, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            for (int i = 0; i < t; i++)
             {
-                printf("%c", concatenated_text[i]);
+                affichage_result(CTR_cipher(round_keys, blocks, num_blocks, cipher, &num_cipher, num_round_keys, (unsigned char *)vector_init), "encryption", &cipher, &num_cipher, verbose, debug);
+                for (size_t j = 0; j < num_cipher; j++)
+                {
+                    memcpy(blocks[j], cipher[j], BLOCK_SIZE);
+                }
             }
-            printf("\n");
-            if (time_flag)
+            end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CTR, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
+            cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
+            concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
+            have_result = true;
+        }
+        else if (decrypt)
+        {
+            start = clock();
+            double loop_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_BLOCKS, STREAM_CTR, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            for (int i = 0; i < t; i++)
             {
-                printf("Loop execution time : %f seconds\n", cpu_time_used);
+                affichage_result(CTR_decipher(round_keys, blocks, num_blocks, decipher, &num_decipher, num_round_keys, (unsigned char *)vector_init), "decryption", &decipher, &num_decipher, verbose, debug);
+                for (size_t j = 0; j < num_decipher; j++)
+                {
+                    memcpy(blocks[j], decipher[j], BLOCK_SIZE);
+                }
             }
+            end = clock();
+            AES_PROBE3(chunk_end, AES_ENGINE_BLOCKS, STREAM_CTR, (uint64_t)num_blocks * BLOCK_SIZE * t);
+            stats_end(STATS_CIPHER, loop_start, (unsigned long long)num_blocks * BLOCK_SIZE * t);
+            cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC; // Calculate elapsed time in seconds
+            concatenate_blocks(concatenated_text, &concatenated_text_length, &blocks, &num_blocks);
+            have_result = true;
         }
         else
         {
@@ -1078,19 +2056,42 @@ int main(int argc, char *argv[])
     {
         printf("Error mode, the mode input is not supported");
     }
+    if (perf_flag)
+    {
+        perfctr_stop(&counters, &counter_values);
+        perfctr_close(&counters);
+    }
 
-    if (output_specified)
+    if (have_result && !quiet)
+    {
+        io_start = monotonic_seconds();
+        print_result(concatenated_text, concatenated_text_length);
+        io_time += monotonic_seconds() - io_start;
+    }
+    if (output_specified && have_result)
     {
+        io_start = monotonic_seconds();
         if (write_to_file(output_file, concatenated_text, concatenated_text_length) == EXIT_FAILURE)
         {
             fprintf(stderr, "Failed to write content to the file\n %s\n", output_file);
             exit(EXIT_FAILURE);
         }
+        io_time += monotonic_seconds() - io_start;
+        stats_end(STATS_WRITE, io_start, concatenated_text_length);
         if (verbose)
         {
             printf("Content successfully written to the file\n %s\n", output_file);
         }
     }
+    if (have_result && time_flag)
+    {
+        printf("Loop execution time : %f seconds\n", cpu_time_used);
+        printf("I/O execution time : %f seconds\n", io_time);
+    }
+    if (have_result && perf_flag)
+    {
+        perfctr_print(stdout, "Hardware counters (mode loop)", &counter_values, (unsigned long long)num_blocks * BLOCK_SIZE * t);
+    }
     num_cipher = num_blocks;
     num_decipher = num_blocks;
     // free memory.
@@ -32,13 +32,14 @@ int CBC_cipher(unsigned char **key, unsigned char **blocks, size_t num_blocks, u
     for (size_t i = 0; i < num_blocks; i++)
     {
         // XOR the current plaintext block with the previous ciphertext block
+        unsigned char xored_block[BLOCK_SIZE];
         for (size_t j = 0; j < BLOCK_SIZE; j++)
         {
-            blocks[i][j] ^= previous_cipher_block[j];
+            xored_block[j] = blocks[i][j] ^ previous_cipher_block[j];
         }
 
         // Encrypt the XORed block
-        AES_cipher(blocks[i], key, cipher[i], Nr);
+        AES_cipher(xored_block, key, cipher[i], Nr);
 
         // Update the previous ciphertext block with the current ciphertext block
         memcpy(previous_cipher_block, cipher[i], BLOCK_SIZE);
@@ -75,14 +75,14 @@ int CFB_decipher(unsigned char **key, unsigned char **blocks, size_t num_blocks,
         unsigned char encrypted_state[BLOCK_SIZE];
         AES_cipher(current_state, key, encrypted_state, Nr);
 
+        // Mettre à jour l'état actuel avec le bloc de texte chiffré, avant que cipher[i] ne l'écrase
+        memcpy(current_state, blocks[i], BLOCK_SIZE);
+
         // XOR l'état chiffré avec le bloc de texte chiffré pour produire le bloc de texte clair
         for (size_t j = 0; j < BLOCK_SIZE; j++)
         {
             cipher[i][j] = blocks[i][j] ^ encrypted_state[j];
         }
-
-        // Mettre à jour l'état actuel avec le bloc de texte chiffré
-        memcpy(current_state, blocks[i], BLOCK_SIZE);
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../include/CTR.h"
+#include "../include/AES.h"
+#include "../include/more.h"
+
+/**
+ * @brief Adds n to a counter block read as a 128-bit big-endian integer.
+ *
+ * @param counter  The counter block to increment.
+ * @param n        The value to add.
+ */
+void CTR_increment(unsigned char *counter, size_t n)
+{
+    // Propagate the addition from the least significant byte, with carry.
+    for (int i = BLOCK_SIZE - 1; i >= 0 && n != 0; i--)
+    {
+        size_t sum = counter[i] + (n & 0xff);
+        counter[i] = (unsigned char)sum;
+        n = (n >> 8) + (sum >> 8);
+    }
+}
+
+/**
+ * @brief Generates consecutive keystream blocks in a contiguous buffer.
+ *
+ * Each block is the encryption of the counter, which is then incremented. On
+ * return the counter holds the value for the next unused block.
+ *
+ * @param key          Encryption key.
+ * @param Nr           Number of rounds.
+ * @param counter      The counter block, updated in place.
+ * @param keystream    Buffer of num_blocks * BLOCK_SIZE bytes for the keystream.
+ * @param num_blocks   Number of keystream blocks to generate.
+ */
+void CTR_keystream(unsigned char **key, size_t Nr, unsigned char *counter, unsigned char *keystream, size_t num_blocks)
+{
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        AES_cipher(counter, key, keystream + i * BLOCK_SIZE, Nr);
+        CTR_increment(counter, 1);
+    }
+}
+
+/**
+ * @brief Encrypts data blocks using the CTR mode.
+ *
+ * The keystream is generated CTR_BATCH_BLOCKS blocks at a time, then XORed
+ * with the data.
+ *
+ * @param key          Encryption key.
+ * @param blocks       Array of pointers to data blocks to be encrypted.
+ * @param num_blocks   Number of data blocks.
+ * @param cipher       Array of pointers to store the encrypted blocks.
+ * @param num_cipher   Number of encrypted blocks.
+ * @param Nr           Number of rounds.
+ * @param vector_init  The initial counter block.
+ * @return int         Returns 0 on success, -1 on failure.
+ */
+int CTR_cipher(unsigned char **key, unsigned char **blocks, size_t num_blocks, unsigned char **cipher, size_t *num_cipher, size_t Nr, unsigned char *vector_init)
+{
+    // Set the number of encrypted blocks equal to the number of input blocks.
+    *num_cipher = num_blocks;
+
+    unsigned char counter[BLOCK_SIZE];
+    memcpy(counter, vector_init, BLOCK_SIZE);
+
+    unsigned char keystream[CTR_BATCH_BLOCKS * BLOCK_SIZE];
+    for (size_t i = 0; i < num_blocks; i += CTR_BATCH_BLOCKS)
+    {
+        size_t batch = num_blocks - i < CTR_BATCH_BLOCKS ? num_blocks - i : CTR_BATCH_BLOCKS;
+        CTR_keystream(key, Nr, counter, keystream, batch);
+
+        // XOR the keystream with the data blocks
+        for (size_t b = 0; b < batch; b++)
+        {
+            for (size_t j = 0; j < BLOCK_SIZE; j++)
+            {
+                cipher[i + b][j] = blocks[i + b][j] ^ keystream[b * BLOCK_SIZE + j];
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decrypts data blocks using the CTR mode.
+ *
+ * CTR decryption is the same operation as encryption.
+ *
+ * @param key          Encryption key.
+ * @param blocks       Array of pointers to data blocks to be decrypted.
+ * @param num_blocks   Number of data blocks.
+ * @param cipher       Array of pointers to store the decrypted blocks.
+ * @param num_cipher   Number of decrypted blocks.
+ * @param Nr           Number of rounds.
+ * @param vector_init  The initial counter block.
+ * @return int         Returns 0 on success, -1 on failure.
+ */
+int CTR_decipher(unsigned char **key, unsigned char **blocks, size_t num_blocks, unsigned char **cipher, size_t *num_cipher, size_t Nr, unsigned char *vector_init)
+{
+    return CTR_cipher(key, blocks, num_blocks, cipher, num_cipher, Nr, vector_init);
+}
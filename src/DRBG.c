@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/random.h>
+#include "../include/DRBG.h"
+#include "../include/CTR.h"
+#include "../include/AES.h"
+#include "../include/more.h"
+
+// Seed shared by every thread when the generator is seeded by the user.
+static uint8_t drbg_seed[DRBG_SEED_LEN];
+static bool drbg_deterministic = false;
+static unsigned int drbg_next_thread = 0;
+
+// Per-thread generator and output buffer.
+static __thread drbg_state tls_state;
+static __thread bool tls_ready = false;
+static __thread uint8_t *tls_buffer = NULL;
+static __thread size_t tls_pos = DRBG_BUFFER_SIZE;
+static __thread uint64_t tls_refills = 0;
+
+/**
+ * @brief CTR_DRBG_Update: derives a new key and V from the current state.
+ *
+ * @param state          The generator state.
+ * @param provided_data  DRBG_SEED_LEN bytes XORed into the new key and V.
+ * @return 0 on success, -1 on failure.
+ */
+static int drbg_update(drbg_state *state, const uint8_t *provided_data)
+{
+    uint8_t temp[DRBG_SEED_LEN];
+    unsigned char counter[BLOCK_SIZE];
+
+    // temp = E(V+1) || E(V+2) || E(V+3)
+    memcpy(counter, state->V, BLOCK_SIZE);
+    CTR_increment(counter, 1);
+    CTR_keystream(state->round_keys, state->Nr, counter, temp, DRBG_SEED_LEN / BLOCK_SIZE);
+    for (size_t i = 0; i < DRBG_SEED_LEN; i++)
+    {
+        temp[i] ^= provided_data[i];
+    }
+
+    // Key = leftmost keylen bits, V = rightmost outlen bits.
+    free_blocks(state->round_keys, state->Nr);
+    state->round_keys = NULL;
+    int result = key_setup_bytes(temp, DRBG_KEY_LEN, &state->round_keys, &state->Nr);
+    memcpy(state->V, temp + DRBG_KEY_LEN, BLOCK_SIZE);
+    memset(temp, 0, sizeof(temp));
+    return result;
+}
+
+/**
+ * @brief Copies up to DRBG_SEED_LEN bytes into a zero-padded seed block.
+ */
+static void drbg_pad(uint8_t *padded, const uint8_t *data, size_t len)
+{
+    memset(padded, 0, DRBG_SEED_LEN);
+    if (data != NULL)
+    {
+        memcpy(padded, data, len < DRBG_SEED_LEN ? len : DRBG_SEED_LEN);
+    }
+}
+
+/**
+ * @brief Instantiates a generator.
+ *
+ * @param state                The generator state to initialize.
+ * @param entropy              DRBG_SEED_LEN bytes of entropy input.
+ * @param entropy_len          Must be DRBG_SEED_LEN.
+ * @param personalization      Optional personalization string (may be NULL).
+ * @param personalization_len  Length of the personalization string, at most DRBG_SEED_LEN.
+ * @return 0 on success, -1 on failure.
+ */
+int drbg_instantiate(drbg_state *state, const uint8_t *entropy, size_t entropy_len, const uint8_t *personalization, size_t personalization_len)
+{
+    if (entropy_len != DRBG_SEED_LEN || personalization_len > DRBG_SEED_LEN)
+    {
+        printf("Invalid DRBG seed length.\n");
+        return -1;
+    }
+    uint8_t seed_material[DRBG_SEED_LEN];
+    drbg_pad(seed_material, personalization, personalization_len);
+    for (size_t i = 0; i < DRBG_SEED_LEN; i++)
+    {
+        seed_material[i] ^= entropy[i];
+    }
+
+    // Key = 0, V = 0, then update with the seed material.
+    uint8_t zero_key[DRBG_KEY_LEN] = {0};
+    memset(state->V, 0, BLOCK_SIZE);
+    state->round_keys = NULL;
+    if (key_setup_bytes(zero_key, DRBG_KEY_LEN, &state->round_keys, &state->Nr) != 0)
+    {
+        return -1;
+    }
+    int result = drbg_update(state, seed_material);
+    memset(seed_material, 0, sizeof(seed_material));
+    state->reseed_counter = 1;
+    return result;
+}
+
+/**
+ * @brief Reseeds a generator.
+ *
+ * @param state           The generator state.
+ * @param entropy         DRBG_SEED_LEN bytes of fresh entropy.
+ * @param entropy_len     Must be DRBG_SEED_LEN.
+ * @param additional      Optional additional input (may be NULL).
+ * @param additional_len  Length of the additional input, at most DRBG_SEED_LEN.
+ * @return 0 on success, -1 on failure.
+ */
+int drbg_reseed(drbg_state *state, const uint8_t *entropy, size_t entropy_len, const uint8_t *additional, size_t additional_len)
+{
+    if (entropy_len != DRBG_SEED_LEN || additional_len > DRBG_SEED_LEN)
+    {
+        printf("Invalid DRBG reseed length.\n");
+        return -1;
+    }
+    uint8_t seed_material[DRBG_SEED_LEN];
+    drbg_pad(seed_material, additional, additional_len);
+    for (size_t i = 0; i < DRBG_SEED_LEN; i++)
+    {
+        seed_material[i] ^= entropy[i];
+    }
+    int result = drbg_update(state, seed_material);
+    memset(seed_material, 0, sizeof(seed_material));
+    state->reseed_counter = 1;
+    return result;
+}
+
+/**
+ * @brief Generates pseudorandom bytes.
+ *
+ * @param state           The generator state.
+ * @param out             Buffer to fill.
+ * @param len             Number of bytes, at most DRBG_MAX_REQUEST.
+ * @param additional      Optional additional input (may be NULL).
+ * @param additional_len  Length of the additional input, at most DRBG_SEED_LEN.
+ * @return 0 on success, 1 if a reseed is required, -1 on failure.
+ */
+int drbg_generate(drbg_state *state, uint8_t *out, size_t len, const uint8_t *additional, size_t additional_len)
+{
+    if (len > DRBG_MAX_REQUEST || additional_len > DRBG_SEED_LEN)
+    {
+        printf("Invalid DRBG request length.\n");
+        return -1;
+    }
+    if (state->reseed_counter > DRBG_RESEED_INTERVAL)
+    {
+        return 1;
+    }
+
+    uint8_t padded[DRBG_SEED_LEN];
+    drbg_pad(padded, additional, additional_len);
+    if (additional_len > 0 && drbg_update(state, padded) != 0)
+    {
+        return -1;
+    }
+
+    // Output E(V+1) || E(V+2) || ..., the last block truncated if needed.
+    unsigned char counter[BLOCK_SIZE];
+    memcpy(counter, state->V, BLOCK_SIZE);
+    CTR_increment(counter, 1);
+    size_t full_blocks = len / BLOCK_SIZE;
+    CTR_keystream(state->round_keys, state->Nr, counter, out, full_blocks);
+    if (len % BLOCK_SIZE != 0)
+    {
+        unsigned char last[BLOCK_SIZE];
+        CTR_keystream(state->round_keys, state->Nr, counter, last, 1);
+        memcpy(out + full_blocks * BLOCK_SIZE, last, len % BLOCK_SIZE);
+        full_blocks++;
+    }
+    CTR_increment(state->V, full_blocks);
+
+    if (drbg_update(state, padded) != 0)
+    {
+        return -1;
+    }
+    state->reseed_counter++;
+    return 0;
+}
+
+/**
+ * @brief Erases a generator state and frees its round keys.
+ *
+ * @param state  The generator state.
+ */
+void drbg_uninstantiate(drbg_state *state)
+{
+    free_blocks(state->round_keys, state->Nr);
+    memset(state, 0, sizeof(*state));
+}
+
+/**
+ * @brief Seeds every thread-local generator from a hexadecimal seed.
+ *
+ * With a seed, the output is deterministic: the first thread to draw bytes
+ * always produces the same stream. Must be called before any thread draws.
+ *
+ * @param seed  The seed in hexadecimal, at most 2 * DRBG_SEED_LEN characters.
+ * @return EXIT_SUCCESS or EXIT_FAILURE if the seed is not valid.
+ */
+int drbg_set_seed(const char *seed)
+{
+    size_t len = strlen(seed);
+    if (len == 0 || len % 2 != 0 || len > 2 * DRBG_SEED_LEN)
+    {
+        printf("The seed must be an even number of hexadecimal characters, at most %d.\n", 2 * DRBG_SEED_LEN);
+        return EXIT_FAILURE;
+    }
+    memset(drbg_seed, 0, sizeof(drbg_seed));
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!is_hexadecimal(seed[i]))
+        {
+            printf("Seed contains invalid characters in hexadecimal.\n");
+            return EXIT_FAILURE;
+        }
+        drbg_seed[i / 2] |= char_to_hex(seed[i]) << (i % 2 == 0 ? 4 : 0);
+    }
+    drbg_deterministic = true;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Fills a buffer with entropy from the operating system.
+ */
+static int drbg_os_entropy(uint8_t *entropy)
+{
+    size_t done = 0;
+    while (done < DRBG_SEED_LEN)
+    {
+        ssize_t got = getrandom(entropy + done, DRBG_SEED_LEN - done, 0);
+        if (got < 0)
+        {
+            printf("Failed to read entropy from the system.\n");
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Instantiates the generator and output buffer of the calling thread.
+ *
+ * Each thread gets its own personalization string, so threads never share
+ * an output stream even when seeded from the same seed.
+ */
+static int drbg_thread_init(void)
+{
+    uint8_t entropy[DRBG_SEED_LEN];
+    uint8_t personalization[DRBG_SEED_LEN] = "AES CTR_DRBG thread";
+    unsigned int index = __atomic_fetch_add(&drbg_next_thread, 1, __ATOMIC_RELAXED);
+    memcpy(personalization + DRBG_SEED_LEN - sizeof(index), &index, sizeof(index));
+
+    if (drbg_deterministic)
+    {
+        memcpy(entropy, drbg_seed, DRBG_SEED_LEN);
+    }
+    else if (drbg_os_entropy(entropy) != 0)
+    {
+        return -1;
+    }
+
+    tls_buffer = (uint8_t *)malloc(DRBG_BUFFER_SIZE);
+    if (tls_buffer == NULL)
+    {
+        printf("Memory allocation failed for the DRBG buffer.\n");
+        return -1;
+    }
+    int result = drbg_instantiate(&tls_state, entropy, DRBG_SEED_LEN, personalization, DRBG_SEED_LEN);
+    memset(entropy, 0, sizeof(entropy));
+    if (result != 0)
+    {
+        free(tls_buffer);
+        tls_buffer = NULL;
+        return -1;
+    }
+    tls_pos = DRBG_BUFFER_SIZE;
+    tls_refills = 0;
+    tls_ready = true;
+    return 0;
+}
+
+/**
+ * @brief Generates DRBG_BUFFER_SIZE bytes with the thread generator.
+ *
+ * Unseeded generators are reseeded from the system every DRBG_THREAD_RESEED
+ * refills, and whenever the generator asks for it.
+ */
+static int drbg_refill(uint8_t *dest)
+{
+    uint8_t entropy[DRBG_SEED_LEN];
+    bool reseed = !drbg_deterministic && tls_refills != 0 && tls_refills % DRBG_THREAD_RESEED == 0;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (reseed)
+        {
+            if (drbg_deterministic)
+            {
+                printf("The seeded DRBG reached its reseed interval.\n");
+                return -1;
+            }
+            if (drbg_os_entropy(entropy) != 0 || drbg_reseed(&tls_state, entropy, DRBG_SEED_LEN, NULL, 0) != 0)
+            {
+                return -1;
+            }
+            memset(entropy, 0, sizeof(entropy));
+        }
+        int result = drbg_generate(&tls_state, dest, DRBG_BUFFER_SIZE, NULL, 0);
+        if (result == 0)
+        {
+            tls_refills++;
+            return 0;
+        }
+        if (result < 0)
+        {
+            return -1;
+        }
+        reseed = true;
+    }
+    return -1;
+}
+
+/**
+ * @brief Copies pseudorandom bytes from the thread buffer into out.
+ *
+ * The buffer is refilled DRBG_BUFFER_SIZE bytes at a time, so most calls are
+ * a single memcpy. Requests of a whole buffer or more are generated directly
+ * into out.
+ *
+ * @param out  Buffer to fill.
+ * @param len  Number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+int drbg_random_bytes(uint8_t *out, size_t len)
+{
+    if (!tls_ready && drbg_thread_init() != 0)
+    {
+        return -1;
+    }
+    while (len > 0)
+    {
+        if (tls_pos == DRBG_BUFFER_SIZE)
+        {
+            if (len >= DRBG_BUFFER_SIZE)
+            {
+                if (drbg_refill(out) != 0)
+                {
+                    return -1;
+                }
+                out += DRBG_BUFFER_SIZE;
+                len -= DRBG_BUFFER_SIZE;
+                continue;
+            }
+            if (drbg_refill(tls_buffer) != 0)
+            {
+                return -1;
+            }
+            tls_pos = 0;
+        }
+        size_t n = DRBG_BUFFER_SIZE - tls_pos < len ? DRBG_BUFFER_SIZE - tls_pos : len;
+        memcpy(out, tls_buffer + tls_pos, n);
+        // Bytes handed out are erased from the buffer.
+        memset(tls_buffer + tls_pos, 0, n);
+        tls_pos += n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the generator and buffer of the calling thread.
+ */
+void drbg_thread_cleanup(void)
+{
+    if (tls_ready)
+    {
+        drbg_uninstantiate(&tls_state);
+        memset(tls_buffer, 0, DRBG_BUFFER_SIZE);
+        free(tls_buffer);
+        tls_buffer = NULL;
+        tls_ready = false;
+    }
+}
+
+/**
+ * @brief Writes num_bytes pseudorandom bytes to a file.
+ *
+ * @param file       The file to write to.
+ * @param num_bytes  Number of bytes to write.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int drbg_write_random(FILE *file, unsigned long long num_bytes)
+{
+    size_t buffer_size = 16 * DRBG_BUFFER_SIZE;
+    uint8_t *buffer = (uint8_t *)malloc(buffer_size);
+    if (buffer == NULL)
+    {
+        printf("Memory allocation failed for the output buffer.\n");
+        return EXIT_FAILURE;
+    }
+    while (num_bytes > 0)
+    {
+        size_t n = num_bytes < buffer_size ? (size_t)num_bytes : buffer_size;
+        if (drbg_random_bytes(buffer, n) != 0 || fwrite(buffer, 1, n, file) != n)
+        {
+            printf("Failed to write the random output.\n");
+            free(buffer);
+            return EXIT_FAILURE;
+        }
+        num_bytes -= n;
+    }
+    free(buffer);
+    drbg_thread_cleanup();
+    return EXIT_SUCCESS;
+}
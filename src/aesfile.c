@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/aesfile.h"
+#include "../include/stream.h"
+#include "../include/CTR.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+/**
+ * @brief Wraps an open encrypted file.
+ *
+ * The file holds bare ciphertext as written by the other modes of the
+ * program: whole blocks, the last one zero-padded. The descriptor is closed
+ * by aes_file_close.
+ *
+ * @param fd           The file, which must support pread (and pwrite to write).
+ * @param mode         The mode name (ECB, CBC, CFB, CTR).
+ * @param round_keys   The round keys, owned by the caller.
+ * @param Nr           Number of round keys.
+ * @param vector_init  The 16-byte IV or initial counter, ignored in ECB mode.
+ * @return The file, or NULL on failure.
+ */
+aes_file *aes_file_fdopen(int fd, const char *mode, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init)
+{
+    aes_file *file = (aes_file *)malloc(sizeof(aes_file));
+    if (file == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return NULL;
+    }
+    if (stream_init(&file->ctx, mode, false, round_keys, Nr, vector_init) != EXIT_SUCCESS)
+    {
+        free(file);
+        return NULL;
+    }
+    file->fd = fd;
+    return file;
+}
+
+/**
+ * @brief Opens an encrypted file for random access.
+ *
+ * @param path      The file path.
+ * @param writable  true to open it for aes_pwrite as well (created if missing).
+ * @return The file, or NULL on failure.
+ * @see aes_file_fdopen for the other parameters.
+ */
+aes_file *aes_file_open(const char *path, bool writable, const char *mode, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init)
+{
+    int fd = writable ? open(path, O_RDWR | O_CREAT, 0644) : open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Failed to open the file %s.\n", path);
+        return NULL;
+    }
+    aes_file *file = aes_file_fdopen(fd, mode, round_keys, Nr, vector_init);
+    if (file == NULL)
+    {
+        close(fd);
+    }
+    return file;
+}
+
+/**
+ * @brief Builds the context that ciphers the file from block index onwards.
+ *
+ * @param file      The file.
+ * @param index     The first block to cipher.
+ * @param previous  The ciphertext block before it (CBC, CFB), NULL for the first block.
+ * @param ctx       The context to initialize.
+ */
+static void aes_file_seek_ctx(const aes_file *file, off_t index, const unsigned char *previous, stream_ctx *ctx)
+{
+    *ctx = file->ctx;
+    if (ctx->mode == STREAM_CTR)
+    {
+        CTR_increment(ctx->chain, (size_t)index);
+    }
+    else if (ctx->mode != STREAM_ECB && previous != NULL)
+    {
+        memcpy(ctx->chain, previous, BLOCK_SIZE);
+    }
+}
+
+/**
+ * @brief Reads and decrypts length bytes at a plaintext offset.
+ *
+ * Only the blocks covering the range are read, plus the block before it in
+ * CBC and CFB, so the cost does not depend on the file size. The plaintext
+ * of block i is at offset i * BLOCK_SIZE, so the padding of the last block
+ * reads back as zeros.
+ *
+ * @param file    The file.
+ * @param buffer  Receives the plaintext.
+ * @param length  The number of bytes to read.
+ * @param offset  The plaintext offset.
+ * @return The number of bytes read, short at the end of the file, or -1 on error.
+ */
+ssize_t aes_pread(aes_file *file, void *buffer, size_t length, off_t offset)
+{
+    unsigned char batch[(AESFILE_BATCH_BLOCKS + 1) * BLOCK_SIZE];
+    struct stat st;
+    if (offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fstat(file->fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (offset >= st.st_size || length == 0)
+    {
+        return 0;
+    }
+    if ((off_t)length > st.st_size - offset)
+    {
+        length = (size_t)(st.st_size - offset);
+    }
+
+    off_t first = offset / BLOCK_SIZE;
+    off_t last = (offset + (off_t)length - 1) / BLOCK_SIZE;
+    bool chained = file->ctx.mode == STREAM_CBC || file->ctx.mode == STREAM_CFB;
+    stream_ctx ctx;
+    size_t done = 0;
+    for (off_t block = first; block <= last;)
+    {
+        size_t count = (size_t)(last - block + 1);
+        if (count > AESFILE_BATCH_BLOCKS)
+        {
+            count = AESFILE_BATCH_BLOCKS;
+        }
+        // The first batch of a chained mode also reads the ciphertext block
+        // it chains from; later batches continue from the context.
+        bool with_previous = block == first && chained && block > 0;
+        off_t read_offset = (block - (with_previous ? 1 : 0)) * BLOCK_SIZE;
+        size_t read_length = (count + (with_previous ? 1 : 0)) * BLOCK_SIZE;
+        ssize_t n = pread_full(file->fd, batch, read_length, read_offset);
+        if (n < 0 || (size_t)n != read_length)
+        {
+            if (n >= 0)
+            {
+                errno = EIO; // The ciphertext is not a whole number of blocks
+            }
+            return -1;
+        }
+        unsigned char *data = batch + (with_previous ? BLOCK_SIZE : 0);
+        if (block == first)
+        {
+            aes_file_seek_ctx(file, block, with_previous ? batch : NULL, &ctx);
+        }
+        if (stream_update(&ctx, data, data, count * BLOCK_SIZE) != EXIT_SUCCESS)
+        {
+            errno = EIO;
+            return -1;
+        }
+        size_t skip = block == first ? (size_t)(offset - first * BLOCK_SIZE) : 0;
+        size_t take = count * BLOCK_SIZE - skip;
+        if (take > length - done)
+        {
+            take = length - done;
+        }
+        memcpy((unsigned char *)buffer + done, data + skip, take);
+        done += take;
+        block += (off_t)count;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Encrypts and writes length bytes at a plaintext offset.
+ *
+ * Only ECB and CTR, where every block is ciphered on its own: in CBC and CFB
+ * a write would change every block after it. Blocks partly covered by the
+ * range are read, decrypted and patched first; blocks past the end of the
+ * file are zero-padded. The write must start at or before the end of the
+ * file. Concurrent writes to the same block are not serialized.
+ *
+ * WARNING: in CTR mode, overwriting a block encrypts the new data with the
+ * keystream of the old data, as the counter of a block depends only on its
+ * position. Anyone who sees both versions of the file (a backup, a snapshot,
+ * the old blocks left on disk) gets the XOR of the old and new plaintext.
+ * That includes writing into the zero padding of the last block. Only write
+ * CTR files that are never observed twice, or write each block once, in
+ * order; ECB does not have this problem but shows equal blocks.
+ *
+ * @param file    The file, opened writable.
+ * @param buffer  The plaintext to write.
+ * @param length  The number of bytes to write.
+ * @param offset  The plaintext offset.
+ * @return The number of bytes written, or -1 on error.
+ */
+ssize_t aes_pwrite(aes_file *file, const void *buffer, size_t length, off_t offset)
+{
+    unsigned char batch[AESFILE_BATCH_BLOCKS * BLOCK_SIZE];
+    struct stat st;
+    if (file->ctx.mode != STREAM_ECB && file->ctx.mode != STREAM_CTR)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (fstat(file->fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (offset < 0 || offset > (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    off_t first = offset / BLOCK_SIZE;
+    off_t last = (offset + (off_t)length - 1) / BLOCK_SIZE;
+    size_t done = 0;
+    for (off_t block = first; block <= last;)
+    {
+        size_t count = (size_t)(last - block + 1);
+        if (count > AESFILE_BATCH_BLOCKS)
+        {
+            count = AESFILE_BATCH_BLOCKS;
+        }
+        size_t size = count * BLOCK_SIZE;
+        size_t skip = block == first ? (size_t)(offset - first * BLOCK_SIZE) : 0;
+        size_t take = size - skip;
+        if (take > length - done)
+        {
+            take = length - done;
+        }
+        stream_ctx ctx;
+        if (skip != 0 || skip + take != size)
+        {
+            // Partial edge block: keep the plaintext around the range.
+            ssize_t n = pread_full(file->fd, batch, size, block * BLOCK_SIZE);
+            if (n < 0)
+            {
+                return -1;
+            }
+            size_t whole = (size_t)n / BLOCK_SIZE * BLOCK_SIZE;
+            memset(batch + whole, 0, size - whole);
+            aes_file_seek_ctx(file, block, NULL, &ctx);
+            if (whole > 0 && stream_update(&ctx, batch, batch, whole) != EXIT_SUCCESS)
+            {
+                errno = EIO;
+                return -1;
+            }
+        }
+        memcpy(batch + skip, (const unsigned char *)buffer + done, take);
+        aes_file_seek_ctx(file, block, NULL, &ctx);
+        ctx.encrypt = true;
+        if (stream_update(&ctx, batch, batch, size) != EXIT_SUCCESS)
+        {
+            errno = EIO;
+            return -1;
+        }
+        if (pwrite_all(file->fd, batch, size, block * BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+        done += take;
+        block += (off_t)count;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Closes the file and releases it.
+ *
+ * @return 0 on success, -1 if closing the descriptor failed.
+ */
+int aes_file_close(aes_file *file)
+{
+    int result = 0;
+    if (close(file->fd) != 0)
+    {
+        result = -1;
+    }
+    free(file);
+    return result;
+}
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/appendlog.h"
+#include "../include/stream.h"
+#include "../include/CTR.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+// What the trailer of a log records.
+typedef struct
+{
+    uint64_t length;                 // Plaintext bytes in the log
+    unsigned char chain[BLOCK_SIZE]; // Chaining state before the block holding byte length - length % BLOCK_SIZE
+} append_log_state;
+
+static void append_log_pack(const stream_ctx *ctx, const append_log_state *state, unsigned char *trailer)
+{
+    memset(trailer, 0, APPENDLOG_TRAILER_SIZE);
+    memcpy(trailer, APPENDLOG_MAGIC, sizeof(APPENDLOG_MAGIC));
+    trailer[8] = (unsigned char)ctx->mode;
+    for (int i = 0; i < 8; i++)
+    {
+        trailer[16 + i] = (unsigned char)(state->length >> (8 * i));
+    }
+    memcpy(trailer + 24, state->chain, BLOCK_SIZE);
+}
+
+// CFB and CTR logs are stored unpadded: their last block is completed in place.
+static bool append_log_unpadded(const stream_ctx *ctx)
+{
+    return ctx->mode == STREAM_CFB || ctx->mode == STREAM_CTR;
+}
+
+// The bytes of ciphertext that hold length bytes of data.
+static uint64_t append_log_stored(const stream_ctx *ctx, uint64_t length)
+{
+    return append_log_unpadded(ctx) ? length : (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+/**
+ * @brief The CFB or CTR keystream of the block that starts from the chaining state of ctx.
+ */
+static int append_log_keystream(const stream_ctx *ctx, unsigned char *keystream)
+{
+    stream_ctx block = *ctx;
+    block.encrypt = true;
+    memset(keystream, 0, BLOCK_SIZE);
+    return stream_update(&block, keystream, keystream, BLOCK_SIZE);
+}
+
+// Moves the chaining state of a CFB or CTR context past the block just completed.
+static void append_log_advance(stream_ctx *ctx, const unsigned char *cipher)
+{
+    if (ctx->mode == STREAM_CTR)
+    {
+        CTR_increment(ctx->chain, 1);
+    }
+    else
+    {
+        memcpy(ctx->chain, cipher, BLOCK_SIZE);
+    }
+}
+
+/**
+ * @brief Reads the trailer of a log and checks it against the file size.
+ *
+ * An empty file is an empty log whose chaining state is the IV of ctx.
+ *
+ * @param ctx    The context of the log (mode and IV).
+ * @param fd     The log file.
+ * @param state  Filled with the trailer content.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int append_log_state_read(const stream_ctx *ctx, int fd, append_log_state *state)
+{
+    unsigned char trailer[APPENDLOG_TRAILER_SIZE];
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        printf("The log must be a regular file.\n");
+        return EXIT_FAILURE;
+    }
+    if (st.st_size == 0)
+    {
+        state->length = 0;
+        memcpy(state->chain, ctx->chain, BLOCK_SIZE);
+        return EXIT_SUCCESS;
+    }
+    if (st.st_size < APPENDLOG_TRAILER_SIZE ||
+        pread_full(fd, trailer, APPENDLOG_TRAILER_SIZE, st.st_size - APPENDLOG_TRAILER_SIZE) != APPENDLOG_TRAILER_SIZE ||
+        memcmp(trailer, APPENDLOG_MAGIC, sizeof(APPENDLOG_MAGIC)) != 0)
+    {
+        printf("The file is not an encrypted log.\n");
+        return EXIT_FAILURE;
+    }
+    if (trailer[8] != (unsigned char)ctx->mode)
+    {
+        printf("The log was written with another mode.\n");
+        return EXIT_FAILURE;
+    }
+    state->length = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        state->length = (state->length << 8) | trailer[16 + i];
+    }
+    memcpy(state->chain, trailer + 24, BLOCK_SIZE);
+    if (append_log_stored(ctx, state->length) != (uint64_t)st.st_size - APPENDLOG_TRAILER_SIZE)
+    {
+        printf("The log trailer does not match the file size.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Appends the input to an encrypted log in O(input size).
+ *
+ * Encryption resumes from the chaining state saved in the trailer (the last
+ * ciphertext block in CBC and CFB, the counter in CTR), so the log is the
+ * encryption of all its records at once. CFB and CTR logs are not padded: a
+ * partial last block is completed by encrypting the new bytes with the rest
+ * of its keystream, and ciphertext already in the log is never rewritten, as
+ * writing it again under the same keystream would give away the XOR of the
+ * old and new plaintext. An ECB or CBC log ends with a zero-padded block,
+ * which is decrypted, completed with the new data and encrypted again from
+ * the same state; earlier blocks are never read. The trailer is rewritten
+ * after the new data.
+ *
+ * @param ctx         The encryption context (mode, round keys, IV of an empty log).
+ * @param in_fd       The data to append.
+ * @param log_fd      The log, opened read-write.
+ * @param chunk_size  The bytes read from the input at once.
+ * @param bytes_out   Set to the number of bytes appended.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int append_log_write(const stream_ctx *ctx, int in_fd, int log_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    append_log_state state;
+    if (append_log_state_read(ctx, log_fd, &state) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    unsigned char *buffer = (unsigned char *)malloc(chunk_size + BLOCK_SIZE + APPENDLOG_TRAILER_SIZE);
+    if (buffer == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+
+    stream_ctx running = *ctx;
+    running.encrypt = true;
+    memcpy(running.chain, state.chain, BLOCK_SIZE);
+    uint64_t position = state.length / BLOCK_SIZE * BLOCK_SIZE; // Log offset of buffer[0]
+    size_t fill = (size_t)(state.length - position);
+    size_t kept = 0;   // Bytes at the start of buffer that are already ciphertext in the log
+    bool ended = false; // The input ended inside the partial last block
+    int status = EXIT_SUCCESS;
+    *bytes_out = 0;
+    if (fill > 0 && append_log_unpadded(ctx))
+    {
+        // Complete the partial last block in place.
+        unsigned char keystream[BLOCK_SIZE];
+        if (pread_full(log_fd, buffer, fill, (off_t)position) != (ssize_t)fill || append_log_keystream(&running, keystream) != EXIT_SUCCESS)
+        {
+            printf("Failed to read the end of the log.\n");
+            free(buffer);
+            return EXIT_FAILURE;
+        }
+        ssize_t n = read_full(in_fd, buffer + fill, BLOCK_SIZE - fill);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            free(buffer);
+            return EXIT_FAILURE;
+        }
+        for (size_t i = fill; i < fill + (size_t)n; i++)
+        {
+            buffer[i] ^= keystream[i];
+        }
+        kept = fill;
+        fill += (size_t)n;
+        *bytes_out = (unsigned long long)n;
+        if (fill == BLOCK_SIZE)
+        {
+            if (pwrite_all(log_fd, buffer + kept, BLOCK_SIZE - kept, (off_t)(position + kept)) != 0)
+            {
+                printf("Failed to write the log.\n");
+                free(buffer);
+                return EXIT_FAILURE;
+            }
+            append_log_advance(&running, buffer);
+            position += BLOCK_SIZE;
+            fill = 0;
+            kept = 0;
+        }
+        else
+        {
+            ended = true;
+        }
+    }
+    else if (fill > 0)
+    {
+        // Recover the plaintext of the padded last block.
+        stream_ctx decrypt = running;
+        decrypt.encrypt = false;
+        if (pread_full(log_fd, buffer, BLOCK_SIZE, (off_t)position) != BLOCK_SIZE ||
+            stream_update(&decrypt, buffer, buffer, BLOCK_SIZE) != EXIT_SUCCESS)
+        {
+            printf("Failed to read the end of the log.\n");
+            free(buffer);
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (!ended)
+    {
+        ssize_t n = read_full(in_fd, buffer + fill, chunk_size - fill);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        fill += (size_t)n;
+        *bytes_out += (unsigned long long)n;
+        if (fill < chunk_size)
+        {
+            break;
+        }
+        if (stream_update(&running, buffer, buffer, chunk_size) != EXIT_SUCCESS ||
+            pwrite_all(log_fd, buffer, chunk_size, (off_t)position) != 0)
+        {
+            printf("Failed to write the log.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        position += chunk_size;
+        fill = 0;
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        // The whole blocks, then the partial block, whose starting state goes
+        // to the trailer, then the trailer itself.
+        size_t whole = fill / BLOCK_SIZE * BLOCK_SIZE;
+        size_t padded = (fill + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        size_t stored = (size_t)append_log_stored(ctx, fill);
+        if (!ended)
+        {
+            memset(buffer + fill, 0, padded - fill);
+            status = stream_update(&running, buffer, buffer, whole);
+        }
+        state.length = position + fill;
+        memcpy(state.chain, running.chain, BLOCK_SIZE);
+        if (status == EXIT_SUCCESS && !ended && fill > whole)
+        {
+            unsigned char keystream[BLOCK_SIZE];
+            if (!append_log_unpadded(ctx))
+            {
+                status = stream_update(&running, buffer + whole, buffer + whole, BLOCK_SIZE);
+            }
+            else if ((status = append_log_keystream(&running, keystream)) == EXIT_SUCCESS)
+            {
+                for (size_t i = whole; i < fill; i++)
+                {
+                    buffer[i] ^= keystream[i - whole];
+                }
+            }
+        }
+        append_log_pack(ctx, &state, buffer + stored);
+        if (status != EXIT_SUCCESS ||
+            pwrite_all(log_fd, buffer + kept, stored - kept + APPENDLOG_TRAILER_SIZE, (off_t)(position + kept)) != 0)
+        {
+            printf("Failed to write the log.\n");
+            status = EXIT_FAILURE;
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+/**
+ * @brief Decrypts a whole log, without the padding of an ECB or CBC log.
+ *
+ * @param ctx         The decryption context (mode, round keys, IV).
+ * @param log_fd      The log.
+ * @param out_fd      The output.
+ * @param chunk_size  The bytes decrypted at once.
+ * @param bytes_out   Set to the number of plaintext bytes written.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int append_log_read(const stream_ctx *ctx, int log_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    append_log_state state;
+    if (append_log_state_read(ctx, log_fd, &state) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    unsigned char *buffer = (unsigned char *)malloc(chunk_size);
+    if (buffer == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    stream_ctx running = *ctx;
+    running.encrypt = false;
+    int status = EXIT_SUCCESS;
+    *bytes_out = 0;
+    for (uint64_t position = 0; position < state.length;)
+    {
+        uint64_t left = state.length - position;
+        size_t length = left < chunk_size ? (size_t)left : chunk_size;
+        size_t padded = (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        size_t stored = (size_t)append_log_stored(ctx, length);
+        memset(buffer + stored, 0, padded - stored);
+        if (pread_full(log_fd, buffer, stored, (off_t)position) != (ssize_t)stored ||
+            stream_update(&running, buffer, buffer, padded) != EXIT_SUCCESS ||
+            write_all(out_fd, buffer, length) != 0)
+        {
+            printf("Failed to decrypt the log.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        position += length;
+        *bytes_out += length;
+    }
+    free(buffer);
+    return status;
+}
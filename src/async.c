@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "../include/async.h"
+#include "../include/ring.h"
+#include "../include/ECB.h"
+#include "../include/CTR.h"
+#include "../include/stream.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+#define ASYNC_SPINS 64 // Polls of an empty queue before a worker sleeps
+
+struct aes_async
+{
+    mpmc_ring jobs;
+    int event_fd;
+    aes_job *completed; // Stack of completed jobs, newest first
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int idle; // Workers sleeping on ready
+    bool stop;
+    pthread_t *threads;
+    int num_workers;
+};
+
+// Blocks of small ECB or CTR jobs with the same key, gathered for one cipher call.
+typedef struct
+{
+    const key_schedule *key;
+    bool encrypt;
+    bool ctr;
+    unsigned char *round_keys[AES_MAX_ROUND_KEYS + 1];
+    size_t count;
+    unsigned char *in[STREAM_BATCH_BLOCKS];
+    unsigned char *out[STREAM_BATCH_BLOCKS];
+    unsigned char counters[STREAM_BATCH_BLOCKS][BLOCK_SIZE]; // CTR: counter blocks, then keystream
+    unsigned char *counter_blocks[STREAM_BATCH_BLOCKS];
+} async_gather;
+
+/**
+ * @brief Runs the cipher on the gathered blocks: one ECB call over all of them.
+ *
+ * In CTR the counter blocks are encrypted in that call and XORed with the data.
+ */
+static void async_gather_flush(async_gather *gather)
+{
+    size_t num_out;
+    if (gather->count == 0)
+    {
+        return;
+    }
+    stream_mode mode = gather->ctr ? STREAM_CTR : STREAM_ECB;
+    AES_PROBE3(chunk_start, AES_ENGINE_ASYNC, mode, gather->count * BLOCK_SIZE);
+    if (gather->ctr)
+    {
+        ECB_cipher(gather->round_keys, gather->counter_blocks, gather->count, gather->counter_blocks, &num_out, gather->key->Nr);
+        for (size_t b = 0; b < gather->count; b++)
+        {
+            for (int i = 0; i < BLOCK_SIZE; i++)
+            {
+                gather->out[b][i] = gather->in[b][i] ^ gather->counters[b][i];
+            }
+        }
+    }
+    else if (gather->encrypt)
+    {
+        ECB_cipher(gather->round_keys, gather->in, gather->count, gather->out, &num_out, gather->key->Nr);
+    }
+    else
+    {
+        ECB_decipher(gather->round_keys, gather->in, gather->count, gather->out, &num_out, gather->key->Nr);
+    }
+    AES_PROBE3(chunk_end, AES_ENGINE_ASYNC, mode, gather->count * BLOCK_SIZE);
+    gather->count = 0;
+}
+
+/**
+ * @brief Adds the blocks of a small ECB or CTR job, flushing when the key, direction or mode changes or the batch is full.
+ */
+static void async_gather_job(async_gather *gather, aes_job *job)
+{
+    bool ctr = job->mode == STREAM_CTR;
+    bool encrypt = ctr || job->encrypt; // CTR decryption is encryption
+    if (gather->key != job->key || gather->ctr != ctr || gather->encrypt != encrypt)
+    {
+        async_gather_flush(gather);
+        gather->key = job->key;
+        gather->ctr = ctr;
+        gather->encrypt = encrypt;
+        for (size_t i = 0; i < job->key->Nr; i++)
+        {
+            gather->round_keys[i] = (unsigned char *)job->key->round_keys[i];
+        }
+    }
+    unsigned char counter[BLOCK_SIZE];
+    memcpy(counter, job->iv, BLOCK_SIZE);
+    for (size_t offset = 0; offset < job->length; offset += BLOCK_SIZE)
+    {
+        if (gather->count == STREAM_BATCH_BLOCKS)
+        {
+            async_gather_flush(gather);
+        }
+        size_t b = gather->count++;
+        gather->in[b] = (unsigned char *)job->in + offset;
+        gather->out[b] = job->out + offset;
+        if (ctr)
+        {
+            memcpy(gather->counters[b], counter, BLOCK_SIZE);
+            CTR_increment(counter, 1);
+        }
+    }
+    job->status = EXIT_SUCCESS;
+}
+
+/**
+ * @brief Runs a batch of jobs and sets their status.
+ *
+ * Small ECB and CTR jobs are gathered into shared cipher calls, so
+ * consecutive jobs under the same key share them; the others run through
+ * stream_update one by one. Jobs with a NULL key are skipped.
+ */
+static void async_process(aes_job **jobs, size_t count)
+{
+    async_gather gather;
+    gather.key = NULL;
+    gather.count = 0;
+    for (size_t b = 0; b < STREAM_BATCH_BLOCKS; b++)
+    {
+        gather.counter_blocks[b] = gather.counters[b];
+    }
+    for (size_t j = 0; j < count; j++)
+    {
+        aes_job *job = jobs[j];
+        AES_PROBE2(job_dequeue, AES_ENGINE_ASYNC, job->length);
+        if (job->key == NULL)
+        {
+            continue;
+        }
+        if ((job->mode == STREAM_ECB || job->mode == STREAM_CTR) && job->length <= ASYNC_SMALL_JOB)
+        {
+            async_gather_job(&gather, job);
+            continue;
+        }
+        unsigned char *round_keys[AES_MAX_ROUND_KEYS + 1];
+        stream_ctx ctx;
+        key_schedule_ctx(job->key, round_keys, job->mode, job->encrypt, job->iv, &ctx);
+        AES_PROBE3(chunk_start, AES_ENGINE_ASYNC, job->mode, job->length);
+        job->status = stream_update(&ctx, job->in, job->out, job->length) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        AES_PROBE3(chunk_end, AES_ENGINE_ASYNC, job->mode, job->length);
+    }
+    async_gather_flush(&gather);
+}
+
+/**
+ * @brief Processes a batch of jobs and publishes their completions with one eventfd write.
+ */
+static void async_run_batch(aes_async *engine, aes_job **jobs, size_t count)
+{
+    async_process(jobs, count);
+
+    // Chain the batch and push it on the completed stack at once.
+    for (size_t j = 0; j + 1 < count; j++)
+    {
+        jobs[j]->next = jobs[j + 1];
+    }
+    aes_job *head = __atomic_load_n(&engine->completed, __ATOMIC_RELAXED);
+    do
+    {
+        jobs[count - 1]->next = head;
+    } while (!__atomic_compare_exchange_n(&engine->completed, &head, jobs[0], true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // The eventfd is already readable if the stack was not empty: aes_poll has not drained it yet.
+    if (head == NULL)
+    {
+        uint64_t one = 1;
+        ssize_t written = write(engine->event_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+static void *async_worker(void *arg)
+{
+    aes_async *engine = (aes_async *)arg;
+    aes_job *jobs[ASYNC_BATCH_JOBS];
+    int spins = 0;
+    for (;;)
+    {
+        size_t count = 0;
+        void *job;
+        while (count < ASYNC_BATCH_JOBS && mpmc_try_pop(&engine->jobs, &job))
+        {
+            jobs[count++] = (aes_job *)job;
+        }
+        if (count > 0)
+        {
+            async_run_batch(engine, jobs, count);
+            spins = 0;
+            continue;
+        }
+        if (++spins < ASYNC_SPINS)
+        {
+            sched_yield();
+            continue;
+        }
+        // Idle: sleep until aes_submit sees a sleeper and signals.
+        pthread_mutex_lock(&engine->lock);
+        __atomic_add_fetch(&engine->idle, 1, __ATOMIC_SEQ_CST);
+        bool found = false;
+        while (!engine->stop && !(found = mpmc_try_pop(&engine->jobs, &job)))
+        {
+            pthread_cond_wait(&engine->ready, &engine->lock);
+        }
+        __atomic_sub_fetch(&engine->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&engine->lock);
+        if (found)
+        {
+            jobs[0] = (aes_job *)job;
+            async_run_batch(engine, jobs, 1);
+        }
+        else
+        {
+            break; // Stopped with an empty queue
+        }
+        spins = 0;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts an engine: a pool of workers fed by a lock-free job queue.
+ *
+ * @param num_workers  The number of workers.
+ * @return The engine, or NULL on failure.
+ */
+aes_async *aes_async_create(int num_workers)
+{
+    aes_async *engine = (aes_async *)calloc(1, sizeof(aes_async));
+    if (engine == NULL || mpmc_init(&engine->jobs, ASYNC_QUEUE_SIZE) != 0)
+    {
+        printf("Memory allocation failed.\n");
+        free(engine);
+        return NULL;
+    }
+    engine->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    engine->threads = (pthread_t *)calloc((size_t)num_workers, sizeof(pthread_t));
+    if (engine->event_fd < 0 || engine->threads == NULL)
+    {
+        printf("Failed to create the completion eventfd.\n");
+        aes_async_destroy(engine);
+        return NULL;
+    }
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->ready, NULL);
+    for (int w = 0; w < num_workers; w++)
+    {
+        if (pthread_create(&engine->threads[w], NULL, async_worker, engine) != 0)
+        {
+            printf("Failed to start the workers.\n");
+            aes_async_destroy(engine);
+            return NULL;
+        }
+        engine->num_workers++;
+    }
+    return engine;
+}
+
+/**
+ * @brief The eventfd of the engine: readable when completed jobs wait for aes_poll.
+ *
+ * Add it to epoll (EPOLLIN) or poll; aes_poll drains it.
+ */
+int aes_async_fd(const aes_async *engine)
+{
+    return engine->event_fd;
+}
+
+/**
+ * @brief Queues a job without blocking.
+ *
+ * A sleeping worker is woken only if all of them went idle; while they are
+ * busy, submitting costs no system call.
+ *
+ * @param engine  The engine.
+ * @param job     The job, owned by the engine until its completion is polled.
+ * @return EXIT_SUCCESS if the job is queued, EXIT_FAILURE if it is invalid or the queue is full (poll and retry).
+ */
+int aes_submit(aes_async *engine, aes_job *job)
+{
+    AES_PROBE2(job_queue, AES_ENGINE_ASYNC, job->length);
+    if (job->key == NULL || job->length % BLOCK_SIZE != 0 || job->mode > STREAM_CTR || !mpmc_try_push(&engine->jobs, job))
+    {
+        return EXIT_FAILURE;
+    }
+    // Order the push before the idle check (paired with the increment in async_worker).
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&engine->idle, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&engine->lock);
+        pthread_cond_signal(&engine->ready);
+        pthread_mutex_unlock(&engine->lock);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Runs the callbacks of the completed jobs, in completion order. Never blocks.
+ *
+ * Call it from one thread, when the eventfd is readable or from time to time.
+ *
+ * @return The number of completed jobs.
+ */
+int aes_poll(aes_async *engine)
+{
+    uint64_t value;
+    // Drain the eventfd before taking the stack, so a completion pushed after is signalled again.
+    ssize_t result = read(engine->event_fd, &value, sizeof(value));
+    (void)result;
+    aes_job *job = __atomic_exchange_n(&engine->completed, NULL, __ATOMIC_ACQUIRE);
+    aes_job *ordered = NULL;
+    while (job != NULL)
+    {
+        aes_job *next = job->next;
+        job->next = ordered;
+        ordered = job;
+        job = next;
+    }
+    int count = 0;
+    while (ordered != NULL)
+    {
+        aes_job *next = ordered->next;
+        if (ordered->callback != NULL)
+        {
+            ordered->callback(ordered, ordered->arg);
+        }
+        ordered = next;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Stops an engine once the queued jobs are processed, and frees it.
+ *
+ * Poll the last completions before: their callbacks are not run.
+ */
+void aes_async_destroy(aes_async *engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+    if (engine->num_workers > 0)
+    {
+        pthread_mutex_lock(&engine->lock);
+        engine->stop = true;
+        pthread_cond_broadcast(&engine->ready);
+        pthread_mutex_unlock(&engine->lock);
+        for (int w = 0; w < engine->num_workers; w++)
+        {
+            pthread_join(engine->threads[w], NULL);
+        }
+        pthread_mutex_destroy(&engine->lock);
+        pthread_cond_destroy(&engine->ready);
+    }
+    if (engine->event_fd >= 0)
+    {
+        close(engine->event_fd);
+    }
+    mpmc_free(&engine->jobs);
+    free(engine->threads);
+    free(engine);
+}
+
+static int compare_batch_items(const void *a, const void *b)
+{
+    const aes_batch_item *x = *(const aes_batch_item *const *)a;
+    const aes_batch_item *y = *(const aes_batch_item *const *)b;
+    if (x->key_id != y->key_id)
+    {
+        return x->key_id < y->key_id ? -1 : 1;
+    }
+    return x < y ? -1 : (x > y ? 1 : 0); // Keep the submission order within a key
+}
+
+/**
+ * @brief Encrypts or decrypts many buffers under many keys, in the calling thread.
+ *
+ * The items are grouped by key id, the schedules of all the groups are
+ * looked up in the cache at once (the misses are expanded together), and
+ * the jobs of each group run one after the other, so small ECB and CTR jobs
+ * of a key share cipher calls. Items with key id 0 are not cached and form
+ * a group each. An item whose key differs from the one the first keyed item
+ * of its key id gave fails, rather than running under the wrong key.
+ *
+ * @param cache  The cache of key schedules.
+ * @param items  The items; the job key and callback are ignored, the job status is set.
+ * @param count  The number of items.
+ * @return EXIT_SUCCESS if every item succeeded, EXIT_FAILURE otherwise.
+ */
+int aes_batch(keycache *cache, aes_batch_item *items, size_t count)
+{
+    if (count == 0)
+    {
+        return EXIT_SUCCESS;
+    }
+    aes_batch_item **sorted = (aes_batch_item **)malloc(count * sizeof(aes_batch_item *));
+    aes_job **jobs = (aes_job **)malloc(count * sizeof(aes_job *));
+    keycache_request *requests = (keycache_request *)malloc(count * sizeof(keycache_request));
+    key_schedule *schedules = (key_schedule *)malloc(count * sizeof(key_schedule));
+    keycache_status *statuses = (keycache_status *)malloc(count * sizeof(keycache_status));
+    size_t *group_of = (size_t *)malloc(count * sizeof(size_t));
+    if (sorted == NULL || jobs == NULL || requests == NULL || schedules == NULL || statuses == NULL || group_of == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(sorted);
+        free(jobs);
+        free(requests);
+        free(schedules);
+        free(statuses);
+        free(group_of);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        sorted[i] = &items[i];
+    }
+    qsort(sorted, count, sizeof(aes_batch_item *), compare_batch_items);
+
+    // One lookup per key id; the first item of a group that carries the key
+    // provides it, and the other keyed items must give the same bytes.
+    size_t groups = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        aes_batch_item *item = sorted[i];
+        bool same = groups > 0 && item->key_id != 0 && requests[groups - 1].key_id == item->key_id;
+        if (!same)
+        {
+            requests[groups].key_id = item->key_id;
+            requests[groups].key = NULL;
+            requests[groups].key_length = 0;
+            groups++;
+        }
+        keycache_request *request = &requests[groups - 1];
+        group_of[i] = groups - 1;
+        if (item->key == NULL || item->key_length == 0)
+        {
+            continue;
+        }
+        if (request->key == NULL)
+        {
+            request->key = item->key;
+            request->key_length = item->key_length;
+        }
+        else if (request->key_length != item->key_length || memcmp(request->key, item->key, item->key_length) != 0)
+        {
+            group_of[i] = SIZE_MAX; // Fails below
+        }
+    }
+    keycache_get_many(cache, requests, groups, schedules, statuses);
+
+    int result = EXIT_SUCCESS;
+    for (size_t i = 0; i < count; i++)
+    {
+        aes_job *job = &sorted[i]->job;
+        bool valid = group_of[i] != SIZE_MAX && statuses[group_of[i]] == KEYCACHE_OK && job->length % BLOCK_SIZE == 0 && job->mode <= STREAM_CTR;
+        job->key = valid ? &schedules[group_of[i]] : NULL;
+        job->status = EXIT_FAILURE;
+        jobs[i] = job;
+    }
+    async_process(jobs, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (jobs[i]->status != EXIT_SUCCESS)
+        {
+            result = EXIT_FAILURE;
+        }
+        jobs[i]->key = NULL; // The schedules are freed below
+    }
+    free(sorted);
+    free(jobs);
+    free(requests);
+    free(schedules);
+    free(statuses);
+    free(group_of);
+    return result;
+}
@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/batch.h"
+#include "../include/stream.h"
+#include "../include/pipeline.h"
+#include "../include/CTR.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+// A file of the batch.
+typedef struct
+{
+    char *input;
+    char *output;
+    uint64_t size;
+    bool split;           // Processed as several chunk tasks sharing the descriptors below
+    int in_fd;
+    int out_fd;
+    FILE *out_file;
+    unsigned int pending; // Chunk tasks not finished yet (split files)
+    bool failed;
+} batch_file;
+
+// A unit of work: a whole file, or one chunk of a split file.
+typedef struct
+{
+    batch_file *file;
+    uint64_t offset;
+    uint64_t length;
+} batch_task;
+
+// The tasks of one worker: it takes from the back, thieves from the front.
+typedef struct
+{
+    pthread_mutex_t lock;
+    batch_task *tasks;
+    size_t head;
+    size_t tail;
+} batch_deque;
+
+typedef struct
+{
+    const stream_ctx *ctx;
+    size_t chunk_size;
+    int num_workers;
+    batch_deque *deques;
+    unsigned long long bytes; // Input bytes processed
+    unsigned long long failures;
+    unsigned long long steals;
+} batch_pool;
+
+typedef struct
+{
+    batch_pool *pool;
+    int index;
+} batch_worker;
+
+// The files collected from the list or the directory.
+typedef struct
+{
+    batch_file *files;
+    size_t count;
+    size_t capacity;
+} batch_list;
+
+static int batch_add(batch_list *list, const char *input, const char *output)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        batch_file *files = (batch_file *)realloc(list->files, capacity * sizeof(batch_file));
+        if (files == NULL)
+        {
+            printf("Memory allocation failed.\n");
+            return EXIT_FAILURE;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+    batch_file *file = &list->files[list->count];
+    memset(file, 0, sizeof(*file));
+    file->input = strdup(input);
+    file->output = strdup(output);
+    file->in_fd = -1;
+    if (file->input == NULL || file->output == NULL)
+    {
+        free(file->input);
+        free(file->output);
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    list->count++;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reads a manifest of "input<TAB>output" lines; empty lines and lines starting with # are skipped.
+ */
+static int batch_read_manifest(const char *path, batch_list *list)
+{
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL)
+    {
+        printf("Failed to open the batch list %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    unsigned long long number = 0;
+    int status = EXIT_SUCCESS;
+    while (status == EXIT_SUCCESS && (length = getline(&line, &capacity, manifest)) != -1)
+    {
+        number++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#')
+        {
+            continue;
+        }
+        char *tab = strchr(line, '\t');
+        if (tab == NULL || tab == line || tab[1] == '\0')
+        {
+            fprintf(stderr, "%s:%llu: expected \"input<TAB>output\", line skipped.\n", path, number);
+            continue;
+        }
+        *tab = '\0';
+        status = batch_add(list, line, tab + 1);
+    }
+    free(line);
+    fclose(manifest);
+    return status;
+}
+
+/**
+ * @brief Creates a directory and its missing parents.
+ */
+static int make_directories(const char *path)
+{
+    char buffer[strlen(path) + 1];
+    strcpy(buffer, path);
+    for (char *p = buffer + 1; *p != '\0'; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            if (mkdir(buffer, 0755) != 0 && errno != EEXIST)
+            {
+                return EXIT_FAILURE;
+            }
+            *p = '/';
+        }
+    }
+    return mkdir(buffer, 0755) != 0 && errno != EEXIST ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Adds the regular files under a directory, recursively, with the same relative path under output_dir.
+ */
+static int batch_read_directory(const char *input_dir, const char *output_dir, batch_list *list)
+{
+    DIR *dir = opendir(input_dir);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Failed to read the directory %s.\n", input_dir);
+        return EXIT_SUCCESS; // Reported, the rest of the batch goes on
+    }
+    if (make_directories(output_dir) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create the directory %s.\n", output_dir);
+        closedir(dir);
+        return EXIT_SUCCESS;
+    }
+    int status = EXIT_SUCCESS;
+    struct dirent *entry;
+    while (status == EXIT_SUCCESS && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t in_length = strlen(input_dir) + strlen(entry->d_name) + 2;
+        size_t out_length = strlen(output_dir) + strlen(entry->d_name) + 2;
+        char input[in_length];
+        char output[out_length];
+        snprintf(input, in_length, "%s/%s", input_dir, entry->d_name);
+        snprintf(output, out_length, "%s/%s", output_dir, entry->d_name);
+        struct stat st;
+        if (lstat(input, &st) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            status = batch_read_directory(input, output, list);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            status = batch_add(list, input, output);
+        }
+    }
+    closedir(dir);
+    return status;
+}
+
+static void batch_fail(batch_pool *pool, batch_file *file, const char *what)
+{
+    fprintf(stderr, "Failed: %s (%s)\n", file->input, what);
+    __atomic_fetch_add(&pool->failures, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Processes a whole file with the worker buffer.
+ */
+static void batch_whole_file(batch_pool *pool, batch_file *file, unsigned char *buffer)
+{
+    int in_fd = open(file->input, O_RDONLY);
+    if (in_fd < 0)
+    {
+        batch_fail(pool, file, "cannot open the input");
+        return;
+    }
+    FILE *out_file = open_output_file(file->output);
+    if (out_file == NULL)
+    {
+        close(in_fd);
+        batch_fail(pool, file, "cannot open the output");
+        return;
+    }
+    stream_ctx ctx = *pool->ctx;
+    const char *error = NULL;
+    for (;;)
+    {
+        ssize_t n = read_full(in_fd, buffer, pool->chunk_size);
+        if (n < 0)
+        {
+            error = "read error";
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        size_t padded = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(buffer + n, 0, padded - (size_t)n);
+        if (stream_update(&ctx, buffer, buffer, padded) != EXIT_SUCCESS || write_all(fileno(out_file), buffer, padded) != 0)
+        {
+            error = "write error";
+            break;
+        }
+        __atomic_fetch_add(&pool->bytes, (unsigned long long)n, __ATOMIC_RELAXED);
+        if ((size_t)n < pool->chunk_size)
+        {
+            break;
+        }
+    }
+    close(in_fd);
+    if (fclose(out_file) != 0 && error == NULL)
+    {
+        error = "write error";
+    }
+    if (error != NULL)
+    {
+        batch_fail(pool, file, error);
+    }
+}
+
+/**
+ * @brief Processes one chunk of a split file, at the same offset in the output.
+ *
+ * The chunk starts from the chaining state at its offset: the counter moved
+ * forward in CTR, the previous ciphertext block when decrypting CBC or CFB.
+ */
+static void batch_chunk(batch_pool *pool, const batch_task *task, unsigned char *buffer)
+{
+    batch_file *file = task->file;
+    stream_ctx ctx = *pool->ctx;
+    bool ok = true;
+    if (task->offset > 0 && ctx.mode == STREAM_CTR)
+    {
+        CTR_increment(ctx.chain, (size_t)(task->offset / BLOCK_SIZE));
+    }
+    else if (task->offset > 0 && ctx.mode != STREAM_ECB)
+    {
+        unsigned char previous[BLOCK_SIZE];
+        ok = pread_full(file->in_fd, previous, BLOCK_SIZE, (off_t)(task->offset - BLOCK_SIZE)) == BLOCK_SIZE;
+        stream_skip(&ctx, previous, BLOCK_SIZE);
+    }
+    size_t padded = ((size_t)task->length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (ok)
+    {
+        ok = pread_full(file->in_fd, buffer, (size_t)task->length, (off_t)task->offset) == (ssize_t)task->length;
+    }
+    if (ok)
+    {
+        memset(buffer + task->length, 0, padded - (size_t)task->length);
+        ok = stream_update(&ctx, buffer, buffer, padded) == EXIT_SUCCESS &&
+             pwrite_all(file->out_fd, buffer, padded, (off_t)task->offset) == 0;
+    }
+    if (ok)
+    {
+        __atomic_fetch_add(&pool->bytes, task->length, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(&file->failed, true, __ATOMIC_RELAXED);
+    }
+    // The last chunk to finish closes the file and reports it.
+    if (__atomic_sub_fetch(&file->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(file->in_fd);
+        if (fclose(file->out_file) != 0)
+        {
+            file->failed = true;
+        }
+        if (file->failed)
+        {
+            batch_fail(pool, file, "read or write error");
+        }
+    }
+}
+
+static bool batch_pop(batch_deque *deque, batch_task *task, bool steal)
+{
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail)
+    {
+        *task = steal ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * @brief Worker: runs its own tasks, then steals from the other workers until none are left.
+ */
+static void *batch_work(void *arg)
+{
+    batch_worker *worker = (batch_worker *)arg;
+    batch_pool *pool = worker->pool;
+    unsigned char *buffer = (unsigned char *)malloc(pool->chunk_size);
+    if (buffer == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return NULL; // The other workers steal its tasks
+    }
+    batch_task task;
+    for (;;)
+    {
+        bool found = batch_pop(&pool->deques[worker->index], &task, false);
+        for (int i = 1; !found && i < pool->num_workers; i++)
+        {
+            found = batch_pop(&pool->deques[(worker->index + i) % pool->num_workers], &task, true);
+            if (found)
+            {
+                __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if (!found)
+        {
+            break; // No task is ever added once the workers run
+        }
+        if (task.file->split)
+        {
+            batch_chunk(pool, &task, buffer);
+        }
+        else
+        {
+            batch_whole_file(pool, task.file, buffer);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int batch_compare_size(const void *a, const void *b)
+{
+    const batch_file *fa = (const batch_file *)a;
+    const batch_file *fb = (const batch_file *)b;
+    return fa->size < fb->size ? 1 : (fa->size > fb->size ? -1 : 0);
+}
+
+/**
+ * @brief Encrypts or decrypts many files with one key expansion and a work-stealing pool.
+ *
+ * The files come from a list of "input<TAB>output" lines or, if list is a
+ * directory, from the tree under it, mirrored under output_dir. Tasks are
+ * dealt largest first to the workers' deques; an idle worker steals from the
+ * others. In the parallel modes (see stream_is_parallel), files larger than
+ * BATCH_SPLIT_CHUNKS chunks are split into chunk tasks. A file that fails is
+ * reported and the batch goes on.
+ *
+ * @param ctx          The streaming context (mode, direction, round keys, IV).
+ * @param list         The list file or input directory.
+ * @param output_dir   The output directory, for a directory batch.
+ * @param chunk_size   The bytes processed at once, and the size of split tasks.
+ * @param num_workers  The number of threads.
+ * @param verbose      Also report the task and steal counts.
+ * @return EXIT_SUCCESS if every file succeeded, EXIT_FAILURE otherwise.
+ */
+int batch_run(const stream_ctx *ctx, const char *list, const char *output_dir, size_t chunk_size, int num_workers, bool verbose)
+{
+    batch_list files = {NULL, 0, 0};
+    struct stat st;
+    int status;
+    if (stat(list, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        if (output_dir == NULL)
+        {
+            printf("A directory batch needs an output directory (-o).\n");
+            return EXIT_FAILURE;
+        }
+        status = batch_read_directory(list, output_dir, &files);
+    }
+    else
+    {
+        status = batch_read_manifest(list, &files);
+    }
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (num_workers < 1)
+    {
+        num_workers = 1;
+    }
+    if (num_workers > PIPELINE_MAX_WORKERS)
+    {
+        num_workers = PIPELINE_MAX_WORKERS;
+    }
+
+    batch_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.ctx = ctx;
+    pool.chunk_size = chunk_size;
+    pool.num_workers = num_workers;
+    size_t num_tasks = 0;
+    if (status == EXIT_SUCCESS)
+    {
+        for (size_t i = 0; i < files.count; i++)
+        {
+            batch_file *file = &files.files[i];
+            file->size = stat(file->input, &st) == 0 ? (uint64_t)st.st_size : 0;
+            file->split = stream_is_parallel(ctx) && file->size > (uint64_t)chunk_size * BATCH_SPLIT_CHUNKS;
+            num_tasks += file->split ? (size_t)((file->size + chunk_size - 1) / chunk_size) : 1;
+        }
+        qsort(files.files, files.count, sizeof(batch_file), batch_compare_size);
+        pool.deques = (batch_deque *)calloc((size_t)num_workers, sizeof(batch_deque));
+        status = pool.deques != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+        for (int w = 0; status == EXIT_SUCCESS && w < num_workers; w++)
+        {
+            pthread_mutex_init(&pool.deques[w].lock, NULL);
+            pool.deques[w].tasks = (batch_task *)malloc((num_tasks / (size_t)num_workers + 1) * sizeof(batch_task));
+            status = pool.deques[w].tasks != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (status != EXIT_SUCCESS)
+        {
+            printf("Memory allocation failed.\n");
+        }
+    }
+
+    // Deal the tasks, largest files first. A split file opens its
+    // descriptors once here, shared by its chunk tasks.
+    size_t next = 0;
+    for (size_t i = 0; status == EXIT_SUCCESS && i < files.count; i++)
+    {
+        batch_file *file = &files.files[i];
+        uint64_t pieces = 1;
+        if (file->split)
+        {
+            file->in_fd = open(file->input, O_RDONLY);
+            file->out_file = file->in_fd >= 0 ? open_output_file(file->output) : NULL;
+            if (file->out_file == NULL)
+            {
+                if (file->in_fd >= 0)
+                {
+                    close(file->in_fd);
+                }
+                batch_fail(&pool, file, "cannot open the file");
+                continue;
+            }
+            file->out_fd = fileno(file->out_file);
+            pieces = (file->size + chunk_size - 1) / chunk_size;
+            file->pending = (unsigned int)pieces;
+        }
+        for (uint64_t p = 0; p < pieces; p++, next++)
+        {
+            batch_deque *deque = &pool.deques[next % (size_t)num_workers];
+            batch_task *task = &deque->tasks[deque->tail++];
+            task->file = file;
+            task->offset = p * chunk_size;
+            task->length = file->split && file->size - task->offset < chunk_size ? file->size - task->offset : chunk_size;
+        }
+    }
+
+    double start = monotonic_seconds();
+    if (status == EXIT_SUCCESS)
+    {
+        pthread_t threads[PIPELINE_MAX_WORKERS];
+        batch_worker workers[PIPELINE_MAX_WORKERS];
+        int started = 0;
+        for (int w = 0; w < num_workers; w++)
+        {
+            workers[w].pool = &pool;
+            workers[w].index = w;
+        }
+        for (int w = 1; w < num_workers; w++)
+        {
+            if (pthread_create(&threads[started], NULL, batch_work, &workers[w]) != 0)
+            {
+                break; // The running workers steal the tasks of the missing ones
+            }
+            started++;
+        }
+        batch_work(&workers[0]);
+        for (int w = 0; w < started; w++)
+        {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    if (status == EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Batch: %zu files, %llu failed, %llu bytes in %f seconds (%.1f MB/s)\n", files.count, pool.failures, pool.bytes, elapsed,
+                elapsed > 0 ? pool.bytes / elapsed / 1e6 : 0.0);
+        if (verbose)
+        {
+            fprintf(stderr, "Batch: %zu tasks on %d workers, %llu stolen\n", num_tasks, num_workers, pool.steals);
+        }
+        if (pool.failures > 0)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    for (int w = 0; pool.deques != NULL && w < num_workers; w++)
+    {
+        free(pool.deques[w].tasks);
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    }
+    free(pool.deques);
+    for (size_t i = 0; i < files.count; i++)
+    {
+        free(files.files[i].input);
+        free(files.files[i].output);
+    }
+    free(files.files);
+    return status;
+}
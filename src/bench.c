@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/bench.h"
+#include "../include/AES.h"
+#include "../include/ECB.h"
+#include "../include/CBC.h"
+#include "../include/CFB.h"
+#include "../include/CTR.h"
+#include "../include/perfctr.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+static const char *const bench_mode_names[] = {"ECB", "CBC", "CFB", "CTR"};
+static const char *const bench_engine_names[] = {"stream", "blocks"};
+static const size_t bench_key_sizes[] = {16, 24, 32};
+
+typedef struct
+{
+    bench_engine engine;
+    stream_ctx ctx;
+    unsigned char *in;
+    unsigned char *out;
+    size_t size;
+    unsigned char **blocks; // Block pointers into in and out, for BENCH_BLOCKS
+    unsigned char **cipher;
+    unsigned char iv[BLOCK_SIZE];
+} bench_case;
+
+typedef struct
+{
+    unsigned long iterations; // Operations per sample
+    int samples;
+    double median_seconds; // Per operation
+    double p99_seconds;
+    double mb_per_s;
+    double tsc_ticks_per_byte; // Time stamp counter ticks (reference cycles, not core cycles), 0 without one
+    perfctr_values counters; // Over all the timed samples
+} bench_result;
+
+/**
+ * @brief Reads the time stamp counter, or returns 0 where there is none.
+ */
+static inline uint64_t bench_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Runs one operation of a case: the whole input through the engine.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int bench_operation(bench_case *c)
+{
+    if (c->engine == BENCH_STREAM)
+    {
+        return stream_update(&c->ctx, c->in, c->out, c->size);
+    }
+    size_t num_blocks = c->size / BLOCK_SIZE;
+    size_t num_cipher;
+    unsigned char **key = c->ctx.round_keys;
+    size_t Nr = c->ctx.Nr;
+    bool encrypt = c->ctx.encrypt;
+    switch (c->ctx.mode)
+    {
+    case STREAM_ECB:
+        return encrypt ? ECB_cipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr) : ECB_decipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr);
+    case STREAM_CBC:
+        return encrypt ? CBC_cipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv)
+                       : CBC_decipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv);
+    case STREAM_CFB:
+        return encrypt ? CFB_cipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv)
+                       : CFB_decipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv);
+    case STREAM_CTR:
+        return encrypt ? CTR_cipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv)
+                       : CTR_decipher(key, c->blocks, num_blocks, c->cipher, &num_cipher, Nr, c->iv);
+    }
+    return -1;
+}
+
+/**
+ * @brief Times iterations operations of a case.
+ *
+ * @param ticks  Set to the time stamp counter ticks of the sample.
+ * @return The seconds of the sample, or a negative value if an operation failed.
+ */
+static double bench_sample(bench_case *c, unsigned long iterations, uint64_t *ticks)
+{
+    double start = monotonic_seconds();
+    uint64_t start_ticks = bench_ticks();
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        if (bench_operation(c) != 0)
+        {
+            return -1.0;
+        }
+    }
+    *ticks = bench_ticks() - start_ticks;
+    return monotonic_seconds() - start;
+}
+
+/**
+ * @brief Warms a case up and measures it.
+ *
+ * @param counters  The counters to run during the timed samples, or NULL.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if an operation failed.
+ */
+static int bench_measure(bench_case *c, int repetitions, perfctr_set *counters, double *seconds, double *ticks_per_op, bench_result *result)
+{
+    uint64_t ticks;
+    unsigned long iterations = 1;
+    for (;;)
+    {
+        double elapsed = bench_sample(c, iterations, &ticks);
+        if (elapsed < 0)
+        {
+            return EXIT_FAILURE;
+        }
+        if (elapsed >= BENCH_SAMPLE_SECONDS)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+    if (counters != NULL)
+    {
+        perfctr_start(counters);
+    }
+    for (int r = 0; r < repetitions; r++)
+    {
+        double elapsed = bench_sample(c, iterations, &ticks);
+        if (elapsed < 0)
+        {
+            return EXIT_FAILURE;
+        }
+        seconds[r] = elapsed / iterations;
+        ticks_per_op[r] = (double)ticks / iterations;
+    }
+    if (counters != NULL)
+    {
+        perfctr_stop(counters, &result->counters);
+    }
+    qsort(seconds, (size_t)repetitions, sizeof(double), compare_double);
+    qsort(ticks_per_op, (size_t)repetitions, sizeof(double), compare_double);
+    result->iterations = iterations;
+    result->samples = repetitions;
+    result->median_seconds = seconds[repetitions / 2];
+    result->p99_seconds = seconds[repetitions * 99 / 100];
+    result->mb_per_s = c->size / result->median_seconds / 1e6;
+    result->tsc_ticks_per_byte = ticks_per_op[repetitions / 2] / c->size;
+    return EXIT_SUCCESS;
+}
+
+static void bench_format_size(char *text, size_t text_size, size_t size)
+{
+    if (size >= (1 << 30) && size % (1 << 30) == 0)
+    {
+        snprintf(text, text_size, "%zuG", size >> 30);
+    }
+    else if (size >= (1 << 20) && size % (1 << 20) == 0)
+    {
+        snprintf(text, text_size, "%zuM", size >> 20);
+    }
+    else if (size >= (1 << 10) && size % (1 << 10) == 0)
+    {
+        snprintf(text, text_size, "%zuK", size >> 10);
+    }
+    else
+    {
+        snprintf(text, text_size, "%zu", size);
+    }
+}
+
+/**
+ * @brief Benchmarks every engine, selected mode, direction, key size and input size on synthetic data.
+ *
+ * Prints a table of the median throughput, time stamp counter ticks per
+ * byte and median and p99 time per operation, and writes the same results
+ * as JSON if asked. The counter ticks at a fixed rate whatever the core
+ * clock; core cycles per byte come from the hardware counters (-P).
+ *
+ * @param options  The modes, maximum input size, repetitions and outputs.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int bench_run(const bench_options *options)
+{
+    size_t max_size = (size_t)options->max_size;
+    if (max_size < BENCH_MIN_SIZE || max_size % BLOCK_SIZE != 0 || options->repetitions < 1)
+    {
+        printf("The benchmark needs a maximum size that is a multiple of %d and at least one repetition.\n", BLOCK_SIZE);
+        return EXIT_FAILURE;
+    }
+    size_t max_blocks = max_size / BLOCK_SIZE;
+    unsigned char *in = (unsigned char *)malloc(max_size);
+    unsigned char *out = (unsigned char *)malloc(max_size);
+    unsigned char **blocks = (unsigned char **)malloc(max_blocks * sizeof(unsigned char *));
+    unsigned char **cipher = (unsigned char **)malloc(max_blocks * sizeof(unsigned char *));
+    double *seconds = (double *)malloc((size_t)options->repetitions * sizeof(double));
+    double *ticks_per_op = (double *)malloc((size_t)options->repetitions * sizeof(double));
+    FILE *json = NULL;
+    if (options->json_file != NULL)
+    {
+        json = strcmp(options->json_file, "-") == 0 ? stdout : fopen(options->json_file, "w");
+        if (json == NULL)
+        {
+            printf("Failed to open the file %s.\n", options->json_file);
+        }
+    }
+    if (in == NULL || out == NULL || blocks == NULL || cipher == NULL || seconds == NULL || ticks_per_op == NULL ||
+        (options->json_file != NULL && json == NULL))
+    {
+        if (options->json_file == NULL || json != NULL)
+        {
+            printf("Memory allocation failed.\n");
+        }
+        if (json != NULL && json != stdout)
+        {
+            fclose(json);
+        }
+        free(in);
+        free(out);
+        free(blocks);
+        free(cipher);
+        free(seconds);
+        free(ticks_per_op);
+        return EXIT_FAILURE;
+    }
+    perfctr_set counter_set;
+    perfctr_set *counters = NULL;
+    if (options->counters && perfctr_open(&counter_set) == EXIT_SUCCESS)
+    {
+        counters = &counter_set;
+    }
+    uint64_t state = 0x9e3779b97f4a7c15ULL; // xorshift64, the data does not change the timings
+    for (size_t i = 0; i < max_size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        in[i] = (unsigned char)state;
+    }
+    for (size_t i = 0; i < max_blocks; i++)
+    {
+        blocks[i] = in + i * BLOCK_SIZE;
+        cipher[i] = out + i * BLOCK_SIZE;
+    }
+
+    if (!options->quiet)
+    {
+        printf("%-7s %-4s %-8s %4s %6s %10s %9s %12s %12s\n", "engine", "mode", "op", "key", "size", "MB/s", "ticks/B", "median us", "p99 us");
+    }
+    if (json != NULL)
+    {
+        fprintf(json, "{\"tsc\": %s, \"repetitions\": %d, \"results\": [", bench_ticks() != 0 ? "true" : "false", options->repetitions);
+    }
+    int status = EXIT_SUCCESS;
+    bool first = true;
+    for (int engine = BENCH_STREAM; engine <= BENCH_BLOCKS && status == EXIT_SUCCESS; engine++)
+    {
+        for (int m = 0; m < options->num_modes && status == EXIT_SUCCESS; m++)
+        {
+            for (int direction = 0; direction < 2 && status == EXIT_SUCCESS; direction++)
+            {
+                for (size_t k = 0; k < sizeof(bench_key_sizes) / sizeof(bench_key_sizes[0]) && status == EXIT_SUCCESS; k++)
+                {
+                    unsigned char key[32];
+                    for (size_t i = 0; i < sizeof(key); i++)
+                    {
+                        key[i] = (unsigned char)i;
+                    }
+                    unsigned char **round_keys;
+                    size_t Nr;
+                    if (key_setup_bytes(key, bench_key_sizes[k], &round_keys, &Nr) != 0)
+                    {
+                        status = EXIT_FAILURE;
+                        break;
+                    }
+                    // BENCH_SIZE_STEP times larger each time, and the maximum size last
+                    for (size_t size = BENCH_MIN_SIZE;; size = size > max_size / BENCH_SIZE_STEP ? max_size : size * BENCH_SIZE_STEP)
+                    {
+                        bench_case c;
+                        c.engine = (bench_engine)engine;
+                        memset(c.iv, 0, BLOCK_SIZE);
+                        stream_init(&c.ctx, bench_mode_names[options->modes[m]], direction == 0, round_keys, Nr, c.iv);
+                        c.in = in;
+                        c.out = out;
+                        c.size = size;
+                        c.blocks = blocks;
+                        c.cipher = cipher;
+                        bench_result result;
+                        if (bench_measure(&c, options->repetitions, counters, seconds, ticks_per_op, &result) != EXIT_SUCCESS)
+                        {
+                            printf("The benchmark of %s %s failed.\n", bench_engine_names[engine], bench_mode_names[options->modes[m]]);
+                            status = EXIT_FAILURE;
+                            break;
+                        }
+                        const char *op = direction == 0 ? "encrypt" : "decrypt";
+                        if (!options->quiet)
+                        {
+                            char size_text[24];
+                            bench_format_size(size_text, sizeof(size_text), size);
+                            printf("%-7s %-4s %-8s %4zu %6s %10.1f %9.1f %12.3f %12.3f\n", bench_engine_names[engine], bench_mode_names[options->modes[m]], op,
+                                   bench_key_sizes[k] * 8, size_text, result.mb_per_s, result.tsc_ticks_per_byte, result.median_seconds * 1e6,
+                                   result.p99_seconds * 1e6);
+                            if (counters != NULL)
+                            {
+                                perfctr_print(stdout, "    counters", &result.counters, (unsigned long long)size * result.iterations * result.samples);
+                            }
+                            fflush(stdout);
+                        }
+                        if (json != NULL)
+                        {
+                            fprintf(json,
+                                    "%s\n  {\"engine\": \"%s\", \"mode\": \"%s\", \"op\": \"%s\", \"key_bits\": %zu, \"size\": %zu, \"samples\": %d, "
+                                    "\"iterations\": %lu, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mb_per_s\": %.3f, \"tsc_ticks_per_byte\": %.3f",
+                                    first ? "" : ",", bench_engine_names[engine], bench_mode_names[options->modes[m]], op, bench_key_sizes[k] * 8, size,
+                                    result.samples, result.iterations, result.median_seconds * 1e9, result.p99_seconds * 1e9, result.mb_per_s,
+                                    result.tsc_ticks_per_byte);
+                            if (counters != NULL)
+                            {
+                                fprintf(json, ", \"counters\": ");
+                                perfctr_print_json(json, &result.counters, (unsigned long long)size * result.iterations * result.samples);
+                            }
+                            fprintf(json, "}");
+                            first = false;
+                        }
+                        if (size == max_size)
+                        {
+                            break;
+                        }
+                    }
+                    free_blocks(round_keys, Nr);
+                }
+            }
+        }
+    }
+    if (counters != NULL)
+    {
+        perfctr_close(counters);
+    }
+    if (json != NULL)
+    {
+        fprintf(json, "\n]}\n");
+        if (json != stdout)
+        {
+            fclose(json);
+        }
+    }
+    free(in);
+    free(out);
+    free(blocks);
+    free(cipher);
+    free(seconds);
+    free(ticks_per_op);
+    return status;
+}
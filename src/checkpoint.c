@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/checkpoint.h"
+#include "../include/stream.h"
+#include "../include/manifest.h"
+#include "../include/AES.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+// The state saved by a checkpoint.
+typedef struct
+{
+    uint64_t input_size;
+    uint64_t input_mtime;
+    uint64_t input_offset;  // Input bytes encrypted and durably written
+    uint64_t output_offset; // Output bytes durably written
+    unsigned char chain[BLOCK_SIZE];
+} checkpoint_state;
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/**
+ * @brief Key check value: the first 8 bytes of E_K(0), to recognize the key of a journal.
+ */
+static uint64_t checkpoint_key_check(const stream_ctx *ctx)
+{
+    unsigned char zero[BLOCK_SIZE] = {0};
+    unsigned char out[BLOCK_SIZE];
+    AES_cipher(zero, ctx->round_keys, out, ctx->Nr);
+    return get_le64(out);
+}
+
+static void checkpoint_pack(const stream_ctx *ctx, const checkpoint_state *state, unsigned char *journal)
+{
+    memset(journal, 0, CHECKPOINT_SIZE);
+    memcpy(journal, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    journal[8] = (unsigned char)ctx->mode;
+    journal[9] = ctx->encrypt ? 1 : 0;
+    put_le64(journal + 16, state->input_size);
+    put_le64(journal + 24, state->input_mtime);
+    put_le64(journal + 32, state->input_offset);
+    put_le64(journal + 40, state->output_offset);
+    memcpy(journal + 48, state->chain, BLOCK_SIZE);
+    put_le64(journal + 64, checkpoint_key_check(ctx));
+    put_le64(journal + 72, manifest_digest(journal, 72, 0));
+}
+
+/**
+ * @brief Writes a journal atomically: to a temporary file, synced, then renamed.
+ *
+ * The output must have been synced before, so the journal never points past
+ * data that could be lost.
+ */
+static int checkpoint_write(const char *path, const stream_ctx *ctx, const checkpoint_state *state)
+{
+    unsigned char journal[CHECKPOINT_SIZE];
+    char temp[strlen(path) + 5];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    checkpoint_pack(ctx, state, journal);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int status = fd >= 0 && write_all(fd, journal, CHECKPOINT_SIZE) == 0 && fsync(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (fd >= 0 && close(fd) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS && rename(temp, path) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS)
+    {
+        printf("Failed to write the journal %s.\n", path);
+        unlink(temp);
+    }
+    return status;
+}
+
+/**
+ * @brief Reads a journal and checks it against the job being resumed.
+ *
+ * The journal must be intact and written for the same mode, direction, key
+ * and unchanged input, and the output must hold at least the bytes it records.
+ */
+static int checkpoint_read(const char *path, const stream_ctx *ctx, const struct stat *in_st, int out_fd, checkpoint_state *state)
+{
+    unsigned char journal[CHECKPOINT_SIZE];
+    struct stat out_st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("No journal %s to resume from.\n", path);
+        return EXIT_FAILURE;
+    }
+    ssize_t n = read_full(fd, journal, CHECKPOINT_SIZE);
+    close(fd);
+    if (n != CHECKPOINT_SIZE || memcmp(journal, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+        get_le64(journal + 72) != manifest_digest(journal, 72, 0))
+    {
+        printf("The journal %s is damaged.\n", path);
+        return EXIT_FAILURE;
+    }
+    if (journal[8] != (unsigned char)ctx->mode || journal[9] != (ctx->encrypt ? 1 : 0) || get_le64(journal + 64) != checkpoint_key_check(ctx))
+    {
+        printf("The journal was written with another mode, direction or key.\n");
+        return EXIT_FAILURE;
+    }
+    state->input_size = get_le64(journal + 16);
+    state->input_mtime = get_le64(journal + 24);
+    state->input_offset = get_le64(journal + 32);
+    state->output_offset = get_le64(journal + 40);
+    memcpy(state->chain, journal + 48, BLOCK_SIZE);
+    uint64_t mtime = (uint64_t)in_st->st_mtim.tv_sec * 1000000000ULL + (uint64_t)in_st->st_mtim.tv_nsec;
+    if (state->input_size != (uint64_t)in_st->st_size || state->input_mtime != mtime)
+    {
+        printf("The input changed since the journal was written.\n");
+        return EXIT_FAILURE;
+    }
+    if (fstat(out_fd, &out_st) != 0 || (uint64_t)out_st.st_size < state->output_offset || state->input_offset > state->input_size)
+    {
+        printf("The output is shorter than the journal records.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Streams a file like stream_file, with checkpoints to resume after a crash.
+ *
+ * A new job starts with a journal at offset 0, then every interval bytes the
+ * output is synced and the input offset, output offset and chaining state
+ * are saved in the journal. With resume, the job continues from the journal:
+ * the output is cut back to the last checkpoint and the chaining state
+ * restored, so the result is the same as an uninterrupted run. The journal
+ * is removed once the output is complete.
+ *
+ * @param ctx           The streaming context.
+ * @param in_fd         The input, a regular file.
+ * @param out_fd        The output, a regular file opened read-write.
+ * @param chunk_size    The bytes processed at once.
+ * @param interval      The bytes between checkpoints.
+ * @param journal_path  The journal file.
+ * @param resume        true to continue from the journal.
+ * @param bytes_out     Set to the size of the output.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int checkpoint_stream(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long interval, const char *journal_path, bool resume,
+                      unsigned long long *bytes_out)
+{
+    struct stat in_st;
+    struct stat out_st;
+    if (fstat(in_fd, &in_st) != 0 || !S_ISREG(in_st.st_mode) || fstat(out_fd, &out_st) != 0 || !S_ISREG(out_st.st_mode))
+    {
+        printf("Checkpoints need a regular input and output file.\n");
+        return EXIT_FAILURE;
+    }
+    checkpoint_state state;
+    memset(&state, 0, sizeof(state));
+    state.input_size = (uint64_t)in_st.st_size;
+    state.input_mtime = (uint64_t)in_st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)in_st.st_mtim.tv_nsec;
+    if (resume)
+    {
+        if (checkpoint_read(journal_path, ctx, &in_st, out_fd, &state) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+        memcpy(ctx->chain, state.chain, BLOCK_SIZE);
+    }
+    else if (out_st.st_size != 0)
+    {
+        printf("The output is not empty; resume the job or remove the output.\n");
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(out_fd, (off_t)state.output_offset) != 0)
+    {
+        printf("Failed to write the output.\n");
+        return EXIT_FAILURE;
+    }
+    if (!resume)
+    {
+        // A first checkpoint at offset 0, replacing any journal of an older job,
+        // so a job that dies before its first interval can be resumed too.
+        memcpy(state.chain, ctx->chain, BLOCK_SIZE);
+        if (checkpoint_write(journal_path, ctx, &state) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    unsigned char *chunk = (unsigned char *)malloc(chunk_size);
+    if (chunk == NULL)
+    {
+        printf("Memory allocation failed for the stream chunk.\n");
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    unsigned long long next_checkpoint = state.input_offset + interval;
+    for (;;)
+    {
+        ssize_t n = pread_full(in_fd, chunk, chunk_size, (off_t)state.input_offset);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        size_t padded = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(chunk + n, 0, padded - (size_t)n);
+        if (stream_update(ctx, chunk, chunk, padded) != EXIT_SUCCESS ||
+            pwrite_all(out_fd, chunk, padded, (off_t)state.output_offset) != 0)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        state.input_offset += (uint64_t)n;
+        state.output_offset += padded;
+        if ((size_t)n < chunk_size)
+        {
+            break;
+        }
+        if (state.input_offset >= next_checkpoint)
+        {
+            memcpy(state.chain, ctx->chain, BLOCK_SIZE);
+            if (fdatasync(out_fd) != 0 || checkpoint_write(journal_path, ctx, &state) != EXIT_SUCCESS)
+            {
+                status = EXIT_FAILURE;
+                break;
+            }
+            next_checkpoint = state.input_offset + interval;
+        }
+    }
+    free(chunk);
+    if (status == EXIT_SUCCESS)
+    {
+        if (fdatasync(out_fd) != 0)
+        {
+            printf("Failed to write the output.\n");
+            return EXIT_FAILURE;
+        }
+        unlink(journal_path);
+        *bytes_out = state.output_offset;
+    }
+    return status;
+}
@@ -0,0 +1,1457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "../include/container.h"
+#include "../include/stream.h"
+#include "../include/AES.h"
+#include "../include/CTR.h"
+#include "../include/pipeline.h"
+#include "../include/manifest.h"
+#include "../include/lz.h"
+#include "../include/crc32c.h"
+#include "../include/stats.h"
+#include "../include/probes.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+// A run of bytes of the container that no chunk of the current version uses.
+typedef struct
+{
+    uint64_t offset;
+    uint64_t length;
+} container_extent;
+
+// Work shared by the threads encrypting or decrypting the chunks of one container.
+typedef struct
+{
+    const stream_ctx *ctx;
+    container_info *info;
+    int in_fd;
+    int out_fd;
+    uint64_t next_chunk; // Next chunk to take, shared by the workers
+    // Encrypted chunks are placed in chunk order, see container_commit.
+    pthread_mutex_t lock;
+    pthread_cond_t committed;
+    uint64_t next_commit;
+    uint64_t next_offset;
+    bool failed;
+    // Plaintext digests (encryption), and those of the previous version for an update.
+    container_manifest *manifest;
+    const uint64_t *previous;
+    uint64_t previous_chunks;
+    uint64_t digest_seed;
+    bool update;
+    container_extent *free_space; // Where an update may place chunks, first fit, before next_offset
+    size_t num_free;
+    unsigned long long rewritten; // Ciphertext bytes written by an update
+} container_job;
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/**
+ * @brief Number of key bits for a number of round keys (11, 13 or 15).
+ */
+static unsigned int key_bits_from_rounds(size_t Nr)
+{
+    return (unsigned int)(Nr - 7) * 32;
+}
+
+/**
+ * @brief Plaintext length of a chunk: the chunk size, or what is left for the last one.
+ */
+static uint32_t container_plain_length(const container_header *header, uint64_t index)
+{
+    uint64_t start = index * header->chunk_size;
+    uint64_t left = header->original_length - start;
+    return left < header->chunk_size ? (uint32_t)left : header->chunk_size;
+}
+
+/**
+ * @brief Size of a chunk buffer: a compressed container stores an incompressible chunk with its length prefix, one block more.
+ */
+static size_t container_buffer_size(const container_header *header)
+{
+    return (size_t)header->chunk_size + BLOCK_SIZE;
+}
+
+/**
+ * @brief Compresses a chunk behind its length prefix, or copies it if it does not shrink.
+ *
+ * @param plain   The plaintext chunk.
+ * @param length  Its length.
+ * @param packed  The output, container_buffer_size bytes.
+ * @return The number of bytes written, prefix included (not padded).
+ */
+static uint32_t container_compress_chunk(const unsigned char *plain, uint32_t length, unsigned char *packed)
+{
+    size_t size = lz_compress(plain, length, packed + 4, length > 0 ? length - 1 : 0);
+    if (size == 0)
+    {
+        memcpy(packed + 4, plain, length);
+        put_le32(packed, length | CONTAINER_RAW_CHUNK);
+        return length + 4;
+    }
+    put_le32(packed, (uint32_t)size);
+    return (uint32_t)size + 4;
+}
+
+/**
+ * @brief Restores the plaintext of a decrypted chunk of a compressed container.
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the chunk is corrupted.
+ */
+static int container_expand_chunk(const container_entry *entry, const unsigned char *packed, unsigned char *plain)
+{
+    uint32_t prefix = get_le32(packed);
+    uint32_t size = prefix & ~CONTAINER_RAW_CHUNK;
+    if (entry->stored_length < 4 || size > entry->stored_length - 4)
+    {
+        return EXIT_FAILURE;
+    }
+    if (prefix & CONTAINER_RAW_CHUNK)
+    {
+        if (size != entry->plain_length)
+        {
+            return EXIT_FAILURE;
+        }
+        memcpy(plain, packed + 4, size);
+        return EXIT_SUCCESS;
+    }
+    size_t length;
+    if (lz_decompress(packed + 4, size, plain, entry->plain_length, &length) != 0 || length != entry->plain_length)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Encrypts a chunk in place and, if the container has checksums, takes the CRC32C of the result in the same pass.
+ *
+ * The chunk is encrypted CONTAINER_CRC_SLICE bytes at a time and each slice
+ * goes through the CRC while it is still in cache.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_encrypt_chunk(const container_header *header, stream_ctx *chunk_ctx, unsigned char *data, uint32_t stored, uint32_t *checksum)
+{
+    if (!(header->flags & CONTAINER_FLAG_CRC32C))
+    {
+        return stream_update(chunk_ctx, data, data, stored) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    uint32_t crc = 0;
+    for (uint32_t done = 0; done < stored;)
+    {
+        uint32_t slice = stored - done < CONTAINER_CRC_SLICE ? stored - done : CONTAINER_CRC_SLICE;
+        if (stream_update(chunk_ctx, data + done, data + done, slice) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+        crc = crc32c(crc, data + done, slice);
+        done += slice;
+    }
+    *checksum = crc;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Checks the CRC32C of a stored chunk, if the container has checksums.
+ */
+static bool container_checksum_ok(const container_header *header, const container_entry *entry, const unsigned char *stored)
+{
+    return !(header->flags & CONTAINER_FLAG_CRC32C) || crc32c(0, stored, entry->stored_length) == entry->checksum;
+}
+
+/**
+ * @brief Builds the context that encrypts or decrypts one chunk on its own.
+ *
+ * CTR chunks start at the counter base_iv + index * blocks per chunk, so a
+ * container holds the same keystream as a plain CTR stream. CBC and CFB
+ * chunks start with the IV E_K(base_iv XOR index), the index being XORed
+ * big-endian into the last 8 bytes. ECB needs no IV.
+ *
+ * A chunk rewritten by an incremental update must not reuse its IV, so from
+ * generation 1 on every mode but ECB starts from E_K(base_iv XOR index XOR
+ * generation), the generation being XORed big-endian into bytes 4 to 7.
+ * Compressed chunks can be one block longer than the chunk size, so CTR
+ * chunks of a compressed container use that derived counter too.
+ *
+ * @param base       The context with the mode, direction and round keys.
+ * @param header     The container header.
+ * @param index      The chunk index.
+ * @param generation The generation of the chunk, 0 unless rewritten.
+ * @param chunk_ctx  The context to initialize.
+ */
+void container_chunk_ctx(const stream_ctx *base, const container_header *header, uint64_t index, uint32_t generation, stream_ctx *chunk_ctx)
+{
+    *chunk_ctx = *base;
+    memcpy(chunk_ctx->chain, header->base_iv, BLOCK_SIZE);
+    if (base->mode == STREAM_CTR && generation == 0 && !(header->flags & CONTAINER_FLAG_COMPRESSED))
+    {
+        CTR_increment(chunk_ctx->chain, (size_t)(index * (header->chunk_size / BLOCK_SIZE)));
+    }
+    else if (base->mode != STREAM_ECB)
+    {
+        unsigned char block[BLOCK_SIZE];
+        memcpy(block, header->base_iv, BLOCK_SIZE);
+        for (int i = 0; i < 8; i++)
+        {
+            block[BLOCK_SIZE - 1 - i] ^= (unsigned char)(index >> (8 * i));
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            block[7 - i] ^= (unsigned char)(generation >> (8 * i));
+        }
+        AES_cipher(block, base->round_keys, chunk_ctx->chain, base->Nr);
+    }
+}
+
+static void container_header_pack(const container_header *header, unsigned char *buf)
+{
+    memset(buf, 0, CONTAINER_HEADER_SIZE);
+    memcpy(buf, CONTAINER_MAGIC, 4);
+    buf[4] = CONTAINER_VERSION;
+    buf[5] = (unsigned char)header->mode;
+    buf[6] = (unsigned char)header->key_bits;
+    buf[7] = (unsigned char)(header->key_bits >> 8);
+    put_le32(buf + 8, header->flags);
+    put_le32(buf + 12, header->chunk_size);
+    put_le64(buf + 16, header->original_length);
+    memcpy(buf + 24, header->base_iv, BLOCK_SIZE);
+}
+
+static void container_entry_pack(const container_entry *entry, unsigned char *buf)
+{
+    put_le64(buf, entry->offset);
+    put_le32(buf + 8, entry->plain_length);
+    put_le32(buf + 12, entry->stored_length);
+    put_le32(buf + 16, entry->generation);
+    put_le32(buf + 20, entry->checksum);
+}
+
+/**
+ * @brief Reads and checks the header, index and footer of a container.
+ *
+ * The container must have been written with the mode and key size of ctx,
+ * and every chunk must lie between the header and the index.
+ *
+ * @param fd    The container file, which must support pread.
+ * @param ctx   The context the container will be decrypted with, or NULL to accept any mode and key size.
+ * @param info  Filled with the header and index; release with container_close.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int container_open(int fd, const stream_ctx *ctx, container_info *info)
+{
+    unsigned char buf[CONTAINER_HEADER_SIZE];
+    struct stat st;
+    memset(info, 0, sizeof(*info));
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        printf("The container must be a regular file.\n");
+        return EXIT_FAILURE;
+    }
+    if (pread_full(fd, buf, CONTAINER_HEADER_SIZE, 0) != CONTAINER_HEADER_SIZE || memcmp(buf, CONTAINER_MAGIC, 4) != 0)
+    {
+        printf("The input is not a container.\n");
+        return EXIT_FAILURE;
+    }
+    if (buf[4] != CONTAINER_VERSION)
+    {
+        printf("Unsupported container version %d.\n", buf[4]);
+        return EXIT_FAILURE;
+    }
+    container_header *header = &info->header;
+    header->mode = (stream_mode)buf[5];
+    header->key_bits = buf[6] | ((unsigned int)buf[7] << 8);
+    header->flags = get_le32(buf + 8);
+    header->chunk_size = get_le32(buf + 12);
+    header->original_length = get_le64(buf + 16);
+    memcpy(header->base_iv, buf + 24, BLOCK_SIZE);
+    if (ctx != NULL && (header->mode != ctx->mode || header->key_bits != key_bits_from_rounds(ctx->Nr)))
+    {
+        printf("The container was written with another mode or key size.\n");
+        return EXIT_FAILURE;
+    }
+    if (header->chunk_size == 0 || header->chunk_size % BLOCK_SIZE != 0)
+    {
+        printf("Invalid container chunk size.\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t size = (uint64_t)st.st_size;
+    if (size < CONTAINER_HEADER_SIZE + CONTAINER_FOOTER_SIZE ||
+        pread_full(fd, buf, CONTAINER_FOOTER_SIZE, (off_t)(size - CONTAINER_FOOTER_SIZE)) != CONTAINER_FOOTER_SIZE ||
+        memcmp(buf + 16, CONTAINER_FOOTER_MAGIC, 8) != 0)
+    {
+        printf("The container index is missing.\n");
+        return EXIT_FAILURE;
+    }
+    info->index_offset = get_le64(buf);
+    info->num_chunks = get_le64(buf + 8);
+    uint64_t expected = (header->original_length + header->chunk_size - 1) / header->chunk_size;
+    if (info->num_chunks != expected || info->index_offset < CONTAINER_HEADER_SIZE ||
+        info->num_chunks > (size - CONTAINER_FOOTER_SIZE - info->index_offset) / CONTAINER_ENTRY_SIZE ||
+        info->index_offset + info->num_chunks * CONTAINER_ENTRY_SIZE + CONTAINER_FOOTER_SIZE != size)
+    {
+        printf("The container index is corrupted.\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t index_size = (size_t)info->num_chunks * CONTAINER_ENTRY_SIZE;
+    unsigned char *index = (unsigned char *)malloc(index_size + 1);
+    info->entries = (container_entry *)calloc((size_t)info->num_chunks + 1, sizeof(container_entry));
+    if (index == NULL || info->entries == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(index);
+        container_close(info);
+        return EXIT_FAILURE;
+    }
+    if (pread_full(fd, index, index_size, (off_t)info->index_offset) != (ssize_t)index_size)
+    {
+        printf("Failed to read the container index.\n");
+        free(index);
+        container_close(info);
+        return EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < info->num_chunks; i++)
+    {
+        const unsigned char *p = index + i * CONTAINER_ENTRY_SIZE;
+        container_entry *entry = &info->entries[i];
+        entry->offset = get_le64(p);
+        entry->plain_length = get_le32(p + 8);
+        entry->stored_length = get_le32(p + 12);
+        entry->generation = get_le32(p + 16);
+        entry->checksum = get_le32(p + 20);
+        bool compressed = (header->flags & CONTAINER_FLAG_COMPRESSED) != 0;
+        if (entry->plain_length != container_plain_length(header, i) || entry->stored_length % BLOCK_SIZE != 0 ||
+            (compressed ? entry->stored_length == 0 : entry->stored_length < entry->plain_length) ||
+            entry->stored_length > container_buffer_size(header) - (compressed ? 0 : BLOCK_SIZE) || entry->offset < CONTAINER_HEADER_SIZE ||
+            entry->offset + entry->stored_length > info->index_offset)
+        {
+            printf("The container index is corrupted at chunk %llu.\n", (unsigned long long)i);
+            free(index);
+            container_close(info);
+            return EXIT_FAILURE;
+        }
+    }
+    free(index);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Releases the index read by container_open.
+ */
+void container_close(container_info *info)
+{
+    free(info->entries);
+    info->entries = NULL;
+    info->num_chunks = 0;
+}
+
+/**
+ * @brief Places an encrypted chunk in the container, in chunk order.
+ *
+ * Chunks are stored one after the other, so a chunk only gets its offset once
+ * all the previous ones have theirs. Workers wait here for their turn; the
+ * encryption itself runs concurrently.
+ *
+ * @return The offset of the chunk, or 0 if another worker failed.
+ */
+static uint64_t container_commit(container_job *job, uint64_t index, uint32_t stored_length)
+{
+    uint64_t offset = 0;
+    pthread_mutex_lock(&job->lock);
+    while (job->next_commit != index && !job->failed)
+    {
+        pthread_cond_wait(&job->committed, &job->lock);
+    }
+    if (!job->failed)
+    {
+        offset = job->next_offset;
+        job->next_offset += stored_length;
+        job->next_commit++;
+        pthread_cond_broadcast(&job->committed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return offset;
+}
+
+/**
+ * @brief Places a rewritten chunk: in the first free extent it fits in, or at the end of the file.
+ */
+static uint64_t container_allocate(container_job *job, uint32_t stored_length)
+{
+    uint64_t offset = 0;
+    pthread_mutex_lock(&job->lock);
+    for (size_t k = 0; k < job->num_free && offset == 0; k++)
+    {
+        container_extent *extent = &job->free_space[k];
+        if (extent->length >= stored_length)
+        {
+            offset = extent->offset;
+            extent->offset += stored_length;
+            extent->length -= stored_length;
+        }
+    }
+    if (offset == 0)
+    {
+        offset = job->next_offset;
+        job->next_offset += stored_length;
+    }
+    pthread_mutex_unlock(&job->lock);
+    return offset;
+}
+
+static void container_fail(container_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    job->failed = true;
+    pthread_cond_broadcast(&job->committed);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * @brief Worker: takes chunks until there are none left and encrypts or decrypts them.
+ *
+ * Plaintext chunk i always sits at i * chunk_size, so reads (encryption) and
+ * writes (decryption) of the plaintext side need no coordination. In an
+ * update, a chunk whose digest did not change is left as it is, and a changed
+ * one is written to space the current version does not use.
+ */
+static void *container_worker(void *arg)
+{
+    container_job *job = (container_job *)arg;
+    container_info *info = job->info;
+    const container_header *header = &info->header;
+    bool compressed = (header->flags & CONTAINER_FLAG_COMPRESSED) != 0;
+    unsigned char *buf = (unsigned char *)malloc(container_buffer_size(header));
+    unsigned char *packed = compressed ? (unsigned char *)malloc(container_buffer_size(header)) : NULL;
+    if (buf == NULL || (compressed && packed == NULL))
+    {
+        printf("Memory allocation failed.\n");
+        container_fail(job);
+        free(buf);
+        return NULL;
+    }
+    for (;;)
+    {
+        uint64_t i = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (i >= info->num_chunks || __atomic_load_n(&job->failed, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        container_entry *entry = &info->entries[i];
+        off_t plain_offset = (off_t)(i * header->chunk_size);
+        stream_ctx chunk_ctx;
+        if (job->ctx->encrypt)
+        {
+            uint32_t length = container_plain_length(header, i);
+            double stage_start = stats_begin();
+            if (pread_full(job->in_fd, buf, length, plain_offset) != (ssize_t)length)
+            {
+                printf("Failed to read the input.\n");
+                container_fail(job);
+                break;
+            }
+            stats_end(STATS_READ, stage_start, length);
+            if (job->manifest != NULL)
+            {
+                uint64_t digest = manifest_digest(buf, length, job->digest_seed);
+                job->manifest->digests[i] = digest;
+                if (job->update && i < job->previous_chunks && job->previous[i] == digest && entry->plain_length == length)
+                {
+                    continue;
+                }
+            }
+            if (job->update)
+            {
+                entry->generation = job->manifest->generation;
+            }
+            unsigned char *data = compressed ? packed : buf;
+            uint32_t size = compressed ? container_compress_chunk(buf, length, packed) : length;
+            uint32_t stored = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+            memset(data + size, 0, stored - size);
+            container_chunk_ctx(job->ctx, header, i, entry->generation, &chunk_ctx);
+            stage_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_CONTAINER, chunk_ctx.mode, stored);
+            if (container_encrypt_chunk(header, &chunk_ctx, data, stored, &entry->checksum) != EXIT_SUCCESS)
+            {
+                container_fail(job);
+                break;
+            }
+            AES_PROBE3(chunk_end, AES_ENGINE_CONTAINER, chunk_ctx.mode, stored);
+            stats_end(STATS_CIPHER, stage_start, stored);
+            uint64_t offset;
+            if (!job->update)
+            {
+                offset = container_commit(job, i, stored);
+            }
+            else
+            {
+                offset = container_allocate(job, stored);
+            }
+            if (offset == 0)
+            {
+                break;
+            }
+            if (job->update)
+            {
+                __atomic_fetch_add(&job->rewritten, stored, __ATOMIC_RELAXED);
+            }
+            entry->offset = offset;
+            entry->plain_length = length;
+            entry->stored_length = stored;
+            stage_start = stats_begin();
+            if (pwrite_all(job->out_fd, data, stored, (off_t)offset) != 0)
+            {
+                printf("Failed to write the output.\n");
+                container_fail(job);
+                break;
+            }
+            stats_end(STATS_WRITE, stage_start, stored);
+        }
+        else
+        {
+            container_chunk_ctx(job->ctx, header, i, entry->generation, &chunk_ctx);
+            double stage_start = stats_begin();
+            bool ok = pread_full(job->in_fd, buf, entry->stored_length, (off_t)entry->offset) == (ssize_t)entry->stored_length;
+            stats_end(STATS_READ, stage_start, ok ? entry->stored_length : 0);
+            stage_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_CONTAINER, chunk_ctx.mode, entry->stored_length);
+            if (!ok || !container_checksum_ok(header, entry, buf) || stream_update(&chunk_ctx, buf, buf, entry->stored_length) != EXIT_SUCCESS ||
+                (compressed && container_expand_chunk(entry, buf, packed) != EXIT_SUCCESS))
+            {
+                printf("Failed to decrypt chunk %llu.\n", (unsigned long long)i);
+                container_fail(job);
+                break;
+            }
+            AES_PROBE3(chunk_end, AES_ENGINE_CONTAINER, chunk_ctx.mode, entry->stored_length);
+            stats_end(STATS_CIPHER, stage_start, entry->stored_length);
+            stage_start = stats_begin();
+            if (pwrite_all(job->out_fd, compressed ? packed : buf, entry->plain_length, plain_offset) != 0)
+            {
+                printf("Failed to write the output.\n");
+                container_fail(job);
+                break;
+            }
+            stats_end(STATS_WRITE, stage_start, entry->plain_length);
+        }
+    }
+    free(buf);
+    free(packed);
+    return NULL;
+}
+
+/**
+ * @brief Runs container_worker on num_workers threads, the calling thread included.
+ */
+static int container_run(container_job *job, int num_workers)
+{
+    pthread_t threads[PIPELINE_MAX_WORKERS];
+    int started = 0;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->committed, NULL);
+    if ((uint64_t)num_workers > job->info->num_chunks)
+    {
+        num_workers = job->info->num_chunks > 0 ? (int)job->info->num_chunks : 1;
+    }
+    if (num_workers > PIPELINE_MAX_WORKERS)
+    {
+        num_workers = PIPELINE_MAX_WORKERS;
+    }
+    for (int w = 1; w < num_workers; w++)
+    {
+        if (pthread_create(&threads[started], NULL, container_worker, job) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    container_worker(job);
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    pthread_cond_destroy(&job->committed);
+    pthread_mutex_destroy(&job->lock);
+    return job->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Size of the index and the footer of a container.
+ */
+static size_t container_tail_size(const container_info *info)
+{
+    return (size_t)info->num_chunks * CONTAINER_ENTRY_SIZE + CONTAINER_FOOTER_SIZE;
+}
+
+/**
+ * @brief Packs the index and the footer, container_tail_size bytes.
+ */
+static void container_tail_pack(const container_info *info, unsigned char *tail)
+{
+    size_t index_size = (size_t)info->num_chunks * CONTAINER_ENTRY_SIZE;
+    for (uint64_t i = 0; i < info->num_chunks; i++)
+    {
+        container_entry_pack(&info->entries[i], tail + i * CONTAINER_ENTRY_SIZE);
+    }
+    put_le64(tail + index_size, info->index_offset);
+    put_le64(tail + index_size + 8, info->num_chunks);
+    memcpy(tail + index_size + 16, CONTAINER_FOOTER_MAGIC, 8);
+}
+
+/**
+ * @brief Writes the index and the footer at info->index_offset and cuts the file after them.
+ *
+ * @param info       The container, with the final entries and index offset.
+ * @param out_fd     The container file.
+ * @param bytes_out  Set to the size of the container.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_write_index(const container_info *info, int out_fd, unsigned long long *bytes_out)
+{
+    size_t tail_size = container_tail_size(info);
+    unsigned char *tail = (unsigned char *)malloc(tail_size);
+    if (tail == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    container_tail_pack(info, tail);
+    uint64_t size = info->index_offset + tail_size;
+    int status = EXIT_SUCCESS;
+    if (pwrite_all(out_fd, tail, tail_size, (off_t)info->index_offset) != 0 || ftruncate(out_fd, (off_t)size) != 0)
+    {
+        printf("Failed to write the container index.\n");
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        *bytes_out = size;
+    }
+    free(tail);
+    return status;
+}
+
+/**
+ * @brief Allocates the digests of a manifest for num_chunks chunks.
+ */
+static int container_manifest_init(container_manifest *manifest, const container_header *header, uint64_t num_chunks)
+{
+    free(manifest->digests);
+    memcpy(manifest->base_iv, header->base_iv, BLOCK_SIZE);
+    manifest->chunk_size = header->chunk_size;
+    manifest->num_chunks = num_chunks;
+    manifest->digests = (uint64_t *)calloc((size_t)num_chunks + 1, sizeof(uint64_t));
+    if (manifest->digests == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        manifest->num_chunks = 0;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static const container_entry *container_sort_entries; // For compare_chunk_offsets, used by one qsort at a time
+
+static int compare_chunk_offsets(const void *a, const void *b)
+{
+    uint64_t x = container_sort_entries[*(const uint64_t *)a].offset;
+    uint64_t y = container_sort_entries[*(const uint64_t *)b].offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Lists the chunk indexes in file order.
+ *
+ * Chunks placed by incremental updates are out of index order.
+ *
+ * @return The indexes, to free, or NULL if the allocation failed.
+ */
+static uint64_t *container_sort_chunks(const container_info *info)
+{
+    uint64_t *order = (uint64_t *)malloc(((size_t)info->num_chunks + 1) * sizeof(uint64_t));
+    if (order == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return NULL;
+    }
+    for (uint64_t i = 0; i < info->num_chunks; i++)
+    {
+        order[i] = i;
+    }
+    container_sort_entries = info->entries;
+    qsort(order, (size_t)info->num_chunks, sizeof(uint64_t), compare_chunk_offsets);
+    return order;
+}
+
+/**
+ * @brief End of the last chunk, where the index goes.
+ */
+static uint64_t container_data_end(const container_info *info)
+{
+    uint64_t end = CONTAINER_HEADER_SIZE;
+    for (uint64_t i = 0; i < info->num_chunks; i++)
+    {
+        const container_entry *entry = &info->entries[i];
+        if (entry->offset + entry->stored_length > end)
+        {
+            end = entry->offset + entry->stored_length;
+        }
+    }
+    return end;
+}
+
+/**
+ * @brief Lists the space between the header and the index that no chunk uses, in file order.
+ *
+ * @param info   The container.
+ * @param order  Its chunk indexes in file order, see container_sort_chunks.
+ * @param count  Set to the number of extents.
+ * @return The extents, to free, or NULL if the allocation failed.
+ */
+static container_extent *container_free_space(const container_info *info, const uint64_t *order, size_t *count)
+{
+    container_extent *extents = (container_extent *)malloc(((size_t)info->num_chunks + 1) * sizeof(container_extent));
+    *count = 0;
+    if (extents == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return NULL;
+    }
+    uint64_t position = CONTAINER_HEADER_SIZE;
+    for (uint64_t k = 0; k < info->num_chunks; k++)
+    {
+        const container_entry *entry = &info->entries[order[k]];
+        if (entry->offset > position)
+        {
+            extents[*count].offset = position;
+            extents[*count].length = entry->offset - position;
+            (*count)++;
+        }
+        if (entry->offset + entry->stored_length > position)
+        {
+            position = entry->offset + entry->stored_length;
+        }
+    }
+    if (info->index_offset > position)
+    {
+        extents[*count].offset = position;
+        extents[*count].length = info->index_offset - position;
+        (*count)++;
+    }
+    return extents;
+}
+
+/**
+ * @brief Writes an update journal atomically: to a temporary file, synced, then renamed.
+ *
+ * @param path    The journal.
+ * @param state   CONTAINER_JOURNAL_PENDING or CONTAINER_JOURNAL_COMMIT.
+ * @param size    The size to cut the container back to (pending), or its new size (commit).
+ * @param record  The new header followed by the new index and footer (commit), or NULL.
+ * @param length  The length of the record.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_journal_write(const char *path, uint32_t state, uint64_t size, const unsigned char *record, size_t length)
+{
+    size_t journal_size = CONTAINER_JOURNAL_PREFIX + length + 8;
+    unsigned char *journal = (unsigned char *)calloc(1, journal_size);
+    if (journal == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(journal, CONTAINER_JOURNAL_MAGIC, sizeof(CONTAINER_JOURNAL_MAGIC));
+    put_le32(journal + 8, state);
+    put_le64(journal + 16, size);
+    put_le64(journal + 24, length);
+    if (length > 0)
+    {
+        memcpy(journal + CONTAINER_JOURNAL_PREFIX, record, length);
+    }
+    put_le64(journal + CONTAINER_JOURNAL_PREFIX + length, manifest_digest(journal, CONTAINER_JOURNAL_PREFIX + length, 0));
+
+    char temp[strlen(path) + 5];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int status = fd >= 0 && write_all(fd, journal, journal_size) == 0 && fsync(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (fd >= 0 && close(fd) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS && rename(temp, path) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS)
+    {
+        printf("Failed to write the journal %s.\n", path);
+        unlink(temp);
+    }
+    free(journal);
+    return status;
+}
+
+/**
+ * @brief Writes a committed version over the container: index and footer, then the header.
+ *
+ * @param fd      The container.
+ * @param size    The new size of the container.
+ * @param record  The new header followed by the new index and footer.
+ * @param length  The length of the record.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_apply(int fd, uint64_t size, const unsigned char *record, size_t length)
+{
+    size_t tail_size = length - CONTAINER_HEADER_SIZE;
+    if (pwrite_all(fd, record + CONTAINER_HEADER_SIZE, tail_size, (off_t)(size - tail_size)) != 0 || ftruncate(fd, (off_t)size) != 0 ||
+        pwrite_all(fd, record, CONTAINER_HEADER_SIZE, 0) != 0 || fdatasync(fd) != 0)
+    {
+        printf("Failed to write the container index.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Switches the container to the version described by info.
+ *
+ * The chunks of info must be synced. The new header, index and footer are
+ * written to the journal first, which commits the version, then over the
+ * container, and the journal is removed once the container is synced. After
+ * a crash, container_recover writes them again.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_switch(int fd, const container_info *info, const char *journal_path)
+{
+    size_t length = CONTAINER_HEADER_SIZE + container_tail_size(info);
+    unsigned char *record = (unsigned char *)malloc(length);
+    if (record == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    container_header_pack(&info->header, record);
+    container_tail_pack(info, record + CONTAINER_HEADER_SIZE);
+    uint64_t size = info->index_offset + length - CONTAINER_HEADER_SIZE;
+    int status = container_journal_write(journal_path, CONTAINER_JOURNAL_COMMIT, size, record, length);
+    if (status == EXIT_SUCCESS)
+    {
+        status = container_apply(fd, size, record, length);
+    }
+    if (status == EXIT_SUCCESS && unlink(journal_path) != 0)
+    {
+        printf("Failed to remove the journal %s.\n", journal_path);
+        status = EXIT_FAILURE;
+    }
+    free(record);
+    return status;
+}
+
+/**
+ * @brief Finishes or rolls back an update of a container that was interrupted.
+ *
+ * A pending update is rolled back: the container is cut back to its old
+ * size, which drops the chunks written past its end, and the old header and
+ * index were never touched. A committed one is written again. Without a
+ * journal there is nothing to do.
+ *
+ * @param fd            The container, opened read-write.
+ * @param journal_path  Its update journal.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the journal is damaged or cannot be applied.
+ */
+int container_recover(int fd, const char *journal_path)
+{
+    int journal_fd = open(journal_path, O_RDONLY);
+    if (journal_fd < 0)
+    {
+        if (errno == ENOENT)
+        {
+            return EXIT_SUCCESS;
+        }
+        printf("Failed to open the journal %s.\n", journal_path);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    unsigned char *journal = NULL;
+    ssize_t size = -1;
+    memset(&st, 0, sizeof(st));
+    if (fstat(journal_fd, &st) == 0 && st.st_size >= CONTAINER_JOURNAL_PREFIX + 8 && (journal = (unsigned char *)malloc((size_t)st.st_size)) != NULL)
+    {
+        size = read_full(journal_fd, journal, (size_t)st.st_size);
+    }
+    close(journal_fd);
+    size_t length = size >= CONTAINER_JOURNAL_PREFIX + 8 ? (size_t)size - CONTAINER_JOURNAL_PREFIX - 8 : 0;
+    if (journal == NULL || size != st.st_size || memcmp(journal, CONTAINER_JOURNAL_MAGIC, sizeof(CONTAINER_JOURNAL_MAGIC)) != 0 || get_le64(journal + 24) != length ||
+        get_le64(journal + CONTAINER_JOURNAL_PREFIX + length) != manifest_digest(journal, CONTAINER_JOURNAL_PREFIX + length, 0))
+    {
+        printf("The journal %s is damaged.\n", journal_path);
+        free(journal);
+        return EXIT_FAILURE;
+    }
+    uint32_t state = get_le32(journal + 8);
+    uint64_t container_size = get_le64(journal + 16);
+    int status = EXIT_FAILURE;
+    if (state == CONTAINER_JOURNAL_PENDING && length == 0)
+    {
+        status = ftruncate(fd, (off_t)container_size) == 0 && fdatasync(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if (state == CONTAINER_JOURNAL_COMMIT && length >= CONTAINER_HEADER_SIZE + CONTAINER_FOOTER_SIZE && container_size >= length)
+    {
+        status = container_apply(fd, container_size, journal + CONTAINER_JOURNAL_PREFIX, length);
+    }
+    if (status == EXIT_SUCCESS && unlink(journal_path) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS)
+    {
+        printf("Failed to recover the container from the journal %s.\n", journal_path);
+    }
+    free(journal);
+    return status;
+}
+
+/**
+ * @brief Moves the last chunks of a container into free space before them, then cuts the file.
+ *
+ * Runs while more than 1/CONTAINER_COMPACT_RATIO of the chunk area is not
+ * used by any chunk. Each pass copies the ciphertext of chunks, from the last
+ * one down, as it is into the first free extent before them, syncs, and
+ * switches to the new index. A chunk is only copied to space the committed
+ * version does not use, so a crash during a pass loses nothing.
+ *
+ * @param fd            The container.
+ * @param info          The committed version, updated.
+ * @param journal_path  The update journal.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+static int container_compact(int fd, container_info *info, const char *journal_path)
+{
+    unsigned char *buf = NULL;
+    int status = EXIT_SUCCESS;
+    while (status == EXIT_SUCCESS)
+    {
+        uint64_t live = 0;
+        for (uint64_t i = 0; i < info->num_chunks; i++)
+        {
+            live += info->entries[i].stored_length;
+        }
+        uint64_t area = info->index_offset - CONTAINER_HEADER_SIZE;
+        if ((area - live) * CONTAINER_COMPACT_RATIO <= area)
+        {
+            break;
+        }
+        size_t num_free = 0;
+        uint64_t *order = container_sort_chunks(info);
+        container_extent *free_space = order != NULL ? container_free_space(info, order, &num_free) : NULL;
+        if (buf == NULL)
+        {
+            buf = (unsigned char *)malloc(container_buffer_size(&info->header));
+        }
+        if (free_space == NULL || buf == NULL)
+        {
+            free(order);
+            free(free_space);
+            status = EXIT_FAILURE;
+            break;
+        }
+        bool moved = false;
+        for (uint64_t k = info->num_chunks; k-- > 0 && status == EXIT_SUCCESS;)
+        {
+            container_entry *entry = &info->entries[order[k]];
+            for (size_t e = 0; e < num_free; e++)
+            {
+                container_extent *extent = &free_space[e];
+                if (extent->offset + entry->stored_length > entry->offset)
+                {
+                    break;
+                }
+                if (extent->length < entry->stored_length)
+                {
+                    continue;
+                }
+                if (pread_full(fd, buf, entry->stored_length, (off_t)entry->offset) != (ssize_t)entry->stored_length ||
+                    pwrite_all(fd, buf, entry->stored_length, (off_t)extent->offset) != 0)
+                {
+                    printf("Failed to compact the container.\n");
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                entry->offset = extent->offset;
+                extent->offset += entry->stored_length;
+                extent->length -= entry->stored_length;
+                moved = true;
+                break;
+            }
+        }
+        free(order);
+        free(free_space);
+        if (status != EXIT_SUCCESS || !moved)
+        {
+            break;
+        }
+        uint64_t end = container_data_end(info);
+        bool shrunk = end < info->index_offset;
+        info->index_offset = end;
+        if (fdatasync(fd) != 0 || container_switch(fd, info, journal_path) != EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+        if (!shrunk)
+        {
+            break;
+        }
+    }
+    free(buf);
+    return status;
+}
+
+/**
+ * @brief Tells whether a container can use the chunk size: a multiple of BLOCK_SIZE below 4 GiB.
+ */
+bool container_chunk_size_valid(size_t chunk_size)
+{
+    return chunk_size != 0 && chunk_size % BLOCK_SIZE == 0 && chunk_size <= UINT32_MAX - BLOCK_SIZE;
+}
+
+/**
+ * @brief Encrypts a file into a container with independently encrypted chunks.
+ *
+ * Each chunk starts from its own IV derived from base_iv, so CBC and CFB are
+ * encrypted in parallel like ECB and CTR, and any chunk can be decrypted on
+ * its own. The header is written first, the chunks in order after it, then
+ * the index and the footer.
+ *
+ * @param ctx         The encryption context (mode and round keys).
+ * @param base_iv     The IV the chunk IVs are derived from.
+ * @param in_fd       The input, a regular file.
+ * @param out_fd      The output, which must support pwrite.
+ * @param chunk_size  The plaintext bytes per chunk, a multiple of BLOCK_SIZE.
+ * @param flags       CONTAINER_FLAG_COMPRESSED to compress the chunks, or 0; chunk checksums are always added.
+ * @param num_workers The number of threads.
+ * @param manifest    Filled with the chunk digests for later updates, or NULL.
+ * @param bytes_out   Set to the size of the container.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int container_encrypt(const stream_ctx *ctx, const unsigned char *base_iv, int in_fd, int out_fd, size_t chunk_size, uint32_t flags, int num_workers,
+                      container_manifest *manifest, unsigned long long *bytes_out)
+{
+    struct stat st;
+    struct stat out_st;
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || fstat(out_fd, &out_st) != 0 || !S_ISREG(out_st.st_mode))
+    {
+        printf("Containers are written from and to regular files.\n");
+        return EXIT_FAILURE;
+    }
+    if (!container_chunk_size_valid(chunk_size))
+    {
+        printf("The chunk size must be a multiple of %d below 4 GiB.\n", BLOCK_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    container_info info;
+    memset(&info, 0, sizeof(info));
+    info.header.mode = ctx->mode;
+    info.header.key_bits = key_bits_from_rounds(ctx->Nr);
+    info.header.flags = flags | CONTAINER_FLAG_CRC32C;
+    info.header.chunk_size = (uint32_t)chunk_size;
+    info.header.original_length = (uint64_t)st.st_size;
+    memcpy(info.header.base_iv, base_iv, BLOCK_SIZE);
+    info.num_chunks = (info.header.original_length + chunk_size - 1) / chunk_size;
+    info.entries = (container_entry *)calloc((size_t)info.num_chunks + 1, sizeof(container_entry));
+    if (info.entries == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    if (manifest != NULL)
+    {
+        manifest->generation = 0;
+        if (container_manifest_init(manifest, &info.header, info.num_chunks) != EXIT_SUCCESS)
+        {
+            container_close(&info);
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned char header[CONTAINER_HEADER_SIZE];
+    container_header_pack(&info.header, header);
+    int status = pwrite_all(out_fd, header, CONTAINER_HEADER_SIZE, 0) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS)
+    {
+        container_job job;
+        memset(&job, 0, sizeof(job));
+        job.ctx = ctx;
+        job.info = &info;
+        job.in_fd = in_fd;
+        job.out_fd = out_fd;
+        job.next_offset = CONTAINER_HEADER_SIZE;
+        job.manifest = manifest;
+        job.digest_seed = manifest != NULL ? manifest_seed(ctx) : 0;
+        status = container_run(&job, num_workers);
+        info.index_offset = job.next_offset;
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        status = container_write_index(&info, out_fd, bytes_out);
+    }
+    container_close(&info);
+    return status;
+}
+
+/**
+ * @brief Re-encrypts only the chunks of a container whose plaintext changed.
+ *
+ * Every chunk of the new plaintext is read and its digest compared with the
+ * manifest of the previous version. Changed chunks are encrypted under a new
+ * generation, so no IV or counter is ever reused, and written to space the
+ * previous version does not use: free extents first, past the end of the
+ * file otherwise. Once they are synced, the new header and index are
+ * committed through the journal (see container.h), so a crash at any point
+ * leaves either version. The index then goes right after the last chunk,
+ * which cuts the chunks dropped when the file shrinks, and the container is
+ * compacted when too much of it is dead. The write cost is proportional to
+ * the change. The manifest must describe this container (same base IV, chunk
+ * size and number of chunks, no newer chunk); it is updated in place. An
+ * interrupted update must have been recovered with container_recover.
+ *
+ * @param ctx           The encryption context (mode and round keys).
+ * @param in_fd         The new plaintext, a regular file.
+ * @param out_fd        The container, opened read-write.
+ * @param num_workers   The number of threads.
+ * @param journal_path  The update journal of the container.
+ * @param manifest      The manifest of the container, updated.
+ * @param bytes_out     Set to the number of chunk bytes rewritten.
+ * @return EXIT_SUCCESS on success, IO_UNSUPPORTED if the manifest does not
+ *         match the container, EXIT_FAILURE on failure.
+ */
+int container_update(const stream_ctx *ctx, int in_fd, int out_fd, int num_workers, const char *journal_path, container_manifest *manifest,
+                     unsigned long long *bytes_out)
+{
+    struct stat st;
+    struct stat out_st;
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || fstat(out_fd, &out_st) != 0)
+    {
+        printf("Containers are written from and to regular files.\n");
+        return EXIT_FAILURE;
+    }
+    container_info info;
+    if (container_open(out_fd, ctx, &info) != EXIT_SUCCESS)
+    {
+        return IO_UNSUPPORTED;
+    }
+    // A chunk newer than the manifest means an update was committed but its manifest was not saved.
+    bool stale = false;
+    for (uint64_t i = 0; i < info.num_chunks; i++)
+    {
+        stale = stale || info.entries[i].generation > manifest->generation;
+    }
+    if (memcmp(manifest->base_iv, info.header.base_iv, BLOCK_SIZE) != 0 || manifest->chunk_size != info.header.chunk_size ||
+        manifest->num_chunks != info.num_chunks || manifest->generation == UINT32_MAX || stale)
+    {
+        container_close(&info);
+        return IO_UNSUPPORTED;
+    }
+
+    size_t num_free = 0;
+    uint64_t *order = container_sort_chunks(&info);
+    container_extent *free_space = order != NULL ? container_free_space(&info, order, &num_free) : NULL;
+    free(order);
+    uint64_t previous_chunks = info.num_chunks;
+    uint64_t *previous = manifest->digests;
+    manifest->digests = NULL;
+    info.header.original_length = (uint64_t)st.st_size;
+    info.num_chunks = (info.header.original_length + info.header.chunk_size - 1) / info.header.chunk_size;
+    container_entry *entries = free_space == NULL ? NULL : (container_entry *)realloc(info.entries, ((size_t)info.num_chunks + 1) * sizeof(container_entry));
+    if (entries == NULL || container_manifest_init(manifest, &info.header, info.num_chunks) != EXIT_SUCCESS)
+    {
+        printf("Memory allocation failed.\n");
+        free(previous);
+        free(free_space);
+        if (entries == NULL)
+        {
+            container_close(&info);
+        }
+        else
+        {
+            free(entries);
+        }
+        return EXIT_FAILURE;
+    }
+    info.entries = entries;
+    if (info.num_chunks > previous_chunks)
+    {
+        memset(&info.entries[previous_chunks], 0, (size_t)(info.num_chunks - previous_chunks) * sizeof(container_entry));
+    }
+    manifest->generation++;
+
+    container_job job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+    job.info = &info;
+    job.in_fd = in_fd;
+    job.out_fd = out_fd;
+    job.next_offset = (uint64_t)out_st.st_size; // After the old index, which stays valid until the switch
+    job.free_space = free_space;
+    job.num_free = num_free;
+    job.manifest = manifest;
+    job.previous = previous;
+    job.previous_chunks = previous_chunks;
+    job.digest_seed = manifest_seed(ctx);
+    job.update = true;
+    int status = container_journal_write(journal_path, CONTAINER_JOURNAL_PENDING, (uint64_t)out_st.st_size, NULL, 0);
+    if (status == EXIT_SUCCESS)
+    {
+        status = container_run(&job, num_workers);
+        if (status == EXIT_SUCCESS && fdatasync(out_fd) != 0)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+        }
+        if (status == EXIT_SUCCESS)
+        {
+            info.index_offset = container_data_end(&info);
+            status = container_switch(out_fd, &info, journal_path);
+        }
+        else
+        {
+            container_recover(out_fd, journal_path);
+        }
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        status = container_compact(out_fd, &info, journal_path);
+        *bytes_out = job.rewritten;
+    }
+    free(previous);
+    free(free_space);
+    container_close(&info);
+    return status;
+}
+
+/**
+ * @brief Decrypts a whole container, chunks in parallel.
+ *
+ * Chunks are written at their plaintext position, so the output must support
+ * pwrite; otherwise the container is decrypted sequentially through
+ * container_decrypt_range.
+ *
+ * @param ctx         The decryption context (mode and round keys).
+ * @param in_fd       The container.
+ * @param out_fd      The output.
+ * @param num_workers The number of threads.
+ * @param bytes_out   Set to the number of plaintext bytes written.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int container_decrypt(const stream_ctx *ctx, int in_fd, int out_fd, int num_workers, unsigned long long *bytes_out)
+{
+    struct stat st;
+    if (fstat(out_fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return container_decrypt_range(ctx, in_fd, out_fd, 0, UINT64_MAX, bytes_out);
+    }
+    container_info info;
+    if (container_open(in_fd, ctx, &info) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    container_job job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+    job.info = &info;
+    job.in_fd = in_fd;
+    job.out_fd = out_fd;
+    int status = container_run(&job, num_workers);
+    if (status == EXIT_SUCCESS && ftruncate(out_fd, (off_t)info.header.original_length) != 0)
+    {
+        printf("Failed to write the output.\n");
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        *bytes_out = info.header.original_length;
+    }
+    container_close(&info);
+    return status;
+}
+
+/**
+ * @brief Decrypts a byte range of a container, reading only the chunks that cover it.
+ *
+ * The range is clipped to the original length and written sequentially.
+ *
+ * @param ctx        The decryption context (mode and round keys).
+ * @param in_fd      The container.
+ * @param out_fd     The output.
+ * @param offset     The first plaintext byte.
+ * @param length     The number of plaintext bytes.
+ * @param bytes_out  Set to the number of plaintext bytes written.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int container_decrypt_range(const stream_ctx *ctx, int in_fd, int out_fd, uint64_t offset, uint64_t length, unsigned long long *bytes_out)
+{
+    container_info info;
+    if (container_open(in_fd, ctx, &info) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    const container_header *header = &info.header;
+    uint64_t end = header->original_length;
+    if (offset > end)
+    {
+        offset = end;
+    }
+    if (length < end - offset)
+    {
+        end = offset + length;
+    }
+    bool compressed = (header->flags & CONTAINER_FLAG_COMPRESSED) != 0;
+    unsigned char *buf = (unsigned char *)malloc(container_buffer_size(header));
+    unsigned char *packed = compressed ? (unsigned char *)malloc(container_buffer_size(header)) : NULL;
+    if (buf == NULL || (compressed && packed == NULL))
+    {
+        printf("Memory allocation failed.\n");
+        free(buf);
+        container_close(&info);
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    *bytes_out = 0;
+    for (uint64_t i = offset / header->chunk_size; offset < end; i++)
+    {
+        const container_entry *entry = &info.entries[i];
+        uint64_t chunk_start = i * header->chunk_size;
+        uint64_t chunk_end = chunk_start + entry->plain_length;
+        stream_ctx chunk_ctx;
+        container_chunk_ctx(ctx, header, i, entry->generation, &chunk_ctx);
+        if (pread_full(in_fd, buf, entry->stored_length, (off_t)entry->offset) != (ssize_t)entry->stored_length ||
+            !container_checksum_ok(header, entry, buf) || stream_update(&chunk_ctx, buf, buf, entry->stored_length) != EXIT_SUCCESS ||
+            (compressed && container_expand_chunk(entry, buf, packed) != EXIT_SUCCESS))
+        {
+            printf("Failed to decrypt chunk %llu.\n", (unsigned long long)i);
+            status = EXIT_FAILURE;
+            break;
+        }
+        uint64_t stop = end < chunk_end ? end : chunk_end;
+        if (write_all(out_fd, (compressed ? packed : buf) + (offset - chunk_start), (size_t)(stop - offset)) != 0)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        *bytes_out += stop - offset;
+        offset = stop;
+    }
+    free(buf);
+    free(packed);
+    container_close(&info);
+    return status;
+}
+
+/**
+ * @brief Checks the CRC32C of every chunk of a container, without the key.
+ *
+ * The chunks are read in file order with large sequential reads, so the scan
+ * runs at disk speed. Each bad chunk is reported with its index and offset.
+ *
+ * @param fd          The container.
+ * @param bad_chunks  Set to the number of chunks whose checksum does not match.
+ * @param bytes_out   Set to the number of chunk bytes checked.
+ * @return EXIT_SUCCESS if every chunk is intact, EXIT_FAILURE if one is not or
+ *         the container cannot be read, IO_UNSUPPORTED if it has no checksums.
+ */
+int container_verify(int fd, unsigned long long *bad_chunks, unsigned long long *bytes_out)
+{
+    container_info info;
+    *bad_chunks = 0;
+    *bytes_out = 0;
+    if (container_open(fd, NULL, &info) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    if (!(info.header.flags & CONTAINER_FLAG_CRC32C))
+    {
+        container_close(&info);
+        return IO_UNSUPPORTED;
+    }
+    unsigned char *buf = (unsigned char *)malloc(container_buffer_size(&info.header));
+    uint64_t *order = container_sort_chunks(&info);
+    if (buf == NULL || order == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(buf);
+        free(order);
+        container_close(&info);
+        return EXIT_FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int status = EXIT_SUCCESS;
+    for (uint64_t k = 0; k < info.num_chunks; k++)
+    {
+        const container_entry *entry = &info.entries[order[k]];
+        if (pread_full(fd, buf, entry->stored_length, (off_t)entry->offset) != (ssize_t)entry->stored_length)
+        {
+            printf("Failed to read chunk %llu.\n", (unsigned long long)order[k]);
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (crc32c(0, buf, entry->stored_length) != entry->checksum)
+        {
+            printf("Chunk %llu at offset %llu (%u bytes) is corrupted.\n", (unsigned long long)order[k], (unsigned long long)entry->offset,
+                   entry->stored_length);
+            (*bad_chunks)++;
+            status = EXIT_FAILURE;
+        }
+        *bytes_out += entry->stored_length;
+    }
+    free(buf);
+    free(order);
+    container_close(&info);
+    return status;
+}
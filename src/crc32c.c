@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/crc32c.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static uint32_t crc32c_table[8][256]; // Slicing by 8: table k covers a byte followed by k zero bytes
+// Operators that append CRC32C_LONG or CRC32C_SHORT zero bytes to a CRC, one table per byte of the CRC.
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static bool crc32c_hardware;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t gf2_matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    while (vector != 0)
+    {
+        if (vector & 1)
+        {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+    for (int n = 0; n < 32; n++)
+    {
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+    }
+}
+
+/**
+ * @brief Builds the tables that append length zero bytes (a power of two) to a CRC.
+ *
+ * The operator for one zero bit is squared until it covers length bytes,
+ * then applied to every value of each CRC byte.
+ */
+static void crc32c_zeros(uint32_t zeros[4][256], size_t length)
+{
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++)
+    {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_matrix_square(even, odd); // 2 zero bits
+    gf2_matrix_square(odd, even); // 4 zero bits
+    uint32_t *result = odd;
+    do
+    {
+        gf2_matrix_square(even, odd); // 1 byte on the first pass, then doubled
+        result = even;
+        length >>= 1;
+        if (length == 0)
+        {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        result = odd;
+        length >>= 1;
+    } while (length != 0);
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(result, n);
+        zeros[1][n] = gf2_matrix_times(result, n << 8);
+        zeros[2][n] = gf2_matrix_times(result, n << 16);
+        zeros[3][n] = gf2_matrix_times(result, n << 24);
+    }
+}
+
+static uint32_t crc32c_shift(const uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (int k = 1; k < 8; k++)
+        {
+            crc32c_table[k][n] = crc32c_table[0][crc32c_table[k - 1][n] & 0xff] ^ (crc32c_table[k - 1][n] >> 8);
+        }
+    }
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *next, size_t length)
+{
+    while (length >= 8)
+    {
+        uint32_t low = crc ^ ((uint32_t)next[0] | (uint32_t)next[1] << 8 | (uint32_t)next[2] << 16 | (uint32_t)next[3] << 24);
+        crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^ crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][next[4]] ^ crc32c_table[2][next[5]] ^ crc32c_table[1][next[6]] ^ crc32c_table[0][next[7]];
+        next += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+    {
+        crc = crc32c_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief CRC32C with the SSE4.2 crc32 instruction.
+ *
+ * The instruction has a latency of 3 cycles but a throughput of one per
+ * cycle, so three independent CRCs run over three consecutive lanes and are
+ * combined by shifting the first ones over the lengths that follow.
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *next, size_t length)
+{
+    uint64_t crc0 = crc;
+    // Align to 8 bytes.
+    while (length > 0 && ((uintptr_t)next & 7) != 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+        length--;
+    }
+    static const size_t lanes[2] = {CRC32C_LONG, CRC32C_SHORT};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t lane = lanes[pass];
+        const uint32_t(*zeros)[256] = pass == 0 ? crc32c_long : crc32c_short;
+        while (length >= 3 * lane)
+        {
+            uint64_t crc1 = 0;
+            uint64_t crc2 = 0;
+            const unsigned char *end = next + lane;
+            do
+            {
+                uint64_t a;
+                uint64_t b;
+                uint64_t c;
+                memcpy(&a, next, 8);
+                memcpy(&b, next + lane, 8);
+                memcpy(&c, next + 2 * lane, 8);
+                crc0 = _mm_crc32_u64(crc0, a);
+                crc1 = _mm_crc32_u64(crc1, b);
+                crc2 = _mm_crc32_u64(crc2, c);
+                next += 8;
+            } while (next < end);
+            crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc1;
+            crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc2;
+            next += 2 * lane;
+            length -= 3 * lane;
+        }
+    }
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+        next += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *next++);
+    }
+    return (uint32_t)crc0;
+}
+#endif
+
+/**
+ * @brief Computes or continues a CRC32C (Castagnoli), as in iSCSI and ext4.
+ *
+ * Uses the SSE4.2 crc32 instruction when the processor has it, a table
+ * otherwise.
+ *
+ * @param crc     0 to start, or the CRC of the data before.
+ * @param data    The data.
+ * @param length  Its length.
+ * @return The CRC of everything so far.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_hardware)
+    {
+        return ~crc32c_sse42(crc, (const unsigned char *)data, length);
+    }
+#endif
+    return ~crc32c_software(crc, (const unsigned char *)data, length);
+}
+
+/**
+ * @brief Name of the implementation crc32c uses on this processor.
+ */
+const char *crc32c_implementation(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_hardware ? "SSE4.2, 3-way interleaved" : "table, slicing by 8";
+}
@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "../include/daemon.h"
+#include "../include/stream.h"
+#include "../include/AES.h"
+#include "../include/io.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+// A connection and the request being received on it.
+typedef struct
+{
+    int fd;
+    unsigned char header[DAEMON_REQUEST_SIZE];
+    daemon_request request;
+    size_t length;          // Payload length, from the header
+    size_t received;        // Bytes of the frame received so far, header included
+    unsigned char *payload; // Grown as the payload arrives, to the padded length
+    size_t capacity;
+    daemon_status status; // DAEMON_OK, or the error to answer before closing
+} daemon_connection;
+
+// Connections with a complete request, waiting for a worker.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    daemon_connection **connections;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} daemon_queue;
+
+typedef struct
+{
+    daemon_queue queue;
+    int epoll_fd;
+    keycache keys;
+} daemon_server;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_on_signal(int signal_number)
+{
+    (void)signal_number;
+    daemon_stop = 1;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void daemon_close(daemon_connection *connection)
+{
+    close(connection->fd);
+    free(connection->payload);
+    free(connection);
+}
+
+static void daemon_queue_push(daemon_queue *queue, daemon_connection *connection)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity)
+    {
+        // Too many connections waiting: drop this one.
+        pthread_mutex_unlock(&queue->lock);
+        daemon_close(connection);
+        return;
+    }
+    queue->connections[(queue->head + queue->count) % queue->capacity] = connection;
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static daemon_connection *daemon_queue_pop(daemon_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+    daemon_connection *connection = queue->connections[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_mutex_unlock(&queue->lock);
+    return connection;
+}
+
+/**
+ * @brief Answer to a request whose key lookup ended with status.
+ */
+daemon_status daemon_status_from_key(keycache_status status)
+{
+    return status == KEYCACHE_OK ? DAEMON_OK : (status == KEYCACHE_UNKNOWN ? DAEMON_UNKNOWN_KEY : DAEMON_BAD_REQUEST);
+}
+
+static int daemon_respond(int fd, daemon_status status, const unsigned char *payload, size_t length)
+{
+    unsigned char header[DAEMON_RESPONSE_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, DAEMON_RESPONSE_MAGIC, 4);
+    put_le32(header + 4, (uint32_t)status);
+    put_le32(header + 8, (uint32_t)length);
+    if (write_all(fd, header, sizeof(header)) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return length > 0 ? write_all(fd, payload, length) : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Checks the header of a request once it has arrived.
+ *
+ * @return false if the frame is not a request, the connection is then closed.
+ */
+static bool daemon_parse_header(daemon_connection *connection)
+{
+    const unsigned char *header = connection->header;
+    if (memcmp(header, DAEMON_REQUEST_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    daemon_request *request = &connection->request;
+    request->encrypt = header[4] == 0;
+    request->mode = (stream_mode)header[5];
+    request->key_length = header[6];
+    request->key_id = get_le32(header + 8);
+    connection->length = get_le32(header + 12);
+    memcpy(request->iv, header + 16, BLOCK_SIZE);
+    if (request->key_length > sizeof(request->key) || header[4] > 1 || header[5] > STREAM_CTR)
+    {
+        connection->status = DAEMON_BAD_REQUEST; // The rest of the frame cannot be skipped reliably
+    }
+    else if (connection->length > DAEMON_MAX_PAYLOAD)
+    {
+        connection->status = DAEMON_TOO_LARGE;
+    }
+    return true;
+}
+
+/**
+ * @brief Receives what has arrived of the request of a connection, without blocking.
+ *
+ * Called by the epoll thread, which so never waits for a slow or stalled
+ * client. Only the bytes of the current frame are read; the next request
+ * stays in the socket until this one is answered.
+ *
+ * @return 1 once the request is complete or rejected (status set), 0 to wait
+ *         for more, -1 if the connection is closed, broken or not speaking the protocol.
+ */
+static int daemon_receive(daemon_connection *connection)
+{
+    for (;;)
+    {
+        unsigned char *target;
+        size_t wanted;
+        size_t key_end = DAEMON_REQUEST_SIZE + connection->request.key_length;
+        if (connection->received < DAEMON_REQUEST_SIZE)
+        {
+            target = connection->header + connection->received;
+            wanted = DAEMON_REQUEST_SIZE - connection->received;
+        }
+        else if (connection->status != DAEMON_OK)
+        {
+            return 1;
+        }
+        else if (connection->received < key_end)
+        {
+            target = connection->request.key + (connection->received - DAEMON_REQUEST_SIZE);
+            wanted = key_end - connection->received;
+        }
+        else
+        {
+            size_t done = connection->received - key_end;
+            size_t padded = (connection->length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+            if (connection->capacity < padded && (done == connection->capacity || done == connection->length))
+            {
+                size_t capacity = connection->capacity * 2 > DAEMON_RECEIVE_STEP ? connection->capacity * 2 : DAEMON_RECEIVE_STEP;
+                capacity = capacity < padded ? capacity : padded;
+                unsigned char *grown = (unsigned char *)realloc(connection->payload, capacity);
+                if (grown == NULL)
+                {
+                    connection->status = DAEMON_FAILED;
+                    return 1;
+                }
+                connection->payload = grown;
+                connection->capacity = capacity;
+            }
+            if (done == connection->length)
+            {
+                return 1;
+            }
+            target = connection->payload + done;
+            wanted = (connection->capacity < connection->length ? connection->capacity : connection->length) - done;
+        }
+        ssize_t n = recv(connection->fd, target, wanted, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        connection->received += (size_t)n;
+        if (connection->received == DAEMON_REQUEST_SIZE && !daemon_parse_header(connection))
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Serves the complete request of a connection.
+ *
+ * @return true to keep the connection, false once it is broken or the request was rejected.
+ */
+static bool daemon_serve_request(daemon_server *server, daemon_connection *connection)
+{
+    if (connection->status != DAEMON_OK)
+    {
+        daemon_respond(connection->fd, connection->status, NULL, 0);
+        return false;
+    }
+    daemon_request *request = &connection->request;
+    size_t length = connection->length;
+    size_t padded = (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    memset(connection->payload + length, 0, padded - length);
+
+    key_schedule schedule;
+    daemon_status status = daemon_status_from_key(keycache_get(&server->keys, request->key_id, request->key, request->key_length, &schedule));
+    if (status == DAEMON_OK)
+    {
+        unsigned char *round_keys[AES_MAX_ROUND_KEYS + 1];
+        stream_ctx ctx;
+        key_schedule_ctx(&schedule, round_keys, request->mode, request->encrypt, request->iv, &ctx);
+        AES_PROBE3(chunk_start, AES_ENGINE_DAEMON, request->mode, padded);
+        status = stream_update(&ctx, connection->payload, connection->payload, padded) == EXIT_SUCCESS ? DAEMON_OK : DAEMON_FAILED;
+        AES_PROBE3(chunk_end, AES_ENGINE_DAEMON, request->mode, padded);
+    }
+    return daemon_respond(connection->fd, status, connection->payload, status == DAEMON_OK ? padded : 0) == EXIT_SUCCESS;
+}
+
+static void *daemon_worker(void *arg)
+{
+    daemon_server *server = (daemon_server *)arg;
+    for (;;)
+    {
+        daemon_connection *connection = daemon_queue_pop(&server->queue);
+        AES_PROBE2(job_dequeue, AES_ENGINE_DAEMON, connection->length);
+        bool keep = daemon_serve_request(server, connection);
+        connection->received = 0;
+        connection->status = DAEMON_OK;
+        connection->request.key_length = 0;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = connection;
+        // Watch the connection again for its next request.
+        if (!keep || epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) != 0)
+        {
+            daemon_close(connection);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs the daemon: listens on a Unix socket and serves requests with a pool of workers.
+ *
+ * The main thread accepts connections and receives the requests with epoll,
+ * without blocking; a connection whose request is complete is queued for the
+ * workers, which serve it and hand the connection back, so long-lived
+ * connections share the workers fairly and a client that stalls in the
+ * middle of a frame holds no worker. A client that does not take its
+ * response is dropped after DAEMON_SEND_TIMEOUT seconds. Key schedules are cached by key id. The daemon
+ * stops on SIGINT or SIGTERM and removes the socket.
+ *
+ * @param socket_path  The socket path; an existing socket is replaced, any other file is left alone and the daemon does not start.
+ * @param num_workers  The number of workers.
+ * @param verbose      Report the start and stop on stderr.
+ * @return EXIT_SUCCESS after a signal, EXIT_FAILURE if the daemon cannot start.
+ */
+int daemon_serve(const char *socket_path, int num_workers, bool verbose)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        printf("The socket path is too long.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, socket_path);
+    struct stat st;
+    if (lstat(socket_path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            printf("%s exists and is not a socket.\n", socket_path);
+            return EXIT_FAILURE;
+        }
+        unlink(socket_path);
+    }
+
+    static daemon_server server;
+    pthread_mutex_init(&server.queue.lock, NULL);
+    pthread_cond_init(&server.queue.ready, NULL);
+    server.queue.capacity = DAEMON_BACKLOG * 8;
+    server.queue.connections = (daemon_connection **)malloc(server.queue.capacity * sizeof(daemon_connection *));
+    if (server.queue.connections == NULL || keycache_init(&server.keys, KEYCACHE_DEFAULT_CAPACITY) != EXIT_SUCCESS)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server.epoll_fd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // The listening socket
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, DAEMON_BACKLOG) != 0 ||
+        server.epoll_fd < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0)
+    {
+        printf("Failed to listen on %s.\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_on_signal; // No SA_RESTART: accept returns on a signal
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, daemon_worker, &server) != 0)
+        {
+            printf("Failed to start the workers.\n");
+            return EXIT_FAILURE;
+        }
+        pthread_detach(thread);
+    }
+    if (verbose)
+    {
+        fprintf(stderr, "Listening on %s with %d workers.\n", socket_path, num_workers);
+    }
+    struct epoll_event events[DAEMON_BACKLOG];
+    bool failed = false;
+    while (!daemon_stop && !failed)
+    {
+        int n = epoll_wait(server.epoll_fd, events, DAEMON_BACKLOG, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            failed = true;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            daemon_connection *connection = (daemon_connection *)events[i].data.ptr;
+            if (connection != NULL)
+            {
+                int received = daemon_receive(connection);
+                event.events = EPOLLIN | EPOLLONESHOT;
+                event.data.ptr = connection;
+                if (received > 0)
+                {
+                    AES_PROBE2(job_queue, AES_ENGINE_DAEMON, connection->length);
+                    daemon_queue_push(&server.queue, connection);
+                }
+                else if (received < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) != 0)
+                {
+                    daemon_close(connection);
+                }
+                continue;
+            }
+            int fd = accept(listen_fd, NULL, NULL);
+            connection = fd >= 0 ? (daemon_connection *)calloc(1, sizeof(daemon_connection)) : NULL;
+            if (connection != NULL)
+            {
+                struct timeval timeout = {DAEMON_SEND_TIMEOUT, 0};
+                connection->fd = fd;
+                event.events = EPOLLIN | EPOLLONESHOT;
+                event.data.ptr = connection;
+                if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+                {
+                    daemon_close(connection);
+                }
+            }
+            else if (fd >= 0)
+            {
+                close(fd);
+            }
+            else if (errno != EINTR && errno != ECONNABORTED)
+            {
+                printf("Failed to accept a connection.\n");
+                failed = true;
+            }
+        }
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    if (verbose)
+    {
+        keycache_print_stats(&server.keys);
+        fprintf(stderr, "Stopped.\n");
+    }
+    return daemon_stop ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Connects to a daemon.
+ *
+ * @return The connection, or -1 on failure.
+ */
+int daemon_connect(const char *socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Sends one request and waits for its response.
+ *
+ * @param fd               The connection.
+ * @param request          The operation, mode, key or key id and IV.
+ * @param payload          The data.
+ * @param length           Its length.
+ * @param response         Set to the result, allocated; free it.
+ * @param response_length  Set to the result length (padded to a block).
+ * @param status           Set to the daemon status.
+ * @return EXIT_SUCCESS if a response arrived, EXIT_FAILURE if the connection failed.
+ */
+int daemon_call(int fd, const daemon_request *request, const unsigned char *payload, size_t length, unsigned char **response, size_t *response_length,
+                daemon_status *status)
+{
+    unsigned char header[DAEMON_REQUEST_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, DAEMON_REQUEST_MAGIC, 4);
+    header[4] = request->encrypt ? 0 : 1;
+    header[5] = (unsigned char)request->mode;
+    header[6] = (unsigned char)request->key_length;
+    put_le32(header + 8, request->key_id);
+    put_le32(header + 12, (uint32_t)length);
+    memcpy(header + 16, request->iv, BLOCK_SIZE);
+    *response = NULL;
+    *response_length = 0;
+    if (length > DAEMON_MAX_PAYLOAD || write_all(fd, header, sizeof(header)) != 0 ||
+        (request->key_length > 0 && write_all(fd, request->key, request->key_length) != 0) || write_all(fd, payload, length) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    unsigned char answer[DAEMON_RESPONSE_SIZE];
+    if (read_full(fd, answer, sizeof(answer)) != DAEMON_RESPONSE_SIZE || memcmp(answer, DAEMON_RESPONSE_MAGIC, 4) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    *status = (daemon_status)get_le32(answer + 4);
+    size_t answer_length = get_le32(answer + 8);
+    if (answer_length > DAEMON_MAX_PAYLOAD + BLOCK_SIZE)
+    {
+        return EXIT_FAILURE;
+    }
+    *response = (unsigned char *)malloc(answer_length + 1);
+    if (*response == NULL || read_full(fd, *response, answer_length) != (ssize_t)answer_length)
+    {
+        free(*response);
+        *response = NULL;
+        return EXIT_FAILURE;
+    }
+    *response_length = answer_length;
+    return EXIT_SUCCESS;
+}
+
+// One load test connection.
+typedef struct
+{
+    const char *socket_path;
+    const daemon_request *request;
+    size_t payload_size;
+    unsigned long requests;
+    double *latencies; // Seconds, one per request
+    unsigned long failures;
+} daemon_client;
+
+static void *daemon_client_run(void *arg)
+{
+    daemon_client *client = (daemon_client *)arg;
+    unsigned char *payload = (unsigned char *)calloc(client->payload_size + 1, 1);
+    int fd = daemon_connect(client->socket_path);
+    daemon_request request = *client->request;
+    for (unsigned long i = 0; i < client->requests; i++)
+    {
+        unsigned char *response = NULL;
+        size_t response_length;
+        daemon_status status = DAEMON_FAILED;
+        double start = monotonic_seconds();
+        if (fd < 0 || payload == NULL || daemon_call(fd, &request, payload, client->payload_size, &response, &response_length, &status) != EXIT_SUCCESS ||
+            status != DAEMON_OK)
+        {
+            client->failures++;
+        }
+        client->latencies[i] = monotonic_seconds() - start;
+        free(response);
+        if (request.key_id != 0)
+        {
+            request.key_length = 0; // The key is cached after the first request
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(payload);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Load test: connections clients each send requests requests and the latencies are reported.
+ *
+ * Each client sends the key with its first request and only the key id
+ * afterwards (if the key id is not 0). Prints the requests per second, the
+ * throughput and the p50/p99 latencies.
+ *
+ * @return EXIT_SUCCESS if every request succeeded, EXIT_FAILURE otherwise.
+ */
+int daemon_load_test(const char *socket_path, const daemon_request *request, size_t payload_size, int connections, unsigned long requests)
+{
+    size_t total = (size_t)connections * requests;
+    double *latencies = (double *)malloc((total + 1) * sizeof(double));
+    daemon_client *clients = (daemon_client *)calloc((size_t)connections, sizeof(daemon_client));
+    pthread_t *threads = (pthread_t *)calloc((size_t)connections, sizeof(pthread_t));
+    if (latencies == NULL || clients == NULL || threads == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(latencies);
+        free(clients);
+        free(threads);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    double start = monotonic_seconds();
+    int started = 0;
+    for (int c = 0; c < connections; c++)
+    {
+        clients[c].socket_path = socket_path;
+        clients[c].request = request;
+        clients[c].payload_size = payload_size;
+        clients[c].requests = requests;
+        clients[c].latencies = latencies + (size_t)c * requests;
+        if (pthread_create(&threads[c], NULL, daemon_client_run, &clients[c]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    unsigned long failures = 0;
+    for (int c = 0; c < started; c++)
+    {
+        pthread_join(threads[c], NULL);
+        failures += clients[c].failures;
+    }
+    double elapsed = monotonic_seconds() - start;
+    total = (size_t)started * requests;
+    qsort(latencies, total, sizeof(double), compare_double);
+    if (total > 0)
+    {
+        printf("%zu requests of %zu bytes on %d connections in %f seconds, %lu failed\n", total, payload_size, started, elapsed, failures);
+        printf("%.0f requests/s, %.1f MB/s\n", total / elapsed, total * (double)payload_size / elapsed / 1e6);
+        printf("Latency p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6,
+               latencies[total - 1] * 1e6);
+    }
+    free(latencies);
+    free(clients);
+    free(threads);
+    return failures == 0 && started == connections ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/direct.h"
+#include "../include/stream.h"
+#include "../include/io.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+/**
+ * @brief Turns O_DIRECT on or off on an open file descriptor.
+ *
+ * @return 0 on success, -1 if the file system refuses it.
+ */
+static int set_direct(int fd, bool on)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+    {
+        return -1;
+    }
+    flags = on ? flags | O_DIRECT : flags & ~O_DIRECT;
+    return fcntl(fd, F_SETFL, flags);
+}
+
+/**
+ * @brief Encrypts or decrypts a file with O_DIRECT, bypassing the page cache.
+ *
+ * Chunks are rounded up to DIRECT_ALIGN and read into an aligned buffer. The
+ * last chunk ends with a short read; its aligned part is written with
+ * O_DIRECT and the unaligned tail with a normal write, O_DIRECT being turned
+ * off on the output for that last write.
+ *
+ * @param ctx         The streaming context.
+ * @param in_fd       The input file descriptor, a regular file.
+ * @param out_fd      The output file descriptor, a regular file.
+ * @param chunk_size  The chunk size in bytes, rounded up to a multiple of DIRECT_ALIGN.
+ * @param bytes_out   Pointer to store the number of bytes written (may be NULL).
+ * @return EXIT_SUCCESS, EXIT_FAILURE, or IO_UNSUPPORTED if a file is not a
+ *         regular file or its file system refuses O_DIRECT.
+ */
+int direct_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    struct stat in_stat;
+    struct stat out_stat;
+    if (fstat(in_fd, &in_stat) != 0 || fstat(out_fd, &out_stat) != 0 ||
+        !S_ISREG(in_stat.st_mode) || !S_ISREG(out_stat.st_mode) ||
+        lseek(in_fd, 0, SEEK_CUR) != 0 || lseek(out_fd, 0, SEEK_CUR) != 0)
+    {
+        return IO_UNSUPPORTED;
+    }
+    if (set_direct(in_fd, true) != 0)
+    {
+        return IO_UNSUPPORTED;
+    }
+    if (set_direct(out_fd, true) != 0)
+    {
+        set_direct(in_fd, false);
+        return IO_UNSUPPORTED;
+    }
+
+    chunk_size = (chunk_size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    if (chunk_size == 0)
+    {
+        chunk_size = DIRECT_ALIGN;
+    }
+    unsigned char *chunk = aligned_buffer_alloc(chunk_size, DIRECT_ALIGN);
+    if (chunk == NULL)
+    {
+        printf("Memory allocation failed for the stream chunk.\n");
+        set_direct(in_fd, false);
+        set_direct(out_fd, false);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long long total = 0;
+    int status = EXIT_SUCCESS;
+    for (;;)
+    {
+        // One read per chunk: a short read means the end of the file, another
+        // read at the unaligned end offset would be refused.
+        ssize_t n;
+        do
+        {
+            n = read(in_fd, chunk, chunk_size);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        if ((size_t)n < chunk_size && total + (unsigned long long)n != (unsigned long long)in_stat.st_size)
+        {
+            printf("Short read in the middle of the file.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        size_t length = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(chunk + n, 0, length - (size_t)n);
+        AES_PROBE3(chunk_start, AES_ENGINE_DIRECT, ctx->mode, length);
+        if (stream_update(ctx, chunk, chunk, length) != 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        AES_PROBE3(chunk_end, AES_ENGINE_DIRECT, ctx->mode, length);
+
+        size_t aligned = length / DIRECT_ALIGN * DIRECT_ALIGN;
+        if (write_all(out_fd, chunk, aligned) != EXIT_SUCCESS)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (aligned < length)
+        {
+            // Unaligned tail: only possible on the last chunk.
+            if (set_direct(out_fd, false) != 0 || write_all(out_fd, chunk + aligned, length - aligned) != EXIT_SUCCESS)
+            {
+                printf("Failed to write the output.\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+        total += length;
+        if ((size_t)n < chunk_size)
+        {
+            break;
+        }
+    }
+
+    free(chunk);
+    set_direct(in_fd, false);
+    set_direct(out_fd, false);
+    if (bytes_out != NULL)
+    {
+        *bytes_out = total;
+    }
+    return status;
+}
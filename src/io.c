@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "../include/io.h"
+#include "../include/probes.h"
+
+/**
+ * @brief Reads until the buffer is full or the end of the file is reached.
+ *
+ * @param fd      The file descriptor to read from.
+ * @param buffer  The buffer to fill.
+ * @param length  The number of bytes wanted.
+ * @return The number of bytes read (less than length only at end of file), or -1 on failure.
+ */
+ssize_t read_full(int fd, void *buffer, size_t length)
+{
+    AES_PROBE3(io_submit, AES_ENGINE_IO, AES_IO_READ, length);
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = read(fd, (char *)buffer + done, length - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_READ, 0);
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += (size_t)n;
+    }
+    AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_READ, done);
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Writes the whole buffer, retrying after short writes and interruptions.
+ *
+ * @param fd      The file descriptor to write to.
+ * @param buffer  The data to write.
+ * @param length  The number of bytes to write.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int write_all(int fd, const void *buffer, size_t length)
+{
+    AES_PROBE3(io_submit, AES_ENGINE_IO, AES_IO_WRITE, length);
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = write(fd, (const char *)buffer + done, length - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_WRITE, 0);
+            return EXIT_FAILURE;
+        }
+        done += (size_t)n;
+    }
+    AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_WRITE, done);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reads at an offset until the buffer is full or the end of the file is reached.
+ *
+ * @param fd      The file descriptor to read from.
+ * @param buffer  The buffer to fill.
+ * @param length  The number of bytes wanted.
+ * @param offset  The file offset to read from.
+ * @return The number of bytes read (less than length only at end of file), or -1 on failure.
+ */
+ssize_t pread_full(int fd, void *buffer, size_t length, off_t offset)
+{
+    AES_PROBE3(io_submit, AES_ENGINE_IO, AES_IO_READ, length);
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = pread(fd, (char *)buffer + done, length - done, offset + (off_t)done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_READ, 0);
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += (size_t)n;
+    }
+    AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_READ, done);
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Writes the whole buffer at an offset, retrying after short writes and interruptions.
+ *
+ * @param fd      The file descriptor to write to.
+ * @param buffer  The data to write.
+ * @param length  The number of bytes to write.
+ * @param offset  The file offset to write at.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int pwrite_all(int fd, const void *buffer, size_t length, off_t offset)
+{
+    AES_PROBE3(io_submit, AES_ENGINE_IO, AES_IO_WRITE, length);
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t n = pwrite(fd, (const char *)buffer + done, length - done, offset + (off_t)done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_WRITE, 0);
+            return EXIT_FAILURE;
+        }
+        done += (size_t)n;
+    }
+    AES_PROBE3(io_complete, AES_ENGINE_IO, AES_IO_WRITE, done);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Moves a buffer into a pipe with vmsplice, retrying after partial transfers.
+ *
+ * The pipe references the pages of the buffer instead of copying them, so the
+ * buffer must not be modified until the reader has consumed the data.
+ *
+ * @param fd      The pipe to write to.
+ * @param buffer  The data to move, page aligned for best results.
+ * @param length  The number of bytes.
+ * @return EXIT_SUCCESS, EXIT_FAILURE, or IO_UNSUPPORTED if the kernel refused
+ *         the first transfer (nothing was written).
+ */
+int vmsplice_all(int fd, void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        struct iovec iov = {(char *)buffer + done, length - done};
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (done == 0 && (errno == EINVAL || errno == ENOSYS || errno == EBADF))
+            {
+                return IO_UNSUPPORTED;
+            }
+            return EXIT_FAILURE;
+        }
+        done += (size_t)n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Allocates a buffer whose address is a multiple of alignment.
+ *
+ * @param size       The buffer size in bytes.
+ * @param alignment  The alignment, a power of two multiple of sizeof(void *).
+ * @return The buffer, to release with free, or NULL on failure.
+ */
+void *aligned_buffer_alloc(size_t size, size_t alignment)
+{
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, alignment, size) != 0)
+    {
+        return NULL;
+    }
+    return buffer;
+}
+
+/**
+ * @brief Reads the size of the page cache from /proc/meminfo.
+ *
+ * @return The "Cached" size in KiB, or -1 if it is not available.
+ */
+long long page_cache_kb(void)
+{
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo == NULL)
+    {
+        return -1;
+    }
+    char line[256];
+    long long cached = -1;
+    while (fgets(line, sizeof(line), meminfo) != NULL)
+    {
+        if (strncmp(line, "Cached:", 7) == 0)
+        {
+            cached = strtoll(line + 7, NULL, 10);
+            break;
+        }
+    }
+    fclose(meminfo);
+    return cached;
+}
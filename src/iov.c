@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "../include/iov.h"
+#include "../include/stream.h"
+#include "../include/more.h"
+
+// Position in an iovec array.
+typedef struct
+{
+    const struct iovec *iov;
+    int count;
+    int index;
+    size_t offset;
+} iov_cursor;
+
+static void iov_skip_empty(iov_cursor *cursor)
+{
+    while (cursor->index < cursor->count && cursor->offset == cursor->iov[cursor->index].iov_len)
+    {
+        cursor->index++;
+        cursor->offset = 0;
+    }
+}
+
+static size_t iov_contiguous(const iov_cursor *cursor)
+{
+    return cursor->index < cursor->count ? cursor->iov[cursor->index].iov_len - cursor->offset : 0;
+}
+
+static unsigned char *iov_pointer(const iov_cursor *cursor)
+{
+    return (unsigned char *)cursor->iov[cursor->index].iov_base + cursor->offset;
+}
+
+static void iov_advance(iov_cursor *cursor, size_t length)
+{
+    cursor->offset += length;
+    iov_skip_empty(cursor);
+}
+
+/**
+ * @brief Copies length bytes between a buffer and the iovecs at the cursor, in the given direction.
+ */
+static void iov_copy(iov_cursor *cursor, unsigned char *buffer, size_t length, bool to_buffer)
+{
+    while (length > 0)
+    {
+        size_t part = iov_contiguous(cursor) < length ? iov_contiguous(cursor) : length;
+        if (to_buffer)
+        {
+            memcpy(buffer, iov_pointer(cursor), part);
+        }
+        else
+        {
+            memcpy(iov_pointer(cursor), buffer, part);
+        }
+        buffer += part;
+        length -= part;
+        iov_advance(cursor, part);
+    }
+}
+
+static size_t iov_total(const struct iovec *iov, int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+/**
+ * @brief Runs the mode from input iovecs to output iovecs, both cut anywhere.
+ *
+ * Where the current input and output segments share whole blocks, they are
+ * processed in place in the caller's buffers; only a block split across
+ * segment boundaries goes through a block on the stack. The chaining state
+ * is carried by the context as in stream_update.
+ */
+static int iov_update(stream_ctx *ctx, const struct iovec *in, int in_count, const struct iovec *out, int out_count)
+{
+    size_t length = iov_total(in, in_count);
+    if (length % BLOCK_SIZE != 0 || iov_total(out, out_count) < length)
+    {
+        printf("The input must be a multiple of the block size and fit in the output.\n");
+        return -1;
+    }
+    iov_cursor source = {in, in_count, 0, 0};
+    iov_cursor target = {out, out_count, 0, 0};
+    iov_skip_empty(&source);
+    iov_skip_empty(&target);
+    while (length > 0)
+    {
+        size_t run = iov_contiguous(&source) < iov_contiguous(&target) ? iov_contiguous(&source) : iov_contiguous(&target);
+        run = (run < length ? run : length) / BLOCK_SIZE * BLOCK_SIZE;
+        if (run > 0)
+        {
+            if (stream_update(ctx, iov_pointer(&source), iov_pointer(&target), run) != 0)
+            {
+                return -1;
+            }
+            iov_advance(&source, run);
+            iov_advance(&target, run);
+            length -= run;
+            continue;
+        }
+        unsigned char block[BLOCK_SIZE];
+        iov_copy(&source, block, BLOCK_SIZE, true);
+        if (stream_update(ctx, block, block, BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+        iov_copy(&target, block, BLOCK_SIZE, false);
+        length -= BLOCK_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Encrypts scattered data into scattered buffers, without gathering it first.
+ *
+ * The segments can have any length; their total must be a multiple of
+ * BLOCK_SIZE. Output segments may be the input ones (in place). Consecutive
+ * calls continue the chaining of ctx, like stream_update.
+ *
+ * @param ctx        The streaming context (see stream_init), switched to encryption.
+ * @param in         The input segments.
+ * @param in_count   Their number.
+ * @param out        The output segments, at least as long in total.
+ * @param out_count  Their number.
+ * @return 0 on success, -1 on failure.
+ */
+int aes_encrypt_iov(stream_ctx *ctx, const struct iovec *in, int in_count, const struct iovec *out, int out_count)
+{
+    ctx->encrypt = true;
+    return iov_update(ctx, in, in_count, out, out_count);
+}
+
+/**
+ * @brief Decrypts scattered data into scattered buffers. See aes_encrypt_iov.
+ */
+int aes_decrypt_iov(stream_ctx *ctx, const struct iovec *in, int in_count, const struct iovec *out, int out_count)
+{
+    ctx->encrypt = false;
+    return iov_update(ctx, in, in_count, out, out_count);
+}
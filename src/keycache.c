@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/keycache.h"
+#include "../include/AES.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+/**
+ * @brief Initializes an empty cache.
+ *
+ * @param cache     The cache.
+ * @param capacity  The number of schedules kept.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int keycache_init(keycache *cache, size_t capacity)
+{
+    size_t num_buckets = 2;
+    while (num_buckets < 2 * capacity)
+    {
+        num_buckets <<= 1;
+    }
+    cache->entries = (keycache_entry *)calloc(capacity, sizeof(keycache_entry));
+    cache->buckets = (int32_t *)malloc(num_buckets * sizeof(int32_t));
+    if (cache->entries == NULL || cache->buckets == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(cache->entries);
+        free(cache->buckets);
+        return EXIT_FAILURE;
+    }
+    memset(cache->buckets, 0xff, num_buckets * sizeof(int32_t)); // -1: empty
+    cache->bucket_mask = num_buckets - 1;
+    cache->capacity = capacity;
+    cache->count = 0;
+    cache->newest = -1;
+    cache->oldest = -1;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    pthread_mutex_init(&cache->lock, NULL);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Frees a cache, wiping the keys and schedules it holds first.
+ */
+void keycache_free(keycache *cache)
+{
+    if (cache->entries != NULL)
+    {
+        explicit_bzero(cache->entries, cache->capacity * sizeof(keycache_entry));
+    }
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+static size_t keycache_bucket(const keycache *cache, uint32_t key_id)
+{
+    return (size_t)(key_id * 2654435761u) & cache->bucket_mask;
+}
+
+static int32_t keycache_find(const keycache *cache, uint32_t key_id)
+{
+    int32_t index = cache->buckets[keycache_bucket(cache, key_id)];
+    while (index >= 0 && cache->entries[index].schedule.key_id != key_id)
+    {
+        index = cache->entries[index].chain;
+    }
+    return index;
+}
+
+static void keycache_unlink(keycache *cache, int32_t index)
+{
+    keycache_entry *entry = &cache->entries[index];
+    if (entry->newer >= 0)
+    {
+        cache->entries[entry->newer].older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    if (entry->older >= 0)
+    {
+        cache->entries[entry->older].newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void keycache_push_newest(keycache *cache, int32_t index)
+{
+    keycache_entry *entry = &cache->entries[index];
+    entry->newer = -1;
+    entry->older = cache->newest;
+    if (cache->newest >= 0)
+    {
+        cache->entries[cache->newest].newer = index;
+    }
+    cache->newest = index;
+    if (cache->oldest < 0)
+    {
+        cache->oldest = index;
+    }
+}
+
+/**
+ * @brief Caches a schedule under its key id, replacing the entry of that id or evicting the least recently used one.
+ *
+ * The key and schedule of an evicted entry are wiped before the entry is reused.
+ */
+static void keycache_insert(keycache *cache, const key_schedule *schedule, const unsigned char *key, size_t key_length)
+{
+    int32_t index = keycache_find(cache, schedule->key_id);
+    if (index >= 0)
+    {
+        keycache_unlink(cache, index);
+    }
+    else
+    {
+        if (cache->count < cache->capacity)
+        {
+            index = (int32_t)cache->count++;
+        }
+        else
+        {
+            index = cache->oldest;
+            keycache_unlink(cache, index);
+            int32_t *link = &cache->buckets[keycache_bucket(cache, cache->entries[index].schedule.key_id)];
+            while (*link != index)
+            {
+                link = &cache->entries[*link].chain;
+            }
+            *link = cache->entries[index].chain;
+            explicit_bzero(&cache->entries[index], sizeof(keycache_entry));
+            cache->stats.evictions++;
+        }
+        size_t bucket = keycache_bucket(cache, schedule->key_id);
+        cache->entries[index].chain = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+    }
+    keycache_entry *entry = &cache->entries[index];
+    entry->schedule = *schedule;
+    explicit_bzero(entry->key, sizeof(entry->key)); // A shorter key replacing a longer one
+    memcpy(entry->key, key, key_length);
+    entry->key_length = key_length;
+    keycache_push_newest(cache, index);
+}
+
+/**
+ * @brief Expands a binary key straight into a flat schedule, without allocating.
+ *
+ * Same round keys as key_setup_bytes.
+ *
+ * @return 0 on success, -1 if the key size is not 16, 24 or 32 bytes.
+ */
+static int key_schedule_expand(const unsigned char *key, size_t key_length, key_schedule *schedule)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (key_length != 16 && key_length != 24 && key_length != 32)
+    {
+        return -1;
+    }
+    AES_PROBE2(key_setup_start, AES_ENGINE_KEYCACHE, key_length * 8);
+    int nk = (int)key_length / 4;
+    int rounds = nk + 6;
+    char hex_key[2 * 32 + 1];
+    for (size_t i = 0; i < key_length; i++)
+    {
+        hex_key[2 * i] = hex[key[i] >> 4];
+        hex_key[2 * i + 1] = hex[key[i] & 0x0f];
+    }
+    uint32_t words[(AES_MAX_ROUND_KEYS + 1) * 4];
+    KeyExpansion((uint8_t *)hex_key, words, nk, rounds);
+    for (int i = 0; i < (rounds + 1) * 4; i++)
+    {
+        for (int b = 0; b < 4; b++)
+        {
+            schedule->round_keys[i / 4][(i % 4) * 4 + b] = (unsigned char)(words[i] >> (24 - 8 * b));
+        }
+    }
+    schedule->Nr = (size_t)rounds + 1;
+    AES_PROBE2(key_setup_end, AES_ENGINE_KEYCACHE, key_length * 8);
+    return 0;
+}
+
+/**
+ * @brief Gets the schedules of several keys, expanding the misses together outside the lock.
+ *
+ * A key given with a key id that is cached with the same bytes is a hit;
+ * otherwise it is expanded and, with a non-zero key id, cached. A key id
+ * given without a key must be cached. The schedules are copied out, so they
+ * stay valid after an eviction.
+ *
+ * @param cache      The cache.
+ * @param requests   The key ids and keys.
+ * @param count      The number of requests.
+ * @param schedules  Receives count schedules.
+ * @param statuses   Receives count statuses: KEYCACHE_OK, KEYCACHE_UNKNOWN or KEYCACHE_BAD_KEY.
+ */
+void keycache_get_many(keycache *cache, const keycache_request *requests, size_t count, key_schedule *schedules, keycache_status *statuses)
+{
+    size_t pending = 0;
+    pthread_mutex_lock(&cache->lock);
+    for (size_t i = 0; i < count; i++)
+    {
+        const keycache_request *request = &requests[i];
+        int32_t index = request->key_id != 0 ? keycache_find(cache, request->key_id) : -1;
+        keycache_entry *entry = index >= 0 ? &cache->entries[index] : NULL;
+        if (entry != NULL && (request->key == NULL || (entry->key_length == request->key_length && memcmp(entry->key, request->key, request->key_length) == 0)))
+        {
+            schedules[i] = entry->schedule;
+            statuses[i] = KEYCACHE_OK;
+            keycache_unlink(cache, index);
+            keycache_push_newest(cache, index);
+            cache->stats.hits++;
+            continue;
+        }
+        cache->stats.misses++;
+        statuses[i] = KEYCACHE_UNKNOWN;
+        pending += request->key != NULL ? 1 : 0;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (pending == 0)
+    {
+        return;
+    }
+
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (statuses[i] != KEYCACHE_OK && requests[i].key != NULL)
+        {
+            statuses[i] = key_schedule_expand(requests[i].key, requests[i].key_length, &schedules[i]) == 0 ? KEYCACHE_OK : KEYCACHE_BAD_KEY;
+            schedules[i].key_id = requests[i].key_id;
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stats.setup_seconds += elapsed;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (statuses[i] == KEYCACHE_OK && requests[i].key != NULL && requests[i].key_id != 0)
+        {
+            keycache_insert(cache, &schedules[i], requests[i].key, requests[i].key_length);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Gets the schedule of a key: expands the key given, or copies the cached one.
+ *
+ * @param cache       The cache.
+ * @param key_id      The key id, 0 for a key that is not cached.
+ * @param key         The key bytes, or NULL to use the cached key.
+ * @param key_length  The key size in bytes (16, 24 or 32), 0 without a key.
+ * @param schedule    Receives the schedule.
+ * @return KEYCACHE_OK, KEYCACHE_UNKNOWN or KEYCACHE_BAD_KEY.
+ */
+keycache_status keycache_get(keycache *cache, uint32_t key_id, const unsigned char *key, size_t key_length, key_schedule *schedule)
+{
+    keycache_request request;
+    request.key_id = key_id;
+    request.key = key_length > 0 ? key : NULL;
+    request.key_length = key_length;
+    keycache_status status;
+    keycache_get_many(cache, &request, 1, schedule, &status);
+    return status;
+}
+
+void keycache_get_stats(keycache *cache, keycache_stats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Prints the hit rate and key setup time of a cache on stderr.
+ */
+void keycache_print_stats(keycache *cache)
+{
+    keycache_stats stats;
+    keycache_get_stats(cache, &stats);
+    unsigned long long lookups = stats.hits + stats.misses;
+    fprintf(stderr, "Key cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %.3f ms of key setup\n", stats.hits, stats.misses,
+            lookups > 0 ? 100.0 * stats.hits / lookups : 0.0, stats.evictions, stats.setup_seconds * 1e3);
+}
+
+/**
+ * @brief Builds a streaming context over a schedule.
+ *
+ * @param schedule    The key schedule.
+ * @param round_keys  Array of AES_MAX_ROUND_KEYS + 1 pointers, filled with the round keys.
+ * @param mode        The mode.
+ * @param encrypt     true to encrypt, false to decrypt.
+ * @param iv          The 16-byte IV or initial counter.
+ * @param ctx         The context to initialize.
+ */
+void key_schedule_ctx(const key_schedule *schedule, unsigned char **round_keys, stream_mode mode, bool encrypt, const unsigned char *iv, stream_ctx *ctx)
+{
+    for (size_t i = 0; i < schedule->Nr; i++)
+    {
+        round_keys[i] = (unsigned char *)schedule->round_keys[i];
+    }
+    ctx->mode = mode;
+    ctx->encrypt = encrypt;
+    ctx->round_keys = round_keys;
+    ctx->Nr = schedule->Nr;
+    memcpy(ctx->chain, iv, BLOCK_SIZE);
+}
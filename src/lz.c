@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "../include/lz.h"
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Writes a length continuation: bytes of 255 then the remainder.
+ */
+static bool lz_put_length(unsigned char *out, size_t *op, size_t capacity, size_t length)
+{
+    while (length >= 255)
+    {
+        if (*op >= capacity)
+        {
+            return false;
+        }
+        out[(*op)++] = 255;
+        length -= 255;
+    }
+    if (*op >= capacity)
+    {
+        return false;
+    }
+    out[(*op)++] = (unsigned char)length;
+    return true;
+}
+
+/**
+ * @brief Writes one sequence: token, literals and, unless it is the last one, the match.
+ *
+ * @param match_length  The match length, 0 for the last sequence.
+ */
+static bool lz_put_sequence(unsigned char *out, size_t *op, size_t capacity, const unsigned char *literals, size_t literal_length,
+                            size_t offset, size_t match_length)
+{
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    if (*op >= capacity)
+    {
+        return false;
+    }
+    out[(*op)++] = (unsigned char)((literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15));
+    if (literal_length >= 15 && !lz_put_length(out, op, capacity, literal_length - 15))
+    {
+        return false;
+    }
+    if (capacity - *op < literal_length)
+    {
+        return false;
+    }
+    memcpy(out + *op, literals, literal_length);
+    *op += literal_length;
+    if (match_length == 0)
+    {
+        return true;
+    }
+    if (capacity - *op < 2)
+    {
+        return false;
+    }
+    out[(*op)++] = (unsigned char)offset;
+    out[(*op)++] = (unsigned char)(offset >> 8);
+    return match_code < 15 || lz_put_length(out, op, capacity, match_code - 15);
+}
+
+/**
+ * @brief Compresses a buffer with greedy hash matching.
+ *
+ * Positions are remembered by the hash of their first 4 bytes; the search
+ * steps faster through data that does not match, so incompressible input
+ * costs little.
+ *
+ * @param in        The data.
+ * @param length    Its length.
+ * @param out       The compressed output.
+ * @param capacity  The size of out.
+ * @return The compressed length, or 0 if it does not fit in capacity.
+ */
+size_t lz_compress(const unsigned char *in, size_t length, unsigned char *out, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    size_t op = 0;
+    size_t anchor = 0;
+    size_t ip = 0;
+    if (length > LZ_MATCH_LIMIT)
+    {
+        size_t limit = length - LZ_MATCH_LIMIT;
+        size_t misses = 0;
+        while (ip < limit)
+        {
+            uint32_t sequence = read32(in + ip);
+            uint32_t h = lz_hash(sequence);
+            size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(in + ref) != sequence)
+            {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            // Extend the match backwards over literals that also match.
+            while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1])
+            {
+                ip--;
+                ref--;
+            }
+            size_t match_length = 0;
+            while (ip + match_length < length - LZ_LAST_LITERALS && in[ref + match_length] == in[ip + match_length])
+            {
+                match_length++;
+            }
+            if (!lz_put_sequence(out, &op, capacity, in + anchor, ip - anchor, ip - ref, match_length))
+            {
+                return 0;
+            }
+            ip += match_length;
+            anchor = ip;
+            if (ip < limit)
+            {
+                table[lz_hash(read32(in + ip - 2))] = (uint32_t)(ip - 2);
+            }
+        }
+    }
+    if (!lz_put_sequence(out, &op, capacity, in + anchor, length - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return op;
+}
+
+/**
+ * @brief Reads a length continuation.
+ */
+static bool lz_get_length(const unsigned char *in, size_t length, size_t *ip, size_t *value)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= length)
+        {
+            return false;
+        }
+        byte = in[(*ip)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+ * @brief Decompresses a block, checking every length and offset against the buffers.
+ *
+ * @param in          The compressed data.
+ * @param length      Its length.
+ * @param out         The output.
+ * @param capacity    The size of out.
+ * @param out_length  Set to the decompressed length.
+ * @return 0 on success, -1 if the data is corrupted or does not fit.
+ */
+int lz_decompress(const unsigned char *in, size_t length, unsigned char *out, size_t capacity, size_t *out_length)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    for (;;)
+    {
+        if (ip >= length)
+        {
+            return -1;
+        }
+        unsigned char token = in[ip++];
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_get_length(in, length, &ip, &literal_length))
+        {
+            return -1;
+        }
+        if (length - ip < literal_length || capacity - op < literal_length)
+        {
+            return -1;
+        }
+        memcpy(out + op, in + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == length)
+        {
+            break; // The last sequence has no match
+        }
+        if (length - ip < 2)
+        {
+            return -1;
+        }
+        size_t offset = in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !lz_get_length(in, length, &ip, &match_length))
+        {
+            return -1;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || capacity - op < match_length)
+        {
+            return -1;
+        }
+        // Byte by byte: the match may overlap the bytes it produces.
+        for (size_t i = 0; i < match_length; i++, op++)
+        {
+            out[op] = out[op - offset];
+        }
+    }
+    *out_length = op;
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/manifest.h"
+#include "../include/AES.h"
+#include "../include/io.h"
+#include "../include/more.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_le64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint64_t digest_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t digest_merge(uint64_t acc, uint64_t value)
+{
+    acc ^= digest_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * @brief Derives the digest seed from the key, E_K("manifest digest\0").
+ *
+ * Keying the digests keeps the manifest from confirming guesses about the
+ * plaintext to someone without the key.
+ */
+uint64_t manifest_seed(const stream_ctx *ctx)
+{
+    unsigned char block[BLOCK_SIZE] = "manifest digest";
+    unsigned char out[BLOCK_SIZE];
+    AES_cipher(block, ctx->round_keys, out, ctx->Nr);
+    return read_le64(out);
+}
+
+/**
+ * @brief 64-bit digest of a buffer (the XXH64 algorithm).
+ *
+ * A fast change detector, not a cryptographic hash: two different chunks
+ * have the same digest with probability 2^-64.
+ *
+ * @param data    The data.
+ * @param length  The number of bytes.
+ * @param seed    The seed, from manifest_seed.
+ * @return The digest.
+ */
+uint64_t manifest_digest(const void *data, size_t length, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    uint64_t h;
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do
+        {
+            v1 = digest_round(v1, read_le64(p));
+            v2 = digest_round(v2, read_le64(p + 8));
+            v3 = digest_round(v3, read_le64(p + 16));
+            v4 = digest_round(v4, read_le64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = digest_merge(h, v1);
+        h = digest_merge(h, v2);
+        h = digest_merge(h, v3);
+        h = digest_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t)length;
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= digest_round(0, read_le64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4)
+    {
+        h ^= (uint64_t)read_le32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief Reads a manifest.
+ *
+ * @param path      The manifest file.
+ * @param manifest  Filled with the manifest; release with manifest_free.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if it is missing or invalid.
+ */
+int manifest_load(const char *path, container_manifest *manifest)
+{
+    unsigned char header[MANIFEST_HEADER_SIZE];
+    memset(manifest, 0, sizeof(*manifest));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_FAILURE;
+    if (read_full(fd, header, MANIFEST_HEADER_SIZE) == MANIFEST_HEADER_SIZE && memcmp(header, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) == 0)
+    {
+        manifest->chunk_size = read_le32(header + 8);
+        manifest->generation = read_le32(header + 12);
+        manifest->num_chunks = read_le64(header + 16);
+        memcpy(manifest->base_iv, header + 24, BLOCK_SIZE);
+        size_t size = (size_t)manifest->num_chunks * 8;
+        unsigned char *raw = manifest->num_chunks < SIZE_MAX / 8 ? (unsigned char *)malloc(size + 1) : NULL;
+        manifest->digests = (uint64_t *)calloc((size_t)manifest->num_chunks + 1, sizeof(uint64_t));
+        if (raw != NULL && manifest->digests != NULL && read_full(fd, raw, size + 1) == (ssize_t)size)
+        {
+            for (uint64_t i = 0; i < manifest->num_chunks; i++)
+            {
+                manifest->digests[i] = read_le64(raw + i * 8);
+            }
+            status = EXIT_SUCCESS;
+        }
+        free(raw);
+    }
+    close(fd);
+    if (status != EXIT_SUCCESS)
+    {
+        manifest_free(manifest);
+    }
+    return status;
+}
+
+/**
+ * @brief Writes a manifest atomically: to a temporary file, synced, then renamed.
+ *
+ * @param path      The manifest file.
+ * @param manifest  The manifest.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int manifest_save(const char *path, const container_manifest *manifest)
+{
+    size_t size = MANIFEST_HEADER_SIZE + (size_t)manifest->num_chunks * 8;
+    unsigned char *raw = (unsigned char *)malloc(size);
+    char temp[strlen(path) + 5];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if (raw == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    memset(raw, 0, MANIFEST_HEADER_SIZE);
+    memcpy(raw, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    for (int i = 0; i < 4; i++)
+    {
+        raw[8 + i] = (unsigned char)(manifest->chunk_size >> (8 * i));
+        raw[12 + i] = (unsigned char)(manifest->generation >> (8 * i));
+    }
+    write_le64(raw + 16, manifest->num_chunks);
+    memcpy(raw + 24, manifest->base_iv, BLOCK_SIZE);
+    for (uint64_t i = 0; i < manifest->num_chunks; i++)
+    {
+        write_le64(raw + MANIFEST_HEADER_SIZE + i * 8, manifest->digests[i]);
+    }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int status = fd >= 0 && write_all(fd, raw, size) == 0 && fsync(fd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (fd >= 0 && close(fd) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS && rename(temp, path) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status != EXIT_SUCCESS)
+    {
+        printf("Failed to write the manifest %s.\n", path);
+        unlink(temp);
+    }
+    free(raw);
+    return status;
+}
+
+/**
+ * @brief Releases the digests of a manifest.
+ */
+void manifest_free(container_manifest *manifest)
+{
+    free(manifest->digests);
+    manifest->digests = NULL;
+    manifest->num_chunks = 0;
+}
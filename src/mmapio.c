@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/mmapio.h"
+#include "../include/stream.h"
+#include "../include/io.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+/**
+ * @brief Encrypts or decrypts a file from an input mapping into an output mapping.
+ *
+ * The input is mapped read-only with sequential readahead hints, the output
+ * is sized with ftruncate and mapped writable, and the mode runs directly
+ * from one mapping to the other, chunk_size bytes at a time. The last block
+ * is padded with zeros.
+ *
+ * @param ctx         The streaming context.
+ * @param in_fd       The input file descriptor.
+ * @param out_fd      The output file descriptor, opened for reading and writing.
+ * @param chunk_size  Bytes processed between two writeback requests.
+ * @param bytes_out   Pointer to store the number of bytes written (may be NULL).
+ * @return EXIT_SUCCESS, EXIT_FAILURE, or IO_UNSUPPORTED if either file is not
+ *         a regular file that can be mapped (pipes, terminals, special files).
+ */
+int mmap_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    struct stat in_stat;
+    struct stat out_stat;
+    if (fstat(in_fd, &in_stat) != 0 || fstat(out_fd, &out_stat) != 0 ||
+        !S_ISREG(in_stat.st_mode) || !S_ISREG(out_stat.st_mode) ||
+        (fcntl(out_fd, F_GETFL) & O_ACCMODE) != O_RDWR ||
+        (uintmax_t)in_stat.st_size > SIZE_MAX - BLOCK_SIZE)
+    {
+        return IO_UNSUPPORTED;
+    }
+
+    size_t in_length = (size_t)in_stat.st_size;
+    size_t out_length = (in_length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (ftruncate(out_fd, (off_t)out_length) != 0)
+    {
+        printf("Failed to resize the output file.\n");
+        return EXIT_FAILURE;
+    }
+    if (bytes_out != NULL)
+    {
+        *bytes_out = out_length;
+    }
+    if (in_length == 0)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    unsigned char *in = mmap(NULL, in_length, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (in == MAP_FAILED)
+    {
+        return IO_UNSUPPORTED;
+    }
+    madvise(in, in_length, MADV_SEQUENTIAL);
+    unsigned char *out = mmap(NULL, out_length, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if (out == MAP_FAILED)
+    {
+        munmap(in, in_length);
+        return IO_UNSUPPORTED;
+    }
+    madvise(out, out_length, MADV_SEQUENTIAL);
+
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (chunk_size == 0)
+    {
+        chunk_size = STREAM_DEFAULT_CHUNK;
+    }
+    size_t full_length = in_length / BLOCK_SIZE * BLOCK_SIZE;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    int status = EXIT_SUCCESS;
+    for (size_t offset = 0; offset < full_length && status == EXIT_SUCCESS; offset += chunk_size)
+    {
+        size_t length = full_length - offset < chunk_size ? full_length - offset : chunk_size;
+        AES_PROBE3(chunk_start, AES_ENGINE_MMAP, ctx->mode, length);
+        if (stream_update(ctx, in + offset, out + offset, length) != 0)
+        {
+            status = EXIT_FAILURE;
+        }
+        AES_PROBE3(chunk_end, AES_ENGINE_MMAP, ctx->mode, length);
+        // Start writeback of the finished chunk while the next one is processed.
+        size_t page_offset = offset % page_size;
+        msync(out + offset - page_offset, length + page_offset, MS_ASYNC);
+    }
+    if (status == EXIT_SUCCESS && full_length < in_length)
+    {
+        // The last partial block is padded with zeros in a temporary block.
+        unsigned char last[BLOCK_SIZE] = {0};
+        memcpy(last, in + full_length, in_length - full_length);
+        if (stream_update(ctx, last, out + full_length, BLOCK_SIZE) != 0)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    munmap(in, in_length);
+    if (munmap(out, out_length) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    return status;
+}
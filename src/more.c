@@ -6,8 +6,11 @@
 #include <time.h>
 #include <limits.h>
 #include <ctype.h>
+#include <unistd.h>
 #include "../include/AES.h"
 #include "../include/more.h"
+#include "../include/io.h"
+#include "../include/stats.h"
 
 /**
  * @brief This function passes a text file to a string.
@@ -224,6 +227,7 @@ int split_text_into_blocks(char *text, size_t text_length, unsigned char ***bloc
  */
 int concatenate_blocks(char *text, size_t *text_length, unsigned char ***blocks, size_t *num_blocks)
 {
+    double start = stats_begin();
     // Calculate the total size of the resulting string.
     size_t total_size = *num_blocks * BLOCK_SIZE;
     // Concatenate the blocks into the resulting text.
@@ -237,18 +241,19 @@ int concatenate_blocks(char *text, size_t *text_length, unsigned char ***blocks,
     // Add a null terminator at the end of the concatenated text.
     text[total_size] = '\0';
     *text_length = total_size;
+    stats_end(STATS_CONCATENATE, start, total_size);
     return 0;
 }
 
 /**
- * @brief This function writes a string to a file. If the file is not empty, it creates a new file.
+ * @brief This function opens a file for writing. If the file is not empty, it creates a new file
+ * named <filename>_new instead of overwriting it. The file is also opened for reading so that
+ * it can be memory-mapped.
  *
  * @param filename The name of the file to write to.
- * @param content The string to write to the file.
- * @param concatenated_text_length The length of the file.
- * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * @return The opened file, or NULL on failure.
  */
-int write_to_file(const char *filename, const char *content, size_t concatenated_text_length)
+FILE *open_output_file(const char *filename)
 {
     FILE *file = fopen(filename, "r");
     if (file != NULL)
@@ -259,37 +264,81 @@ int write_to_file(const char *filename, const char *content, size_t concatenated
         if (file_size >= LONG_MAX)
         {
             printf("File %s is too large.\n", filename);
-            return EXIT_FAILURE;
+            return NULL;
         }
         if (file_size == 0) // File is empty
         {
-            file = fopen(filename, "w");
+            file = fopen(filename, "w+");
         }
         else // File is not empty
         {
             char new_filename[strlen(filename) + 5]; // "_new" + null terminator
             snprintf(new_filename, sizeof(new_filename), "%s_new", filename);
-            file = fopen(new_filename, "w");
+            file = fopen(new_filename, "w+");
         }
     }
     else // File does not exist
     {
-        file = fopen(filename, "w");
+        file = fopen(filename, "w+");
     }
 
     if (file == NULL)
     {
         printf("Failed to open the file %s for writing.\n", filename);
+    }
+    return file;
+}
+
+/**
+ * @brief This function writes a string to a file. If the file is not empty, it creates a new file.
+ *
+ * @param filename The name of the file to write to.
+ * @param content The string to write to the file.
+ * @param concatenated_text_length The length of the file.
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int write_to_file(const char *filename, const char *content, size_t concatenated_text_length)
+{
+    FILE *file = open_output_file(filename);
+    if (file == NULL)
+    {
         return EXIT_FAILURE;
     }
-    // Convert each character in content to its hexadecimal representation and write it to the file
-    for (size_t i = 0; i < concatenated_text_length; i++)
+    // Write the whole content with write(2), retrying after short writes
+    int result = write_all(fileno(file), content, concatenated_text_length);
+    if (result != EXIT_SUCCESS)
     {
-        fprintf(file, "%c", (unsigned char)content[i]); // Write two hexadecimal digits for each character
+        printf("Failed to write to the file %s.\n", filename);
     }
 
     fclose(file);
-    return EXIT_SUCCESS;
+    return result;
+}
+
+/**
+ * @brief This function prints the result on the console in a single write.
+ *
+ * @param content The result to print.
+ * @param length The length of the result.
+ */
+void print_result(const char *content, size_t length)
+{
+    printf("Result :\n");
+    fflush(stdout);
+    write_all(STDOUT_FILENO, content, length);
+    printf("\n");
+}
+
+/**
+ * @brief This function reads the monotonic clock.
+ *
+ * @return The current time in seconds.
+ */
+double monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
 }
 
 /**
@@ -434,4 +483,51 @@ int vector_init_verif(char *vector_init, int vector_lenght)
         }
     }
     return EXIT_SUCCESS;
+}
+
+/**
+ * @brief This function parses a byte count with an optional K, M or G suffix (powers of 1024).
+ *
+ * @params str The string to parse, e.g. "4096", "64K" or "1G".
+ * @params size Pointer to store the number of bytes.
+ * @return EXIT_FAILURE if the string is not a valid size or EXIT_SUCCESS if all is well.
+ */
+int parse_size(const char *str, unsigned long long *size)
+{
+    char *end = NULL;
+    if (str == NULL || !isdigit((unsigned char)str[0]))
+    {
+        return EXIT_FAILURE;
+    }
+    unsigned long long value = strtoull(str, &end, 10);
+    unsigned int shift = 0;
+    switch (*end)
+    {
+    case '\0':
+        break;
+    case 'k':
+    case 'K':
+        shift = 10;
+        break;
+    case 'm':
+    case 'M':
+        shift = 20;
+        break;
+    case 'g':
+    case 'G':
+        shift = 30;
+        break;
+    default:
+        return EXIT_FAILURE;
+    }
+    if (*end != '\0' && end[1] != '\0')
+    {
+        return EXIT_FAILURE;
+    }
+    if (value > (ULLONG_MAX >> shift))
+    {
+        return EXIT_FAILURE;
+    }
+    *size = value << shift;
+    return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../include/perfctr.h"
+#include "../include/io.h"
+
+static const char *const perfctr_names[PERFCTR_COUNT] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+static void perfctr_attr(perfctr_event event, struct perf_event_attr *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->inherit = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (event)
+    {
+    case PERFCTR_CYCLES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERFCTR_INSTRUCTIONS:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERFCTR_L1D_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERFCTR_LLC_MISSES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    default:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+}
+
+/**
+ * @brief Opens the available counters, as one group led by the first one, or each on its own.
+ *
+ * @param set      The counters.
+ * @param grouped  Open the counters as one group.
+ * @return The errno of the last counter that failed to open, 0 if none did.
+ */
+static int perfctr_open_events(perfctr_set *set, bool grouped)
+{
+    set->num_open = 0;
+    set->leader = -1;
+    int error = 0;
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        perfctr_attr((perfctr_event)i, &attr);
+        // The members of a group follow their leader: only the leader is enabled and disabled.
+        attr.disabled = set->leader < 0 ? 1 : 0;
+        set->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, grouped ? set->leader : -1, 0);
+        if (set->fds[i] >= 0)
+        {
+            set->num_open++;
+            if (grouped && set->leader < 0)
+            {
+                set->leader = set->fds[i];
+            }
+        }
+        else
+        {
+            error = errno;
+        }
+    }
+    return error;
+}
+
+/**
+ * @brief Tells whether the group runs at all: a group larger than the
+ * processor's counters is accepted by perf_event_open but never scheduled.
+ */
+static bool perfctr_group_runs(perfctr_set *set)
+{
+    ioctl(set->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(set->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    for (volatile int i = 0; i < 100000; i++)
+    {
+    }
+    ioctl(set->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t data[3]; // value, time enabled, time running
+    return read(set->leader, data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0;
+}
+
+/**
+ * @brief Opens the counters that are available.
+ *
+ * @param set  The counters.
+ * @return EXIT_SUCCESS if at least one counter is available, IO_UNSUPPORTED otherwise.
+ */
+int perfctr_open(perfctr_set *set)
+{
+    int error = perfctr_open_events(set, true);
+    if (set->num_open > 1 && !perfctr_group_runs(set))
+    {
+        perfctr_close(set);
+        error = perfctr_open_events(set, false);
+    }
+    if (set->num_open == 0)
+    {
+        fprintf(stderr, "Hardware counters are not available (%s), see /proc/sys/kernel/perf_event_paranoid.\n", strerror(error));
+        return IO_UNSUPPORTED;
+    }
+    return EXIT_SUCCESS;
+}
+
+void perfctr_close(perfctr_set *set)
+{
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        if (set->fds[i] >= 0)
+        {
+            close(set->fds[i]);
+            set->fds[i] = -1;
+        }
+    }
+    set->num_open = 0;
+    set->leader = -1;
+}
+
+/**
+ * @brief Resets and starts the counters.
+ */
+void perfctr_start(perfctr_set *set)
+{
+    if (set->leader >= 0)
+    {
+        ioctl(set->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(set->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return;
+    }
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        if (set->fds[i] >= 0)
+        {
+            ioctl(set->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(set->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/**
+ * @brief Stops the counters and reads them, scaled for multiplexing.
+ *
+ * Threads created after perfctr_start are only counted once they have exited.
+ *
+ * @param set     The counters.
+ * @param values  Receives the counts; a counter that is missing or never ran is not valid.
+ */
+void perfctr_stop(perfctr_set *set, perfctr_values *values)
+{
+    if (set->leader >= 0)
+    {
+        ioctl(set->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        values->valid[i] = false;
+        values->counts[i] = 0.0;
+        if (set->fds[i] < 0)
+        {
+            continue;
+        }
+        if (set->leader < 0)
+        {
+            ioctl(set->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+        uint64_t data[3]; // value, time enabled, time running
+        if (read(set->fds[i], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0)
+        {
+            values->valid[i] = true;
+            values->counts[i] = data[2] < data[1] ? (double)data[0] * data[1] / data[2] : (double)data[0];
+        }
+    }
+}
+
+/**
+ * @brief Prints the counts per byte and the IPC on one line; missing counters are shown as "-".
+ */
+void perfctr_print(FILE *file, const char *label, const perfctr_values *values, unsigned long long bytes)
+{
+    fprintf(file, "%s:", label);
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        if (values->valid[i] && bytes > 0)
+        {
+            fprintf(file, " %s/B %.4f", perfctr_names[i], values->counts[i] / bytes);
+        }
+        else
+        {
+            fprintf(file, " %s/B -", perfctr_names[i]);
+        }
+    }
+    if (values->valid[PERFCTR_CYCLES] && values->valid[PERFCTR_INSTRUCTIONS] && values->counts[PERFCTR_CYCLES] > 0)
+    {
+        fprintf(file, " IPC %.2f\n", values->counts[PERFCTR_INSTRUCTIONS] / values->counts[PERFCTR_CYCLES]);
+    }
+    else
+    {
+        fprintf(file, " IPC -\n");
+    }
+}
+
+/**
+ * @brief Prints the counts per byte and the IPC as a JSON object, with null for the missing counters.
+ */
+void perfctr_print_json(FILE *file, const perfctr_values *values, unsigned long long bytes)
+{
+    fprintf(file, "{");
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        if (values->valid[i] && bytes > 0)
+        {
+            fprintf(file, "\"%s_per_byte\": %.6f, ", perfctr_names[i], values->counts[i] / bytes);
+        }
+        else
+        {
+            fprintf(file, "\"%s_per_byte\": null, ", perfctr_names[i]);
+        }
+    }
+    if (values->valid[PERFCTR_CYCLES] && values->valid[PERFCTR_INSTRUCTIONS] && values->counts[PERFCTR_CYCLES] > 0)
+    {
+        fprintf(file, "\"ipc\": %.3f}", values->counts[PERFCTR_INSTRUCTIONS] / values->counts[PERFCTR_CYCLES]);
+    }
+    else
+    {
+        fprintf(file, "\"ipc\": null}");
+    }
+}
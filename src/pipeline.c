@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/pipeline.h"
+#include "../include/stream.h"
+#include "../include/ring.h"
+#include "../include/io.h"
+#include "../include/stats.h"
+#include "../include/probes.h"
+#include "../include/more.h"
+
+// A chunk buffer of the pool.
+typedef struct
+{
+    unsigned char *data;
+    size_t length;     // Input bytes read
+    size_t out_length; // Bytes to write, padded to a block
+    stream_ctx ctx;    // Chaining state at the start of the chunk (parallel modes)
+    int status;
+} pipeline_chunk;
+
+typedef struct
+{
+    stream_ctx *ctx;
+    bool parallel;
+    int in_fd;
+    int out_fd;
+    size_t chunk_size;
+    int num_workers;
+    spsc_ring free_ring;   // Writer to reader: empty buffers
+    spsc_ring *work_rings; // Reader to worker i: chunks to process
+    spsc_ring *done_rings; // Worker i to writer: processed chunks
+    bool failed;
+    int read_status;
+} pipeline;
+
+typedef struct
+{
+    pipeline *p;
+    int index;
+} pipeline_worker;
+
+/**
+ * @brief Reader stage: fills free buffers and deals them to the workers in turn.
+ *
+ * Chunk i goes to worker i % num_workers, so the writer can restore the order
+ * by taking from the workers in the same turn. A NULL chunk tells each worker
+ * that the input is over.
+ */
+static void *pipeline_reader(void *arg)
+{
+    pipeline *p = (pipeline *)arg;
+    stream_ctx running = *p->ctx;
+    unsigned long long i = 0;
+    for (;;)
+    {
+        pipeline_chunk *chunk = (pipeline_chunk *)spsc_pop(&p->free_ring);
+        if (__atomic_load_n(&p->failed, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        double read_start = stats_begin();
+        ssize_t n = read_full(p->in_fd, chunk->data, p->chunk_size);
+        stats_end(STATS_READ, read_start, n > 0 ? (unsigned long long)n : 0);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            p->read_status = EXIT_FAILURE;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        chunk->length = (size_t)n;
+        chunk->out_length = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(chunk->data + n, 0, chunk->out_length - (size_t)n);
+        if (p->parallel)
+        {
+            // The chaining state of the next chunk only depends on this input.
+            chunk->ctx = running;
+            stream_skip(&running, chunk->data, chunk->out_length);
+        }
+        AES_PROBE2(job_queue, AES_ENGINE_PIPELINE, chunk->out_length);
+        spsc_push(&p->work_rings[i % p->num_workers], chunk);
+        i++;
+        if ((size_t)n < p->chunk_size)
+        {
+            break;
+        }
+    }
+    for (int w = 0; w < p->num_workers; w++)
+    {
+        spsc_push(&p->work_rings[(i + w) % p->num_workers], NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cipher stage: processes the chunks of one worker ring in place.
+ *
+ * In serial modes there is a single worker and it carries the shared context
+ * from chunk to chunk; in parallel modes each chunk brings its own.
+ */
+static void *pipeline_cipher(void *arg)
+{
+    pipeline_worker *worker = (pipeline_worker *)arg;
+    pipeline *p = worker->p;
+    for (;;)
+    {
+        pipeline_chunk *chunk = (pipeline_chunk *)spsc_pop(&p->work_rings[worker->index]);
+        if (chunk != NULL)
+        {
+            stream_ctx *ctx = p->parallel ? &chunk->ctx : p->ctx;
+            AES_PROBE2(job_dequeue, AES_ENGINE_PIPELINE, chunk->out_length);
+            double cipher_start = stats_begin();
+            AES_PROBE3(chunk_start, AES_ENGINE_PIPELINE, ctx->mode, chunk->out_length);
+            chunk->status = stream_update(ctx, chunk->data, chunk->data, chunk->out_length);
+            AES_PROBE3(chunk_end, AES_ENGINE_PIPELINE, ctx->mode, chunk->out_length);
+            stats_end(STATS_CIPHER, cipher_start, chunk->out_length);
+        }
+        spsc_push(&p->done_rings[worker->index], chunk);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Encrypts or decrypts a file with a reader thread, cipher workers and a writer.
+ *
+ * The stages are connected by single-producer single-consumer lock-free rings
+ * and share a fixed pool of 2 * num_workers + 2 chunk buffers, so reading,
+ * encryption and writing overlap and memory use stays constant. Chunks are
+ * written in input order. CBC and CFB encryption run on one worker, the other
+ * modes on num_workers.
+ *
+ * @param ctx          The streaming context.
+ * @param in_fd        The file descriptor to read from.
+ * @param out_fd       The file descriptor to write to.
+ * @param chunk_size   The chunk size in bytes, rounded up to a multiple of BLOCK_SIZE.
+ * @param num_workers  The number of cipher workers.
+ * @param bytes_out    Pointer to store the number of bytes written (may be NULL).
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int pipeline_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, int num_workers, unsigned long long *bytes_out)
+{
+    pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.ctx = ctx;
+    p.parallel = stream_is_parallel(ctx);
+    p.in_fd = in_fd;
+    p.out_fd = out_fd;
+    p.chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (p.chunk_size == 0)
+    {
+        p.chunk_size = BLOCK_SIZE;
+    }
+    if (num_workers < 1)
+    {
+        num_workers = 1;
+    }
+    p.num_workers = p.parallel ? (num_workers > PIPELINE_MAX_WORKERS ? PIPELINE_MAX_WORKERS : num_workers) : 1;
+    p.read_status = EXIT_SUCCESS;
+
+    // Buffer pool and rings.
+    size_t num_chunks = 2 * (size_t)p.num_workers + 2;
+    pipeline_chunk *chunks = (pipeline_chunk *)calloc(num_chunks, sizeof(pipeline_chunk));
+    unsigned char *memory = (unsigned char *)malloc(num_chunks * p.chunk_size);
+    p.work_rings = (spsc_ring *)calloc(p.num_workers, sizeof(spsc_ring));
+    p.done_rings = (spsc_ring *)calloc(p.num_workers, sizeof(spsc_ring));
+    int status = chunks != NULL && memory != NULL && p.work_rings != NULL && p.done_rings != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS && spsc_init(&p.free_ring, num_chunks) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    int rings_ready = 0;
+    for (; status == EXIT_SUCCESS && rings_ready < p.num_workers; rings_ready++)
+    {
+        if (spsc_init(&p.work_rings[rings_ready], num_chunks + 1) != 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (spsc_init(&p.done_rings[rings_ready], num_chunks + 1) != 0)
+        {
+            spsc_free(&p.work_rings[rings_ready]);
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+    if (status != EXIT_SUCCESS)
+    {
+        printf("Memory allocation failed for the pipeline.\n");
+    }
+    else
+    {
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            chunks[c].data = memory + c * p.chunk_size;
+            spsc_push(&p.free_ring, &chunks[c]);
+        }
+    }
+
+    // Start the reader and the workers; this thread is the writer.
+    pthread_t reader;
+    pthread_t workers[PIPELINE_MAX_WORKERS];
+    pipeline_worker worker_args[PIPELINE_MAX_WORKERS];
+    int started = 0;
+    bool reader_started = false;
+    if (status == EXIT_SUCCESS)
+    {
+        for (; started < p.num_workers; started++)
+        {
+            worker_args[started].p = &p;
+            worker_args[started].index = started;
+            if (pthread_create(&workers[started], NULL, pipeline_cipher, &worker_args[started]) != 0)
+            {
+                break;
+            }
+        }
+        if (started == p.num_workers && pthread_create(&reader, NULL, pipeline_reader, &p) == 0)
+        {
+            reader_started = true;
+        }
+        else
+        {
+            printf("Failed to start the pipeline threads.\n");
+            status = EXIT_FAILURE;
+            for (int w = 0; w < started; w++)
+            {
+                spsc_push(&p.work_rings[w], NULL);
+            }
+        }
+    }
+
+    unsigned long long total = 0;
+    if (reader_started)
+    {
+        // Writer stage: take the chunks back in input order. After a failure,
+        // keep draining so that the other stages can finish.
+        for (unsigned long long i = 0;; i++)
+        {
+            pipeline_chunk *chunk = (pipeline_chunk *)spsc_pop(&p.done_rings[i % p.num_workers]);
+            if (chunk == NULL)
+            {
+                break;
+            }
+            if (status == EXIT_SUCCESS && chunk->status != 0)
+            {
+                status = EXIT_FAILURE;
+            }
+            double write_start = stats_begin();
+            if (status == EXIT_SUCCESS && write_all(out_fd, chunk->data, chunk->out_length) != EXIT_SUCCESS)
+            {
+                printf("Failed to write the output.\n");
+                status = EXIT_FAILURE;
+            }
+            stats_end(STATS_WRITE, write_start, status == EXIT_SUCCESS ? chunk->out_length : 0);
+            if (status != EXIT_SUCCESS)
+            {
+                __atomic_store_n(&p.failed, true, __ATOMIC_RELEASE);
+            }
+            else
+            {
+                total += chunk->out_length;
+            }
+            spsc_push(&p.free_ring, chunk);
+        }
+        pthread_join(reader, NULL);
+        if (p.read_status != EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    for (int w = 0; w < started; w++)
+    {
+        pthread_join(workers[w], NULL);
+    }
+
+    for (int r = 0; r < rings_ready; r++)
+    {
+        spsc_free(&p.work_rings[r]);
+        spsc_free(&p.done_rings[r]);
+    }
+    if (p.free_ring.slots != NULL)
+    {
+        spsc_free(&p.free_ring);
+    }
+    free(p.work_rings);
+    free(p.done_rings);
+    free(memory);
+    free(chunks);
+    if (bytes_out != NULL)
+    {
+        *bytes_out = total;
+    }
+    return status;
+}
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "../include/ring.h"
+
+// Private futexes: both ends of a ring are threads of this process.
+static void ring_event_wait(ring_event *event, uint32_t sequence)
+{
+    syscall(SYS_futex, &event->sequence, FUTEX_WAIT_PRIVATE, sequence, NULL, NULL, 0);
+}
+
+// Called after the ring changed; the fence orders that change before the sleepers check.
+static void ring_event_signal(ring_event *event)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event->sleepers, __ATOMIC_SEQ_CST) > 0)
+    {
+        __atomic_add_fetch(&event->sequence, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &event->sequence, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief Initializes a ring.
+ *
+ * @param ring      The ring to initialize.
+ * @param capacity  The number of slots, rounded up to a power of two.
+ * @return 0 on success, -1 on failure.
+ */
+int spsc_init(spsc_ring *ring, size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    ring->slots = (void **)calloc(size, sizeof(void *));
+    if (ring->slots == NULL)
+    {
+        printf("Memory allocation failed for the ring.\n");
+        return -1;
+    }
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->not_full = (ring_event){0, 0};
+    ring->not_empty = (ring_event){0, 0};
+    return 0;
+}
+
+/**
+ * @brief Frees the slots of a ring.
+ *
+ * @param ring  The ring.
+ */
+void spsc_free(spsc_ring *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief Pushes an item if the ring is not full. Producer side only.
+ *
+ * @return true if the item was pushed.
+ */
+bool spsc_try_push(spsc_ring *ring, void *item)
+{
+    size_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+    {
+        return false;
+    }
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Pops an item if the ring is not empty. Consumer side only.
+ *
+ * @return true if an item was popped.
+ */
+bool spsc_try_pop(spsc_ring *ring, void **item)
+{
+    size_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    *item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Pushes an item, waiting while the ring is full.
+ *
+ * Yields for a few polls, then sleeps on the not_full futex until the consumer pops.
+ */
+void spsc_push(spsc_ring *ring, void *item)
+{
+    for (int spins = 0; !spsc_try_push(ring, item); spins++)
+    {
+        if (spins < RING_SPINS)
+        {
+            sched_yield();
+            continue;
+        }
+        // Announce the sleeper before the last check, so a pop after it
+        // is seen by it or changes the sequence and wakes the futex.
+        __atomic_add_fetch(&ring->not_full.sleepers, 1, __ATOMIC_SEQ_CST);
+        uint32_t sequence = __atomic_load_n(&ring->not_full.sequence, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool pushed = spsc_try_push(ring, item);
+        if (!pushed)
+        {
+            ring_event_wait(&ring->not_full, sequence);
+        }
+        __atomic_sub_fetch(&ring->not_full.sleepers, 1, __ATOMIC_SEQ_CST);
+        if (pushed)
+        {
+            break;
+        }
+    }
+    ring_event_signal(&ring->not_empty);
+}
+
+/**
+ * @brief Pops an item, waiting while the ring is empty.
+ *
+ * Yields for a few polls, then sleeps on the not_empty futex until the producer pushes.
+ */
+void *spsc_pop(spsc_ring *ring)
+{
+    void *item;
+    for (int spins = 0; !spsc_try_pop(ring, &item); spins++)
+    {
+        if (spins < RING_SPINS)
+        {
+            sched_yield();
+            continue;
+        }
+        __atomic_add_fetch(&ring->not_empty.sleepers, 1, __ATOMIC_SEQ_CST);
+        uint32_t sequence = __atomic_load_n(&ring->not_empty.sequence, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool popped = spsc_try_pop(ring, &item);
+        if (!popped)
+        {
+            ring_event_wait(&ring->not_empty, sequence);
+        }
+        __atomic_sub_fetch(&ring->not_empty.sleepers, 1, __ATOMIC_SEQ_CST);
+        if (popped)
+        {
+            break;
+        }
+    }
+    ring_event_signal(&ring->not_full);
+    return item;
+}
+
+/**
+ * @brief Initializes a multi-producer multi-consumer ring.
+ *
+ * @param ring      The ring to initialize.
+ * @param capacity  The number of slots, rounded up to a power of two.
+ * @return 0 on success, -1 on failure.
+ */
+int mpmc_init(mpmc_ring *ring, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    ring->cells = (struct mpmc_cell *)calloc(size, sizeof(struct mpmc_cell));
+    if (ring->cells == NULL)
+    {
+        printf("Memory allocation failed for the ring.\n");
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        ring->cells[i].sequence = i;
+    }
+    ring->mask = size - 1;
+    ring->enqueue = 0;
+    ring->dequeue = 0;
+    return 0;
+}
+
+void mpmc_free(mpmc_ring *ring)
+{
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+/**
+ * @brief Pushes an item if the ring is not full. Any thread.
+ *
+ * Each cell carries a sequence number telling whether it is free for the
+ * push of a given position or holds the item of that position, so producers
+ * and consumers only compete on their own position counter.
+ *
+ * @return true if the item was pushed.
+ */
+bool mpmc_try_push(mpmc_ring *ring, void *item)
+{
+    size_t position = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+    struct mpmc_cell *cell;
+    for (;;)
+    {
+        cell = &ring->cells[position & ring->mask];
+        intptr_t difference = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)position;
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->enqueue, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+    cell->item = item;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Pops an item if the ring is not empty. Any thread.
+ *
+ * @return true if an item was popped.
+ */
+bool mpmc_try_pop(mpmc_ring *ring, void **item)
+{
+    size_t position = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+    struct mpmc_cell *cell;
+    for (;;)
+    {
+        cell = &ring->cells[position & ring->mask];
+        intptr_t difference = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)(position + 1);
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->dequeue, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+        }
+    }
+    *item = cell->item;
+    __atomic_store_n(&cell->sequence, position + ring->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../include/shm.h"
+#include "../include/ring.h"
+#include "../include/keycache.h"
+#include "../include/stream.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+#define SHM_SPINS 64 // Polls of an idle ring or slot before sleeping on its futex
+
+// Slot states; SHM_WAITING is set on top of SHM_SUBMITTED by a client going to sleep.
+#define SHM_IDLE 0
+#define SHM_SUBMITTED 1
+#define SHM_DONE 2
+#define SHM_WAITING 4
+
+// Futex word with a sleeper count: signalling costs no system call while nobody sleeps.
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t sleepers;
+} shm_event;
+
+// Bounded multi-producer multi-consumer ring of slot numbers (Vyukov's algorithm).
+typedef struct
+{
+    _Alignas(RING_CACHE_LINE) uint32_t enqueue;
+    _Alignas(RING_CACHE_LINE) uint32_t dequeue;
+    _Alignas(RING_CACHE_LINE) shm_event not_empty;
+    struct
+    {
+        uint32_t sequence;
+        uint32_t slot;
+    } cells[SHM_SLOTS];
+} shm_ring;
+
+typedef struct
+{
+    _Alignas(RING_CACHE_LINE) uint32_t state; // Futex word
+    uint32_t status;
+    uint32_t encrypt;
+    uint32_t mode;
+    uint32_t key_id;
+    uint32_t key_length;
+    uint32_t length; // Payload length in, result length out
+    unsigned char key[32];
+    unsigned char iv[BLOCK_SIZE];
+} shm_slot;
+
+struct shm_region
+{
+    char magic[8]; // Written last by the server
+    uint32_t slots;
+    uint32_t slot_size;
+    uint64_t payload_offset;
+    int32_t server_pid;
+    shm_ring free;
+    shm_ring submitted;
+    shm_slot slot[SHM_SLOTS];
+};
+
+typedef struct
+{
+    shm_region *region;
+    keycache keys;
+} shm_server;
+
+static volatile sig_atomic_t shm_stop = 0;
+
+static void shm_on_signal(int signal_number)
+{
+    (void)signal_number;
+    shm_stop = 1;
+}
+
+static size_t shm_header_size(void)
+{
+    return (sizeof(shm_region) + 4095) / 4096 * 4096;
+}
+
+static size_t shm_region_size(void)
+{
+    return shm_header_size() + (size_t)SHM_SLOTS * SHM_SLOT_SIZE;
+}
+
+// From the layout, never from the shared header, which any client can write.
+static unsigned char *shm_payload(shm_region *region, int slot)
+{
+    return (unsigned char *)region + shm_header_size() + (size_t)slot * SHM_SLOT_SIZE;
+}
+
+// Shared futexes (not FUTEX_PRIVATE_FLAG): the waiters are in other processes.
+static int futex_wait(uint32_t *word, uint32_t value, const struct timespec *timeout)
+{
+    return (int)syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static void shm_event_signal(shm_event *event)
+{
+    __atomic_add_fetch(&event->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event->sleepers, __ATOMIC_SEQ_CST) > 0)
+    {
+        futex_wake(&event->sequence, 1);
+    }
+}
+
+static void shm_ring_init(shm_ring *ring)
+{
+    for (uint32_t i = 0; i < SHM_SLOTS; i++)
+    {
+        ring->cells[i].sequence = i;
+    }
+    ring->enqueue = 0;
+    ring->dequeue = 0;
+}
+
+/**
+ * @brief Pushes a slot number. The ring holds every slot at most once, so it is never full.
+ */
+static void shm_ring_push(shm_ring *ring, uint32_t slot)
+{
+    uint32_t position = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        uint32_t sequence = __atomic_load_n(&ring->cells[position % SHM_SLOTS].sequence, __ATOMIC_ACQUIRE);
+        int32_t difference = (int32_t)(sequence - position);
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->enqueue, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            sched_yield(); // A consumer has not released the cell yet
+            position = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+    ring->cells[position % SHM_SLOTS].slot = slot;
+    __atomic_store_n(&ring->cells[position % SHM_SLOTS].sequence, position + 1, __ATOMIC_RELEASE);
+    shm_event_signal(&ring->not_empty);
+}
+
+/**
+ * @brief Pops a slot number if the ring is not empty.
+ *
+ * @return The slot, or -1 if the ring is empty.
+ */
+static int shm_ring_try_pop(shm_ring *ring)
+{
+    uint32_t position = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        uint32_t sequence = __atomic_load_n(&ring->cells[position % SHM_SLOTS].sequence, __ATOMIC_ACQUIRE);
+        int32_t difference = (int32_t)(sequence - (position + 1));
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->dequeue, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+        }
+    }
+    int slot = (int)ring->cells[position % SHM_SLOTS].slot;
+    __atomic_store_n(&ring->cells[position % SHM_SLOTS].sequence, position + SHM_SLOTS, __ATOMIC_RELEASE);
+    return slot;
+}
+
+/**
+ * @brief Pops a slot number, polling a while and then sleeping while the ring is empty.
+ *
+ * @param ring    The ring.
+ * @param server  The service to check on while sleeping, or 0 to wait for ever (the service itself).
+ * @return The slot, or -1 if the service is gone or the ring stayed empty for SHM_ACQUIRE_TIMEOUT seconds.
+ */
+static int shm_ring_pop(shm_ring *ring, pid_t server)
+{
+    double deadline = monotonic_seconds() + SHM_ACQUIRE_TIMEOUT;
+    for (;;)
+    {
+        for (int spin = 0; spin < SHM_SPINS; spin++)
+        {
+            int slot = shm_ring_try_pop(ring);
+            if (slot >= 0)
+            {
+                return slot;
+            }
+            sched_yield();
+        }
+        // Announce the sleep before the last check, so a push in between either
+        // is seen by it or changes the sequence and wakes the futex.
+        uint32_t sequence = __atomic_load_n(&ring->not_empty.sequence, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&ring->not_empty.sleepers, 1, __ATOMIC_SEQ_CST);
+        int slot = shm_ring_try_pop(ring);
+        bool timed_out = false;
+        if (slot < 0)
+        {
+            struct timespec timeout = {1, 0};
+            timed_out = futex_wait(&ring->not_empty.sequence, sequence, server != 0 ? &timeout : NULL) != 0 && errno == ETIMEDOUT;
+        }
+        __atomic_sub_fetch(&ring->not_empty.sleepers, 1, __ATOMIC_SEQ_CST);
+        if (slot >= 0)
+        {
+            return slot;
+        }
+        if (timed_out && ((kill(server, 0) != 0 && errno == ESRCH) || monotonic_seconds() > deadline))
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Serves one submitted slot: encrypts or decrypts its payload in place.
+ *
+ * Clients can write the slot at any time, so the request is read out of it
+ * once and only the copy is checked and used.
+ */
+static void shm_serve_slot(shm_server *server, int index)
+{
+    shm_slot *slot = &server->region->slot[index];
+    unsigned char *payload = shm_payload(server->region, index);
+    uint32_t encrypt = __atomic_load_n(&slot->encrypt, __ATOMIC_RELAXED);
+    uint32_t mode = __atomic_load_n(&slot->mode, __ATOMIC_RELAXED);
+    uint32_t key_id = __atomic_load_n(&slot->key_id, __ATOMIC_RELAXED);
+    uint32_t key_length = __atomic_load_n(&slot->key_length, __ATOMIC_RELAXED);
+    size_t length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+    unsigned char key[sizeof(slot->key)];
+    unsigned char iv[BLOCK_SIZE];
+    memcpy(key, slot->key, sizeof(key));
+    memcpy(iv, slot->iv, BLOCK_SIZE);
+    size_t padded = (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    daemon_status status = DAEMON_OK;
+    AES_PROBE2(job_dequeue, AES_ENGINE_SHM, length);
+    if (key_length > sizeof(key) || encrypt > 1 || mode > STREAM_CTR)
+    {
+        status = DAEMON_BAD_REQUEST;
+    }
+    else if (padded > SHM_SLOT_SIZE)
+    {
+        status = DAEMON_TOO_LARGE;
+    }
+    key_schedule schedule;
+    if (status == DAEMON_OK)
+    {
+        status = daemon_status_from_key(keycache_get(&server->keys, key_id, key, key_length, &schedule));
+    }
+    if (status == DAEMON_OK)
+    {
+        memset(payload + length, 0, padded - length);
+        unsigned char *round_keys[AES_MAX_ROUND_KEYS + 1];
+        stream_ctx ctx;
+        key_schedule_ctx(&schedule, round_keys, (stream_mode)mode, encrypt != 0, iv, &ctx);
+        AES_PROBE3(chunk_start, AES_ENGINE_SHM, mode, padded);
+        status = stream_update(&ctx, payload, payload, padded) == EXIT_SUCCESS ? DAEMON_OK : DAEMON_FAILED;
+        AES_PROBE3(chunk_end, AES_ENGINE_SHM, mode, padded);
+    }
+    slot->status = (uint32_t)status;
+    slot->length = status == DAEMON_OK ? (uint32_t)padded : 0;
+    if (__atomic_exchange_n(&slot->state, SHM_DONE, __ATOMIC_SEQ_CST) & SHM_WAITING)
+    {
+        futex_wake(&slot->state, 1);
+    }
+}
+
+static void *shm_worker(void *arg)
+{
+    shm_server *server = (shm_server *)arg;
+    for (;;)
+    {
+        // The slot number comes from shared memory: a stray one is dropped.
+        uint32_t index = (uint32_t)shm_ring_pop(&server->region->submitted, 0);
+        if (index < SHM_SLOTS)
+        {
+            shm_serve_slot(server, (int)index);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Builds the path of a region in /dev/shm.
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the name is not a plain file name or is too long.
+ */
+static int shm_path(const char *name, char *path, size_t size)
+{
+    if (*name == '/')
+    {
+        name++;
+    }
+    if (*name == '\0' || strchr(name, '/') != NULL || (size_t)snprintf(path, size, "/dev/shm/%s", name) >= size)
+    {
+        printf("Invalid shared memory name.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Runs the shared-memory service: creates the region and serves its slots with a pool of workers.
+ *
+ * Requests are the same as the daemon's (see include/daemon.h) and key
+ * schedules are cached by key id the same way. The service stops on SIGINT
+ * or SIGTERM and removes the region; clients still attached keep their
+ * mapping but their requests are no longer served.
+ *
+ * @param name         The region name in /dev/shm; an existing region is replaced.
+ * @param num_workers  The number of workers.
+ * @param verbose      Report the start and stop on stderr.
+ * @return EXIT_SUCCESS after a signal, EXIT_FAILURE if the service cannot start.
+ */
+int shm_serve(const char *name, int num_workers, bool verbose)
+{
+    char path[256];
+    if (shm_path(name, path, sizeof(path)) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    static shm_server server;
+    if (keycache_init(&server.keys, KEYCACHE_DEFAULT_CAPACITY) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    size_t size = shm_region_size();
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0)
+    {
+        printf("Failed to create %s.\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(path);
+        }
+        return EXIT_FAILURE;
+    }
+    server.region = (shm_region *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (server.region == MAP_FAILED)
+    {
+        printf("Failed to map %s.\n", path);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    shm_region *region = server.region;
+    region->slots = SHM_SLOTS;
+    region->slot_size = SHM_SLOT_SIZE;
+    region->payload_offset = shm_header_size();
+    region->server_pid = (int32_t)getpid();
+    shm_ring_init(&region->free);
+    shm_ring_init(&region->submitted);
+    for (uint32_t i = 0; i < SHM_SLOTS; i++)
+    {
+        shm_ring_push(&region->free, i);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(region->magic, SHM_MAGIC, sizeof(region->magic));
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = shm_on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, shm_worker, &server) != 0)
+        {
+            printf("Failed to start the workers.\n");
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+        pthread_detach(thread);
+    }
+    if (verbose)
+    {
+        fprintf(stderr, "Serving %s with %d workers.\n", path, num_workers);
+    }
+    while (!shm_stop)
+    {
+        pause();
+    }
+    unlink(path);
+    if (verbose)
+    {
+        keycache_print_stats(&server.keys);
+        fprintf(stderr, "Stopped.\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Maps the region of a running service.
+ *
+ * A client can be shared by the threads of a process.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if there is no service under name.
+ */
+int shm_attach(const char *name, shm_client *client)
+{
+    char path[256];
+    if (shm_path(name, path, sizeof(path)) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    client->size = shm_region_size();
+    int fd = open(path, O_RDWR);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size != client->size)
+    {
+        printf("No shared memory service at %s.\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    client->region = (shm_region *)mmap(NULL, client->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (client->region == MAP_FAILED)
+    {
+        printf("Failed to map %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    if (memcmp(client->region->magic, SHM_MAGIC, sizeof(client->region->magic)) != 0 || client->region->slots != SHM_SLOTS ||
+        client->region->slot_size != SHM_SLOT_SIZE)
+    {
+        printf("The shared memory service at %s is not ready or has another layout.\n", path);
+        shm_detach(client);
+        return EXIT_FAILURE;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return EXIT_SUCCESS;
+}
+
+void shm_detach(shm_client *client)
+{
+    if (client->region != NULL && client->region != MAP_FAILED)
+    {
+        munmap(client->region, client->size);
+    }
+    client->region = NULL;
+}
+
+/**
+ * @brief Takes a free slot, waiting while all of them are in use.
+ *
+ * The wait checks every second that the service is alive, and gives up
+ * after SHM_ACQUIRE_TIMEOUT seconds, when slots were kept by clients that
+ * exited without releasing them.
+ *
+ * @param client   The client.
+ * @param payload  Set to the slot payload buffer, SHM_SLOT_SIZE bytes: write the data there.
+ * @return The slot number, or -1 if the service is gone or no slot was freed in time.
+ */
+int shm_acquire(shm_client *client, unsigned char **payload)
+{
+    int slot = shm_ring_pop(&client->region->free, (pid_t)client->region->server_pid);
+    *payload = slot >= 0 ? shm_payload(client->region, slot) : NULL;
+    return slot;
+}
+
+/**
+ * @brief Submits the payload of a slot and waits until it is encrypted or decrypted in place.
+ *
+ * The result stays in the slot payload buffer, padded to a block, until the
+ * slot is released.
+ *
+ * @param client         The client.
+ * @param slot           A slot taken with shm_acquire.
+ * @param request        The operation, mode, key or key id and IV.
+ * @param length         The payload length, at most SHM_SLOT_SIZE.
+ * @param result_length  Set to the result length.
+ * @param status         Set to the service status, DAEMON_BAD_REQUEST for a slot out of range.
+ * @return EXIT_SUCCESS if the request was served, EXIT_FAILURE if the service is gone or the slot is out of range.
+ */
+int shm_submit_wait(shm_client *client, int slot, const daemon_request *request, size_t length, size_t *result_length, daemon_status *status)
+{
+    if (slot < 0 || slot >= SHM_SLOTS)
+    {
+        *status = DAEMON_BAD_REQUEST;
+        *result_length = 0;
+        return EXIT_FAILURE;
+    }
+    shm_region *region = client->region;
+    shm_slot *entry = &region->slot[slot];
+    entry->encrypt = request->encrypt ? 1 : 0;
+    entry->mode = (uint32_t)request->mode;
+    entry->key_id = request->key_id;
+    entry->key_length = (uint32_t)request->key_length;
+    memcpy(entry->key, request->key, sizeof(entry->key));
+    memcpy(entry->iv, request->iv, BLOCK_SIZE);
+    entry->length = length > SHM_SLOT_SIZE ? SHM_SLOT_SIZE + 1 : (uint32_t)length;
+    __atomic_store_n(&entry->state, SHM_SUBMITTED, __ATOMIC_RELEASE);
+    AES_PROBE2(job_queue, AES_ENGINE_SHM, length);
+    shm_ring_push(&region->submitted, (uint32_t)slot);
+
+    for (int spin = 0; spin < SHM_SPINS && __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) != SHM_DONE; spin++)
+    {
+        sched_yield();
+    }
+    uint32_t expected = SHM_SUBMITTED;
+    if (__atomic_compare_exchange_n(&entry->state, &expected, SHM_SUBMITTED | SHM_WAITING, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+    {
+        // Sleep until the worker marks the slot done, checking now and then that the service is alive.
+        struct timespec timeout = {1, 0};
+        while (__atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) != SHM_DONE)
+        {
+            if (futex_wait(&entry->state, SHM_SUBMITTED | SHM_WAITING, &timeout) != 0 && errno == ETIMEDOUT &&
+                kill((pid_t)region->server_pid, 0) != 0 && errno == ESRCH)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    *status = (daemon_status)entry->status;
+    *result_length = entry->length;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Gives a slot back once its result has been used. A slot out of range is ignored.
+ */
+void shm_release(shm_client *client, int slot)
+{
+    if (slot < 0 || slot >= SHM_SLOTS)
+    {
+        return;
+    }
+    __atomic_store_n(&client->region->slot[slot].state, SHM_IDLE, __ATOMIC_RELAXED);
+    shm_ring_push(&client->region->free, (uint32_t)slot);
+}
+
+// One load test client thread.
+typedef struct
+{
+    shm_client *client;
+    const daemon_request *request;
+    size_t payload_size;
+    unsigned long requests;
+    double *latencies; // Seconds, one per request
+    unsigned long failures;
+} shm_load_client;
+
+static void *shm_load_run(void *arg)
+{
+    shm_load_client *load = (shm_load_client *)arg;
+    daemon_request request = *load->request;
+    for (unsigned long i = 0; i < load->requests; i++)
+    {
+        double start = monotonic_seconds();
+        unsigned char *payload;
+        int slot = shm_acquire(load->client, &payload);
+        if (slot < 0)
+        {
+            load->failures += load->requests - i;
+            break;
+        }
+        memset(payload, (int)(i & 0xff), load->payload_size);
+        size_t result_length;
+        daemon_status status = DAEMON_FAILED;
+        if (shm_submit_wait(load->client, slot, &request, load->payload_size, &result_length, &status) != EXIT_SUCCESS)
+        {
+            load->failures += load->requests - i;
+            break;
+        }
+        shm_release(load->client, slot);
+        load->latencies[i] = monotonic_seconds() - start;
+        if (status != DAEMON_OK)
+        {
+            load->failures++;
+        }
+        if (request.key_id != 0)
+        {
+            request.key_length = 0; // The key is cached after the first request
+        }
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief Load test: clients threads each submit requests requests and the latencies are reported.
+ *
+ * Same report as daemon_load_test, so the two transports can be compared;
+ * the latency includes writing the payload into the slot.
+ *
+ * @return EXIT_SUCCESS if every request succeeded, EXIT_FAILURE otherwise.
+ */
+int shm_load_test(const char *name, const daemon_request *request, size_t payload_size, int clients, unsigned long requests)
+{
+    if (payload_size > SHM_SLOT_SIZE)
+    {
+        printf("The payload is larger than a slot (%d bytes).\n", SHM_SLOT_SIZE);
+        return EXIT_FAILURE;
+    }
+    shm_client client;
+    if (shm_attach(name, &client) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    size_t total = (size_t)clients * requests;
+    double *latencies = (double *)calloc(total + 1, sizeof(double));
+    shm_load_client *loads = (shm_load_client *)calloc((size_t)clients, sizeof(shm_load_client));
+    pthread_t *threads = (pthread_t *)calloc((size_t)clients, sizeof(pthread_t));
+    if (latencies == NULL || loads == NULL || threads == NULL)
+    {
+        printf("Memory allocation failed.\n");
+        free(latencies);
+        free(loads);
+        free(threads);
+        shm_detach(&client);
+        return EXIT_FAILURE;
+    }
+    double start = monotonic_seconds();
+    int started = 0;
+    for (int c = 0; c < clients; c++)
+    {
+        loads[c].client = &client;
+        loads[c].request = request;
+        loads[c].payload_size = payload_size;
+        loads[c].requests = requests;
+        loads[c].latencies = latencies + (size_t)c * requests;
+        if (pthread_create(&threads[c], NULL, shm_load_run, &loads[c]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    unsigned long failures = 0;
+    for (int c = 0; c < started; c++)
+    {
+        pthread_join(threads[c], NULL);
+        failures += loads[c].failures;
+    }
+    double elapsed = monotonic_seconds() - start;
+    total = (size_t)started * requests;
+    qsort(latencies, total, sizeof(double), compare_double);
+    if (total > 0)
+    {
+        printf("%zu requests of %zu bytes on %d clients in %f seconds, %lu failed\n", total, payload_size, started, elapsed, failures);
+        printf("%.0f requests/s, %.1f MB/s\n", total / elapsed, total * (double)payload_size / elapsed / 1e6);
+        printf("Latency p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6,
+               latencies[total - 1] * 1e6);
+    }
+    free(latencies);
+    free(loads);
+    free(threads);
+    shm_detach(&client);
+    return failures == 0 && started == clients ? EXIT_SUCCESS : EXIT_FAILURE;
+}
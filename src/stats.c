@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "../include/stats.h"
+#include "../include/more.h"
+
+static const char *const stats_names[STATS_STAGES] = {"read", "split", "key_setup", "cipher", "concatenate", "write"};
+static const char *const stats_labels[STATS_STAGES] = {"read (file_parser / read)", "split_text_into_blocks", "key setup (KeyExpansion)",
+                                                       "mode loop", "concatenate_blocks", "write (write_to_file / write)"};
+
+static bool stats_on;
+static bool stats_summary;
+static const char *stats_json_file;
+static double stats_start;
+static int stats_threads = 1;
+static uint64_t stats_calls[STATS_STAGES];
+static uint64_t stats_nanoseconds[STATS_STAGES];
+static uint64_t stats_bytes[STATS_STAGES];
+
+static double stats_seconds(int stage)
+{
+    return __atomic_load_n(&stats_nanoseconds[stage], __ATOMIC_RELAXED) / 1e9;
+}
+
+static void stats_print_summary(FILE *file, double wall, unsigned long long bytes, const struct rusage *usage, double cpu)
+{
+    fprintf(file, "Statistics: %llu bytes in %f seconds (%.1f MB/s)\n", bytes, wall, wall > 0 ? bytes / wall / 1e6 : 0.0);
+    fprintf(file, "  %-30s %8s %12s %7s %14s %10s\n", "stage", "calls", "seconds", "% wall", "bytes", "MB/s");
+    for (int i = 0; i < STATS_STAGES; i++)
+    {
+        uint64_t calls = __atomic_load_n(&stats_calls[i], __ATOMIC_RELAXED);
+        if (calls == 0)
+        {
+            continue;
+        }
+        double seconds = stats_seconds(i);
+        uint64_t stage_bytes = __atomic_load_n(&stats_bytes[i], __ATOMIC_RELAXED);
+        fprintf(file, "  %-30s %8llu %12.6f %7.1f", stats_labels[i], (unsigned long long)calls, seconds, wall > 0 ? 100.0 * seconds / wall : 0.0);
+        if (stage_bytes > 0 && seconds > 0)
+        {
+            fprintf(file, " %14llu %10.1f\n", (unsigned long long)stage_bytes, stage_bytes / seconds / 1e6);
+        }
+        else
+        {
+            fprintf(file, " %14s %10s\n", "-", "-");
+        }
+    }
+    fprintf(file, "  CPU %f seconds user, %f seconds system: %.2f of %d threads busy (%.0f%%)\n", usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+            usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, wall > 0 ? cpu / wall : 0.0, stats_threads,
+            wall > 0 ? 100.0 * cpu / wall / stats_threads : 0.0);
+    fprintf(file, "  Peak memory (max RSS) : %ld KiB\n", usage->ru_maxrss);
+}
+
+static void stats_print_json(FILE *file, double wall, unsigned long long bytes, const struct rusage *usage, double cpu)
+{
+    fprintf(file, "{\"wall_seconds\": %.6f, \"bytes\": %llu, \"mb_per_s\": %.3f, \"stages\": {", wall, bytes, wall > 0 ? bytes / wall / 1e6 : 0.0);
+    bool first = true;
+    for (int i = 0; i < STATS_STAGES; i++)
+    {
+        uint64_t calls = __atomic_load_n(&stats_calls[i], __ATOMIC_RELAXED);
+        if (calls == 0)
+        {
+            continue;
+        }
+        fprintf(file, "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6f, \"bytes\": %llu}", first ? "" : ", ", stats_names[i], (unsigned long long)calls,
+                stats_seconds(i), (unsigned long long)__atomic_load_n(&stats_bytes[i], __ATOMIC_RELAXED));
+        first = false;
+    }
+    fprintf(file, "}, \"cpu_user_seconds\": %.6f, \"cpu_system_seconds\": %.6f, \"threads\": %d, \"thread_utilization\": %.3f, \"peak_rss_kib\": %ld}\n",
+            usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6, usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, stats_threads,
+            wall > 0 ? cpu / wall / stats_threads : 0.0, usage->ru_maxrss);
+}
+
+/**
+ * @brief Prints the statistics when the program exits.
+ */
+static void stats_report(void)
+{
+    double wall = monotonic_seconds() - stats_start;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    // The bytes of the run are those read, or those that went through the cipher when nothing was read through a stage.
+    unsigned long long bytes = __atomic_load_n(&stats_bytes[STATS_READ], __ATOMIC_RELAXED);
+    if (bytes == 0)
+    {
+        bytes = __atomic_load_n(&stats_bytes[STATS_CIPHER], __ATOMIC_RELAXED);
+    }
+    if (stats_summary)
+    {
+        stats_print_summary(stderr, wall, bytes, &usage, cpu);
+    }
+    if (stats_json_file != NULL)
+    {
+        FILE *json = strcmp(stats_json_file, "-") == 0 ? stdout : fopen(stats_json_file, "w");
+        if (json == NULL)
+        {
+            fprintf(stderr, "Failed to open the file %s.\n", stats_json_file);
+            return;
+        }
+        stats_print_json(json, wall, bytes, &usage, cpu);
+        if (json != stdout)
+        {
+            fclose(json);
+        }
+    }
+}
+
+/**
+ * @brief Starts recording the stages, and reports them when the program exits.
+ *
+ * @param summary    true to print a summary on stderr.
+ * @param json_file  The file that receives the JSON report ("-" for stdout), or NULL.
+ */
+void stats_enable(bool summary, const char *json_file)
+{
+    if (!stats_on)
+    {
+        atexit(stats_report);
+    }
+    stats_on = true;
+    stats_summary = stats_summary || summary;
+    stats_json_file = json_file != NULL ? json_file : stats_json_file;
+    stats_start = monotonic_seconds();
+}
+
+/**
+ * @brief Returns the start time of a stage, or 0 while statistics are off.
+ */
+double stats_begin(void)
+{
+    return stats_on ? monotonic_seconds() : 0.0;
+}
+
+/**
+ * @brief Adds a call of a stage started at start, with the bytes it processed.
+ */
+void stats_end(stats_stage stage, double start, unsigned long long bytes)
+{
+    if (!stats_on)
+    {
+        return;
+    }
+    uint64_t nanoseconds = (uint64_t)((monotonic_seconds() - start) * 1e9);
+    __atomic_add_fetch(&stats_calls[stage], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats_nanoseconds[stage], nanoseconds, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats_bytes[stage], bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sets the number of threads the run uses, for the utilization.
+ */
+void stats_set_threads(int threads)
+{
+    stats_threads = threads > 0 ? threads : 1;
+}
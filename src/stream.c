@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/stream.h"
+#include "../include/ECB.h"
+#include "../include/CBC.h"
+#include "../include/CFB.h"
+#include "../include/CTR.h"
+#include "../include/io.h"
+#include "../include/stats.h"
+#include "../include/probes.h"
+#include "../include/more.h"
+
+/**
+ * @brief Converts a mode name (ECB, CBC, CFB, CTR) to a stream mode.
+ *
+ * @param name  The mode name given by the user.
+ * @param mode  Pointer to store the mode.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the mode is not supported.
+ */
+int stream_mode_from_name(const char *name, stream_mode *mode)
+{
+    if (strcmp(name, "ECB") == 0)
+    {
+        *mode = STREAM_ECB;
+    }
+    else if (strcmp(name, "CBC") == 0)
+    {
+        *mode = STREAM_CBC;
+    }
+    else if (strcmp(name, "CFB") == 0)
+    {
+        *mode = STREAM_CFB;
+    }
+    else if (strcmp(name, "CTR") == 0)
+    {
+        *mode = STREAM_CTR;
+    }
+    else
+    {
+        printf("Error mode, the mode input is not supported\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Initializes a streaming context.
+ *
+ * @param ctx          The context to initialize.
+ * @param mode         The mode name (ECB, CBC, CFB, CTR).
+ * @param encrypt      true to encrypt, false to decrypt.
+ * @param round_keys   The round keys, owned by the caller.
+ * @param Nr           Number of round keys.
+ * @param vector_init  The 16-byte IV or initial counter, ignored in ECB mode (may be NULL).
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int stream_init(stream_ctx *ctx, const char *mode, bool encrypt, unsigned char **round_keys, size_t Nr, const unsigned char *vector_init)
+{
+    if (stream_mode_from_name(mode, &ctx->mode) != EXIT_SUCCESS)
+    {
+        return EXIT_FAILURE;
+    }
+    ctx->encrypt = encrypt;
+    ctx->round_keys = round_keys;
+    ctx->Nr = Nr;
+    memset(ctx->chain, 0, BLOCK_SIZE);
+    if (vector_init != NULL)
+    {
+        memcpy(ctx->chain, vector_init, BLOCK_SIZE);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Runs the mode on a buffer and carries the chaining state to the next call.
+ *
+ * Consecutive calls give the same result as one call on the whole data, so
+ * a file can be processed chunk by chunk. The block pointers are built on
+ * the stack STREAM_BATCH_BLOCKS at a time, no block is allocated.
+ *
+ * @param ctx     The streaming context.
+ * @param in      The input data.
+ * @param out     The output buffer, may be equal to in.
+ * @param length  The number of bytes, a multiple of BLOCK_SIZE.
+ * @return 0 on success, -1 on failure.
+ */
+int stream_update(stream_ctx *ctx, const unsigned char *in, unsigned char *out, size_t length)
+{
+    if (length % BLOCK_SIZE != 0)
+    {
+        printf("Stream length must be a multiple of the block size.\n");
+        return -1;
+    }
+    unsigned char *in_blocks[STREAM_BATCH_BLOCKS];
+    unsigned char *out_blocks[STREAM_BATCH_BLOCKS];
+    size_t num_blocks = length / BLOCK_SIZE;
+    size_t num_out;
+
+    for (size_t i = 0; i < num_blocks; i += STREAM_BATCH_BLOCKS)
+    {
+        size_t batch = num_blocks - i < STREAM_BATCH_BLOCKS ? num_blocks - i : STREAM_BATCH_BLOCKS;
+        for (size_t b = 0; b < batch; b++)
+        {
+            in_blocks[b] = (unsigned char *)in + (i + b) * BLOCK_SIZE;
+            out_blocks[b] = out + (i + b) * BLOCK_SIZE;
+        }
+        // Last ciphertext block of the batch, saved before an in-place call overwrites it.
+        unsigned char last_in[BLOCK_SIZE];
+        memcpy(last_in, in_blocks[batch - 1], BLOCK_SIZE);
+
+        int result = 0;
+        switch (ctx->mode)
+        {
+        case STREAM_ECB:
+            result = ctx->encrypt ? ECB_cipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr)
+                                  : ECB_decipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr);
+            break;
+        case STREAM_CBC:
+            result = ctx->encrypt ? CBC_cipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr, ctx->chain)
+                                  : CBC_decipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr, ctx->chain);
+            memcpy(ctx->chain, ctx->encrypt ? out_blocks[batch - 1] : last_in, BLOCK_SIZE);
+            break;
+        case STREAM_CFB:
+            result = ctx->encrypt ? CFB_cipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr, ctx->chain)
+                                  : CFB_decipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr, ctx->chain);
+            memcpy(ctx->chain, ctx->encrypt ? out_blocks[batch - 1] : last_in, BLOCK_SIZE);
+            break;
+        case STREAM_CTR:
+            result = CTR_cipher(ctx->round_keys, in_blocks, batch, out_blocks, &num_out, ctx->Nr, ctx->chain);
+            CTR_increment(ctx->chain, batch);
+            break;
+        }
+        if (result != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells whether chunks can be processed independently of each other.
+ *
+ * ECB, CTR, and CBC or CFB decryption only need the input of the previous
+ * chunk to start a chunk, see stream_skip. CBC and CFB encryption need its
+ * output, so their chunks must be processed in order.
+ *
+ * @param ctx  The streaming context.
+ * @return true if the mode allows parallel chunks.
+ */
+bool stream_is_parallel(const stream_ctx *ctx)
+{
+    return ctx->mode == STREAM_ECB || ctx->mode == STREAM_CTR || !ctx->encrypt;
+}
+
+/**
+ * @brief Moves the chaining state past a chunk without processing it.
+ *
+ * The context ends up as if stream_update had been called on the chunk. Only
+ * valid for the modes of stream_is_parallel.
+ *
+ * @param ctx     The streaming context.
+ * @param in      The input of the skipped chunk.
+ * @param length  The chunk length, a multiple of BLOCK_SIZE.
+ */
+void stream_skip(stream_ctx *ctx, const unsigned char *in, size_t length)
+{
+    if (length < BLOCK_SIZE)
+    {
+        return;
+    }
+    if (ctx->mode == STREAM_CTR)
+    {
+        CTR_increment(ctx->chain, length / BLOCK_SIZE);
+    }
+    else if (ctx->mode != STREAM_ECB)
+    {
+        memcpy(ctx->chain, in + length - BLOCK_SIZE, BLOCK_SIZE);
+    }
+}
+
+/**
+ * @brief Streams into a pipe with vmsplice, without copying the output through the kernel.
+ *
+ * The pipe is grown to the chunk size if allowed, and two buffers of one pipe
+ * capacity are used in turn. Once a whole buffer has been spliced, the pipe
+ * holds nothing but that buffer, so the reader has consumed the other one and
+ * it can be refilled. The buffers are anonymous mappings: unmapping them at the
+ * end leaves the pages still referenced by the pipe untouched.
+ *
+ * @return EXIT_SUCCESS, EXIT_FAILURE, or IO_UNSUPPORTED if nothing was read.
+ */
+static int stream_to_pipe(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *total)
+{
+    fcntl(out_fd, F_SETPIPE_SZ, (int)(chunk_size < (1 << 30) ? chunk_size : (1 << 30)));
+    int pipe_size = fcntl(out_fd, F_GETPIPE_SZ);
+    if (pipe_size <= 0 || pipe_size % BLOCK_SIZE != 0)
+    {
+        return IO_UNSUPPORTED;
+    }
+    size_t size = (size_t)pipe_size;
+    unsigned char *buffers = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+    {
+        return IO_UNSUPPORTED;
+    }
+
+    bool splice = true;
+    int status = EXIT_SUCCESS;
+    for (int current = 0;; current ^= 1)
+    {
+        unsigned char *chunk = buffers + current * size;
+        double stage_start = stats_begin();
+        ssize_t n = read_full(in_fd, chunk, size);
+        stats_end(STATS_READ, stage_start, n > 0 ? (unsigned long long)n : 0);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        size_t length = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(chunk + n, 0, length - (size_t)n);
+        stage_start = stats_begin();
+        AES_PROBE3(chunk_start, AES_ENGINE_STREAM, ctx->mode, length);
+        if (stream_update(ctx, chunk, chunk, length) != 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        AES_PROBE3(chunk_end, AES_ENGINE_STREAM, ctx->mode, length);
+        stats_end(STATS_CIPHER, stage_start, length);
+
+        stage_start = stats_begin();
+        int result = splice ? vmsplice_all(out_fd, chunk, length) : IO_UNSUPPORTED;
+        if (result == IO_UNSUPPORTED)
+        {
+            // vmsplice refused: copy with write from now on.
+            splice = false;
+            result = write_all(out_fd, chunk, length);
+        }
+        stats_end(STATS_WRITE, stage_start, result == EXIT_SUCCESS ? length : 0);
+        if (result != EXIT_SUCCESS)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        *total += length;
+        if ((size_t)n < size)
+        {
+            break;
+        }
+    }
+    munmap(buffers, 2 * size);
+    return status;
+}
+
+/**
+ * @brief Encrypts or decrypts a file chunk by chunk.
+ *
+ * Each chunk is read, processed in place and written before the next one is
+ * read, so memory use is one chunk whatever the file size. The last block is
+ * padded with zeros, as split_text_into_blocks does. Input can be a pipe; when
+ * the output is a pipe, the chunks are moved into it with vmsplice.
+ *
+ * @param ctx         The streaming context.
+ * @param in_fd       The file descriptor to read from.
+ * @param out_fd      The file descriptor to write to.
+ * @param chunk_size  The chunk size in bytes, rounded up to a multiple of BLOCK_SIZE.
+ * @param bytes_out   Pointer to store the number of bytes written (may be NULL).
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int stream_file(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (chunk_size == 0)
+    {
+        chunk_size = BLOCK_SIZE;
+    }
+
+    // Pipes get the output pages by reference.
+    struct stat out_stat;
+    unsigned long long total = 0;
+    if (fstat(out_fd, &out_stat) == 0 && S_ISFIFO(out_stat.st_mode))
+    {
+        int result = stream_to_pipe(ctx, in_fd, out_fd, chunk_size, &total);
+        if (result != IO_UNSUPPORTED)
+        {
+            if (bytes_out != NULL)
+            {
+                *bytes_out = total;
+            }
+            return result;
+        }
+    }
+
+    unsigned char *chunk = (unsigned char *)malloc(chunk_size);
+    if (chunk == NULL)
+    {
+        printf("Memory allocation failed for the stream chunk.\n");
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (;;)
+    {
+        double stage_start = stats_begin();
+        ssize_t n = read_full(in_fd, chunk, chunk_size);
+        stats_end(STATS_READ, stage_start, n > 0 ? (unsigned long long)n : 0);
+        if (n < 0)
+        {
+            printf("Failed to read the input.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        // Pad the last block with zeros.
+        size_t length = ((size_t)n + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(chunk + n, 0, length - (size_t)n);
+
+        stage_start = stats_begin();
+        AES_PROBE3(chunk_start, AES_ENGINE_STREAM, ctx->mode, length);
+        if (stream_update(ctx, chunk, chunk, length) != 0)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        AES_PROBE3(chunk_end, AES_ENGINE_STREAM, ctx->mode, length);
+        stats_end(STATS_CIPHER, stage_start, length);
+        stage_start = stats_begin();
+        if (write_all(out_fd, chunk, length) != EXIT_SUCCESS)
+        {
+            printf("Failed to write the output.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        stats_end(STATS_WRITE, stage_start, length);
+        total += length;
+        if ((size_t)n < chunk_size)
+        {
+            break;
+        }
+    }
+
+    free(chunk);
+    if (bytes_out != NULL)
+    {
+        *bytes_out = total;
+    }
+    return status;
+}
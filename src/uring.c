@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+// <linux/fs.h>, included by <linux/io_uring.h>, has its own BLOCK_SIZE.
+#undef BLOCK_SIZE
+#include "../include/uring.h"
+#include "../include/stream.h"
+#include "../include/io.h"
+#include "../include/more.h"
+#include "../include/probes.h"
+
+#define URING_OP_READ 0
+#define URING_OP_WRITE 1
+
+// Submission and completion rings shared with the kernel.
+typedef struct
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+    unsigned in_flight; // Queued requests whose completion has not been reaped
+} uring;
+
+// State of one chunk buffer.
+typedef struct
+{
+    unsigned char *data;
+    unsigned long long chunk; // Index of the chunk held in the buffer
+    size_t length;            // Bytes of input in the chunk
+    size_t done;              // Bytes already read or written
+    size_t out_length;        // Bytes to write (length padded to a block)
+    bool ready;               // Read complete, waiting to be encrypted
+} uring_buffer;
+
+static int uring_setup(uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+        {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = 0;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        close(ring->fd);
+        return -1;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (ring->cq_ring_size != 0)
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        if (ring->cq_ring_size != 0)
+        {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        close(ring->fd);
+        return -1;
+    }
+
+    char *sq = (char *)ring->sq_ring;
+    char *cq = (char *)ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size != 0)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/**
+ * @brief Queues a read or write on a registered buffer. It is submitted by the next uring_wait.
+ */
+static void uring_queue(uring *ring, int op, int fd, unsigned buffer_index, uring_buffer *buffer, unsigned long long offset, size_t length)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == URING_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(buffer->data + buffer->done);
+    sqe->len = (uint32_t)length;
+    sqe->off = offset;
+    sqe->buf_index = (uint16_t)buffer_index;
+    sqe->user_data = ((uint64_t)buffer_index << 1) | (uint64_t)op;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    ring->in_flight++;
+    AES_PROBE3(io_submit, AES_ENGINE_URING, op == URING_OP_READ ? AES_IO_READ : AES_IO_WRITE, length);
+}
+
+/**
+ * @brief Submits the queued requests and waits for at least one completion.
+ */
+static int uring_wait(uring *ring)
+{
+    for (;;)
+    {
+        int n = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0)
+        {
+            ring->to_submit -= (unsigned)n;
+            return 0;
+        }
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Submits what is still queued and reaps every request in flight, ignoring the results.
+ *
+ * @return 0 once nothing is in flight, -1 if io_uring_enter fails.
+ */
+static int uring_drain(uring *ring)
+{
+    while (ring->in_flight > 0)
+    {
+        if (uring_wait(ring) != 0)
+        {
+            return -1;
+        }
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        ring->in_flight -= tail - head;
+        __atomic_store_n(ring->cq_head, tail, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// start: the file offset of chunk 0.
+static void uring_queue_read(uring *ring, int in_fd, unsigned long long start, unsigned index, uring_buffer *buffer, size_t chunk_size)
+{
+    unsigned long long offset = start + buffer->chunk * chunk_size + buffer->done;
+    uring_queue(ring, URING_OP_READ, in_fd, index, buffer, offset, buffer->length - buffer->done);
+}
+
+static void uring_queue_write(uring *ring, int out_fd, unsigned long long start, unsigned index, uring_buffer *buffer, size_t chunk_size)
+{
+    unsigned long long offset = start + buffer->chunk * chunk_size + buffer->done;
+    uring_queue(ring, URING_OP_WRITE, out_fd, index, buffer, offset, buffer->out_length - buffer->done);
+}
+
+/**
+ * @brief Encrypts or decrypts a file with io_uring, several reads and writes in flight.
+ *
+ * URING_BUFFERS registered chunk buffers cycle through read, encryption and
+ * write. Chunk k always uses buffer k % URING_BUFFERS. Reads may complete in
+ * any order, but chunks are encrypted in file order, as soon as the next one
+ * is read, so the chaining state is carried exactly as in stream_file. A
+ * buffer is refilled with the chunk URING_BUFFERS further when its write
+ * completes. Like read and write, it starts at the current file positions and
+ * leaves them after the data; an output opened with O_APPEND is not supported.
+ *
+ * @param ctx         The streaming context.
+ * @param in_fd       The input file descriptor, a regular file.
+ * @param out_fd      The output file descriptor, a regular file.
+ * @param chunk_size  The chunk size in bytes, rounded up to a multiple of BLOCK_SIZE.
+ * @param bytes_out   Pointer to store the number of bytes written (may be NULL).
+ * @return EXIT_SUCCESS, EXIT_FAILURE, or IO_UNSUPPORTED if io_uring is not
+ *         available, the files are not regular files or the output is in append mode.
+ */
+int uring_process(stream_ctx *ctx, int in_fd, int out_fd, size_t chunk_size, unsigned long long *bytes_out)
+{
+    struct stat in_stat;
+    struct stat out_stat;
+    if (fstat(in_fd, &in_stat) != 0 || fstat(out_fd, &out_stat) != 0 ||
+        !S_ISREG(in_stat.st_mode) || !S_ISREG(out_stat.st_mode))
+    {
+        return IO_UNSUPPORTED;
+    }
+    // Reads and writes at explicit offsets: from the current positions, and
+    // not in append mode, where every write would go to the end of the file.
+    off_t in_start = lseek(in_fd, 0, SEEK_CUR);
+    off_t out_start = lseek(out_fd, 0, SEEK_CUR);
+    int out_flags = fcntl(out_fd, F_GETFL);
+    if (in_start < 0 || out_start < 0 || out_flags < 0 || (out_flags & O_APPEND))
+    {
+        return IO_UNSUPPORTED;
+    }
+    chunk_size = (chunk_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (chunk_size == 0 || chunk_size > UINT32_MAX)
+    {
+        chunk_size = STREAM_DEFAULT_CHUNK;
+    }
+    unsigned long long file_size = in_stat.st_size > in_start ? (unsigned long long)(in_stat.st_size - in_start) : 0;
+    unsigned long long num_chunks = (file_size + chunk_size - 1) / chunk_size;
+
+    uring ring;
+    if (uring_setup(&ring, 2 * URING_BUFFERS) != 0)
+    {
+        return IO_UNSUPPORTED;
+    }
+    unsigned char *memory = mmap(NULL, URING_BUFFERS * chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        printf("Memory allocation failed for the io_uring buffers.\n");
+        uring_teardown(&ring);
+        return EXIT_FAILURE;
+    }
+    uring_buffer buffers[URING_BUFFERS];
+    struct iovec iovecs[URING_BUFFERS];
+    for (unsigned i = 0; i < URING_BUFFERS; i++)
+    {
+        buffers[i].data = memory + i * chunk_size;
+        iovecs[i].iov_base = buffers[i].data;
+        iovecs[i].iov_len = chunk_size;
+    }
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovecs, URING_BUFFERS) != 0)
+    {
+        munmap(memory, URING_BUFFERS * chunk_size);
+        uring_teardown(&ring);
+        return IO_UNSUPPORTED;
+    }
+
+    // Start the first reads.
+    unsigned long long next_read = 0;
+    for (; next_read < num_chunks && next_read < URING_BUFFERS; next_read++)
+    {
+        uring_buffer *buffer = &buffers[next_read];
+        buffer->chunk = next_read;
+        buffer->length = file_size - next_read * chunk_size < chunk_size ? (size_t)(file_size - next_read * chunk_size) : chunk_size;
+        buffer->done = 0;
+        buffer->ready = false;
+        uring_queue_read(&ring, in_fd, (unsigned long long)in_start, (unsigned)next_read, buffer, chunk_size);
+    }
+
+    unsigned long long next_cipher = 0;
+    unsigned long long written = 0;
+    unsigned long long total = 0;
+    int status = EXIT_SUCCESS;
+    while (written < num_chunks && status == EXIT_SUCCESS)
+    {
+        if (uring_wait(&ring) != 0)
+        {
+            printf("io_uring_enter failed.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && status == EXIT_SUCCESS; head++)
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            ring.in_flight--;
+            unsigned index = (unsigned)(cqe->user_data >> 1);
+            int op = (int)(cqe->user_data & 1);
+            uring_buffer *buffer = &buffers[index];
+            AES_PROBE3(io_complete, AES_ENGINE_URING, op == URING_OP_READ ? AES_IO_READ : AES_IO_WRITE, cqe->res > 0 ? cqe->res : 0);
+            if (cqe->res <= 0)
+            {
+                printf("Asynchronous %s failed.\n", op == URING_OP_READ ? "read" : "write");
+                status = EXIT_FAILURE;
+                continue; // Reaped: the loop advances past it, then stops
+            }
+            buffer->done += (size_t)cqe->res;
+            if (op == URING_OP_READ)
+            {
+                if (buffer->done < buffer->length)
+                {
+                    uring_queue_read(&ring, in_fd, (unsigned long long)in_start, index, buffer, chunk_size);
+                }
+                else
+                {
+                    buffer->ready = true;
+                }
+            }
+            else if (buffer->done < buffer->out_length)
+            {
+                uring_queue_write(&ring, out_fd, (unsigned long long)out_start, index, buffer, chunk_size);
+            }
+            else
+            {
+                // Write complete: the buffer takes the next chunk to read.
+                written++;
+                total += buffer->out_length;
+                if (next_read < num_chunks)
+                {
+                    buffer->chunk = next_read;
+                    buffer->length = file_size - next_read * chunk_size < chunk_size ? (size_t)(file_size - next_read * chunk_size) : chunk_size;
+                    buffer->done = 0;
+                    buffer->ready = false;
+                    uring_queue_read(&ring, in_fd, (unsigned long long)in_start, index, buffer, chunk_size);
+                    next_read++;
+                }
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        // Encrypt the chunks that are next in file order, then write them.
+        while (status == EXIT_SUCCESS && next_cipher < num_chunks && buffers[next_cipher % URING_BUFFERS].ready)
+        {
+            unsigned index = (unsigned)(next_cipher % URING_BUFFERS);
+            uring_buffer *buffer = &buffers[index];
+            buffer->ready = false;
+            buffer->out_length = (buffer->length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+            memset(buffer->data + buffer->length, 0, buffer->out_length - buffer->length);
+            AES_PROBE3(chunk_start, AES_ENGINE_URING, ctx->mode, buffer->out_length);
+            if (stream_update(ctx, buffer->data, buffer->data, buffer->out_length) != 0)
+            {
+                status = EXIT_FAILURE;
+                break;
+            }
+            AES_PROBE3(chunk_end, AES_ENGINE_URING, ctx->mode, buffer->out_length);
+            buffer->done = 0;
+            uring_queue_write(&ring, out_fd, (unsigned long long)out_start, index, buffer, chunk_size);
+            next_cipher++;
+        }
+    }
+
+    // After a failure, reads and writes may still be in flight: let them
+    // finish before the buffers go away. If they cannot be reaped, keep the
+    // buffers mapped rather than let a late completion use freed memory.
+    bool drained = uring_drain(&ring) == 0;
+    syscall(__NR_io_uring_register, ring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    uring_teardown(&ring);
+    if (drained)
+    {
+        munmap(memory, URING_BUFFERS * chunk_size);
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        lseek(in_fd, in_start + (off_t)file_size, SEEK_SET);
+        lseek(out_fd, out_start + (off_t)total, SEEK_SET);
+    }
+    if (bytes_out != NULL)
+    {
+        *bytes_out = total;
+    }
+    return status;
+}
@@ -0,0 +1,896 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "../include/AES.h"
+#include "../include/stream.h"
+#include "../include/DRBG.h"
+#include "../include/lz.h"
+#include "../include/crc32c.h"
+#include "../include/keycache.h"
+#include "../include/async.h"
+#include "../include/iov.h"
+#include "../include/appendlog.h"
+#include "../include/aesfile.h"
+#include "../include/shm.h"
+#include "../include/io.h"
+#include "../include/uring.h"
+
+/*
+ * Unit tests of the library: known-answer vectors, and round trips of the
+ * engines the command line does not reach directly, against the streaming
+ * API. Run by "make check" with tests/check.sh.
+ */
+
+static const char *const mode_names[] = {"ECB", "CBC", "CFB", "CTR"};
+
+static int failures = 0;
+
+static void check(bool ok, const char *name)
+{
+    printf("%-48s %s\n", name, ok ? "ok" : "FAILED");
+    if (!ok)
+    {
+        failures++;
+    }
+}
+
+static size_t from_hex(const char *hex, unsigned char *out)
+{
+    size_t length = strlen(hex) / 2;
+    for (size_t i = 0; i < length; i++)
+    {
+        out[i] = (unsigned char)(char_to_hex(hex[2 * i]) << 4 | char_to_hex(hex[2 * i + 1]));
+    }
+    return length;
+}
+
+// Deterministic test data, so a failure can be reproduced.
+static void fill(unsigned char *data, size_t length, uint32_t seed)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+/**
+ * @brief Encrypts or decrypts a whole buffer with the streaming API, the reference for the other engines.
+ */
+static int reference(const char *mode, bool encrypt, const unsigned char *key, size_t key_length, const unsigned char *iv,
+                     const unsigned char *in, unsigned char *out, size_t length)
+{
+    unsigned char **round_keys;
+    size_t Nr;
+    stream_ctx ctx;
+    if (key_setup_bytes(key, key_length, &round_keys, &Nr) != 0)
+    {
+        return -1;
+    }
+    int result = stream_init(&ctx, mode, encrypt, round_keys, Nr, iv) == EXIT_SUCCESS ? stream_update(&ctx, in, out, length) : -1;
+    free_blocks(round_keys, Nr);
+    return result;
+}
+
+/**
+ * @brief FIPS-197 appendix C: one block under a 128, 192 and 256-bit key.
+ */
+static void test_cipher(void)
+{
+    static const char *const keys[] = {"000102030405060708090a0b0c0d0e0f", "000102030405060708090a0b0c0d0e0f1011121314151617",
+                                       "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"};
+    static const char *const ciphers[] = {"69c4e0d86a7b0430d8cdb78070b4c55a", "dda97ca4864cdfe06eaf70a0ec0d7191", "8ea2b7ca516745bfeafc49904b496089"};
+    for (int k = 0; k < 3; k++)
+    {
+        unsigned char key[32];
+        unsigned char plain[BLOCK_SIZE];
+        unsigned char expected[BLOCK_SIZE];
+        unsigned char cipher[BLOCK_SIZE];
+        unsigned char decipher[BLOCK_SIZE];
+        unsigned char **round_keys;
+        size_t Nr;
+        size_t key_length = from_hex(keys[k], key);
+        from_hex("00112233445566778899aabbccddeeff", plain);
+        from_hex(ciphers[k], expected);
+        char name[64];
+        snprintf(name, sizeof(name), "FIPS-197 AES-%zu", key_length * 8);
+        if (key_setup_bytes(key, key_length, &round_keys, &Nr) != 0)
+        {
+            check(false, name);
+            continue;
+        }
+        AES_cipher(plain, round_keys, cipher, Nr);
+        AES_decipher(cipher, round_keys, decipher, Nr);
+        check(memcmp(cipher, expected, BLOCK_SIZE) == 0 && memcmp(decipher, plain, BLOCK_SIZE) == 0, name);
+        free_blocks(round_keys, Nr);
+    }
+}
+
+/**
+ * @brief SP 800-38A appendix F, AES-128: ECB, CBC, CFB128 and CTR over four blocks,
+ * in one call and split across two calls.
+ */
+static void test_modes(void)
+{
+    static const char *const ciphers[] = {
+        "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4",
+        "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b273bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7",
+        "3b3fd92eb72dad20333449f8e83cfb4ac8a64537a0b3a93fcde3cdad9f1ce58b26751f67a3cbb140b1808cf187a4f4dfc04b05357c5d1c0eeac4c66f9ff7f2e6",
+        "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"};
+    unsigned char key[16];
+    unsigned char plain[64];
+    from_hex("2b7e151628aed2a6abf7158809cf4f3c", key);
+    from_hex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+             plain);
+    unsigned char **round_keys;
+    size_t Nr;
+    if (key_setup_bytes(key, sizeof(key), &round_keys, &Nr) != 0)
+    {
+        check(false, "SP 800-38A key setup");
+        return;
+    }
+    for (int m = 0; m < 4; m++)
+    {
+        unsigned char iv[BLOCK_SIZE];
+        unsigned char expected[64];
+        unsigned char cipher[64];
+        unsigned char split[64];
+        unsigned char decipher[64];
+        from_hex(m == STREAM_CTR ? "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff" : "000102030405060708090a0b0c0d0e0f", iv);
+        from_hex(ciphers[m], expected);
+        stream_ctx ctx;
+        stream_init(&ctx, mode_names[m], true, round_keys, Nr, iv);
+        stream_update(&ctx, plain, cipher, sizeof(plain));
+        stream_init(&ctx, mode_names[m], true, round_keys, Nr, iv);
+        stream_update(&ctx, plain, split, BLOCK_SIZE);
+        stream_update(&ctx, plain + BLOCK_SIZE, split + BLOCK_SIZE, sizeof(plain) - BLOCK_SIZE);
+        stream_init(&ctx, mode_names[m], false, round_keys, Nr, iv);
+        stream_update(&ctx, cipher, decipher, sizeof(cipher));
+        char name[64];
+        snprintf(name, sizeof(name), "SP 800-38A %s", mode_names[m]);
+        check(memcmp(cipher, expected, sizeof(expected)) == 0 && memcmp(split, expected, sizeof(expected)) == 0 &&
+                  memcmp(decipher, plain, sizeof(plain)) == 0,
+              name);
+    }
+    free_blocks(round_keys, Nr);
+}
+
+/**
+ * @brief CTR_DRBG (AES-256, no derivation function) against an independent
+ * SP 800-90A implementation built on "openssl enc -aes-256-ecb".
+ */
+static void test_drbg(void)
+{
+    uint8_t entropy[DRBG_SEED_LEN];
+    uint8_t reseed[DRBG_SEED_LEN];
+    for (int i = 0; i < DRBG_SEED_LEN; i++)
+    {
+        entropy[i] = (uint8_t)i;
+        reseed[i] = (uint8_t)(100 + i);
+    }
+    unsigned char expected[64];
+    uint8_t out[64];
+    drbg_state state;
+
+    bool ok = drbg_instantiate(&state, entropy, sizeof(entropy), NULL, 0) == 0 && drbg_generate(&state, out, 40, NULL, 0) == 0;
+    from_hex("061550234d158c5ec95595fe04ef7a25767f2e24cc2bc479d09d86dc9abcfde7056a8c266f9ef97e", expected);
+    ok = ok && memcmp(out, expected, 40) == 0 && drbg_generate(&state, out, 64, NULL, 0) == 0;
+    from_hex("d81c4d8d734fcbfbeade3d3f8a039faa2a2c9957e835ad55b22e75bf57bb556ac81adde6aeeb4a5a875c3bfcadfa958fde1066f4bbee94c6909aa8349b9ff0bc",
+             expected);
+    check(ok && memcmp(out, expected, 64) == 0, "CTR_DRBG generate");
+    drbg_uninstantiate(&state);
+
+    const char *personalization = "AES check personalization";
+    const char *additional = "additional";
+    ok = drbg_instantiate(&state, entropy, sizeof(entropy), (const uint8_t *)personalization, strlen(personalization)) == 0 &&
+         drbg_generate(&state, out, 32, (const uint8_t *)additional, strlen(additional)) == 0;
+    from_hex("3f9454d5d490d182a50649c930f3a830f2355f9dba6ffc8cd66ef76e125d5157", expected);
+    check(ok && memcmp(out, expected, 32) == 0, "CTR_DRBG personalization and additional input");
+    ok = drbg_reseed(&state, reseed, sizeof(reseed), (const uint8_t *)"reseed", 6) == 0 && drbg_generate(&state, out, 32, NULL, 0) == 0;
+    from_hex("8b034b345ae15ace80fd7641b17f2da0dc21c27e89bd0eecacaf69df22ca29ed", expected);
+    check(ok && memcmp(out, expected, 32) == 0, "CTR_DRBG reseed");
+    drbg_uninstantiate(&state);
+}
+
+/**
+ * @brief LZ round trips on empty, tiny, repetitive, text and random data.
+ */
+static void test_lz(void)
+{
+    size_t length = 256 << 10;
+    unsigned char *data = (unsigned char *)malloc(length);
+    unsigned char *packed = (unsigned char *)malloc(2 * length);
+    unsigned char *unpacked = (unsigned char *)malloc(length);
+    if (data == NULL || packed == NULL || unpacked == NULL)
+    {
+        check(false, "LZ round trips");
+        free(data);
+        free(packed);
+        free(unpacked);
+        return;
+    }
+    bool ok = true;
+    bool smaller = true;
+    for (int kind = 0; kind < 3 && ok; kind++)
+    {
+        if (kind == 0)
+        {
+            memset(data, 'a', length);
+        }
+        else if (kind == 1)
+        {
+            static const char *const words[] = {"the ", "Rabbit ", "said ", "Alice, ", "very ", "curious ", "and ", "Queen "};
+            size_t at = 0;
+            uint32_t seed = 7;
+            while (at < length)
+            {
+                seed = seed * 1103515245 + 12345;
+                const char *word = words[(seed >> 16) % 8];
+                size_t n = strlen(word) < length - at ? strlen(word) : length - at;
+                memcpy(data + at, word, n);
+                at += n;
+            }
+        }
+        else
+        {
+            fill(data, length, 3);
+        }
+        for (size_t size = 0; size <= length && ok; size = size < 32 ? size + 1 : size * 4)
+        {
+            size_t packed_length = lz_compress(data, size, packed, 2 * length);
+            size_t out_length = 0;
+            ok = (packed_length > 0 || size == 0) && lz_decompress(packed, packed_length, unpacked, length, &out_length) == 0 &&
+                 out_length == size && memcmp(unpacked, data, size) == 0;
+            if (kind < 2 && size == length)
+            {
+                smaller = smaller && packed_length < size / 2;
+            }
+        }
+    }
+    check(ok, "LZ round trips");
+    check(smaller, "LZ compresses repetitive data");
+    // A corrupted block must be rejected, not overflow the output.
+    size_t packed_length = lz_compress(data, 4096, packed, 2 * length);
+    size_t out_length;
+    check(lz_decompress(packed, packed_length, unpacked, 100, &out_length) != 0, "LZ rejects an output that does not fit");
+    free(data);
+    free(packed);
+    free(unpacked);
+}
+
+static uint32_t crc32c_bitwise(const unsigned char *data, size_t length)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief CRC32C check value, then long buffers (the interleaved loop) in one call and in pieces.
+ */
+static void test_crc32c(void)
+{
+    check(crc32c(0, "123456789", 9) == 0xe3069283, "CRC32C check value");
+    size_t length = 3 * CRC32C_LONG + 1000;
+    unsigned char *data = (unsigned char *)malloc(length);
+    if (data == NULL)
+    {
+        check(false, "CRC32C long buffers");
+        return;
+    }
+    fill(data, length, 1);
+    bool ok = true;
+    for (size_t size = 0; size <= length && ok; size = size * 3 + 7)
+    {
+        uint32_t expected = crc32c_bitwise(data, size);
+        uint32_t pieces = crc32c(crc32c(crc32c(0, data, size / 3), data + size / 3, size / 2 - size / 3), data + size / 2, size - size / 2);
+        ok = crc32c(0, data, size) == expected && pieces == expected;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "CRC32C long buffers (%s)", crc32c_implementation());
+    check(ok, name);
+    free(data);
+}
+
+static void count_completion(aes_job *job, void *arg)
+{
+    (void)job;
+    (*(int *)arg)++;
+}
+
+/**
+ * @brief aes_submit / aes_poll: jobs of every mode, both directions and many
+ * sizes, small ones sharing cipher calls, against the streaming API.
+ */
+static void test_async(void)
+{
+    enum
+    {
+        NUM_JOBS = 300
+    };
+    unsigned char key[16];
+    fill(key, sizeof(key), 11);
+    keycache cache;
+    key_schedule schedule;
+    if (keycache_init(&cache, 1) != EXIT_SUCCESS || keycache_get(&cache, 0, key, sizeof(key), &schedule) != KEYCACHE_OK)
+    {
+        check(false, "aes_submit / aes_poll");
+        return;
+    }
+    keycache_free(&cache);
+    aes_async *engine = aes_async_create(2);
+    aes_job *jobs = (aes_job *)calloc(NUM_JOBS, sizeof(aes_job));
+    unsigned char *in = (unsigned char *)malloc((size_t)NUM_JOBS * 8192);
+    unsigned char *out = (unsigned char *)malloc((size_t)NUM_JOBS * 8192);
+    unsigned char *expected = (unsigned char *)malloc(8192);
+    if (engine == NULL || jobs == NULL || in == NULL || out == NULL || expected == NULL)
+    {
+        check(false, "aes_submit / aes_poll");
+        aes_async_destroy(engine);
+        free(jobs);
+        free(in);
+        free(out);
+        free(expected);
+        return;
+    }
+    fill(in, (size_t)NUM_JOBS * 8192, 12);
+    int completed = 0;
+    for (int j = 0; j < NUM_JOBS; j++)
+    {
+        aes_job *job = &jobs[j];
+        job->mode = (stream_mode)(j % 4);
+        job->encrypt = j % 3 != 0;
+        job->key = &schedule;
+        fill(job->iv, BLOCK_SIZE, (uint32_t)j);
+        job->in = in + (size_t)j * 8192;
+        job->out = out + (size_t)j * 8192;
+        job->length = (size_t)(j * 37 % 512 + 1) * BLOCK_SIZE;
+        job->callback = count_completion;
+        job->arg = &completed;
+        while (aes_submit(engine, job) != EXIT_SUCCESS)
+        {
+            aes_poll(engine);
+        }
+    }
+    for (long spins = 0; completed < NUM_JOBS && spins < 100000000; spins++)
+    {
+        if (aes_poll(engine) == 0)
+        {
+            sched_yield();
+        }
+    }
+    bool ok = completed == NUM_JOBS;
+    for (int j = 0; j < NUM_JOBS && ok; j++)
+    {
+        const aes_job *job = &jobs[j];
+        ok = job->status == EXIT_SUCCESS &&
+             reference(mode_names[job->mode], job->encrypt, key, sizeof(key), job->iv, job->in, expected, job->length) == 0 &&
+             memcmp(job->out, expected, job->length) == 0;
+    }
+    check(ok, "aes_submit / aes_poll");
+    aes_async_destroy(engine);
+    free(jobs);
+    free(in);
+    free(out);
+    free(expected);
+}
+
+/**
+ * @brief aes_batch through a small key cache: items under several key ids,
+ * some only naming a cached key, with evictions, and an unknown key id.
+ */
+static void test_batch(void)
+{
+    enum
+    {
+        NUM_ITEMS = 40,
+        LENGTH = 1024
+    };
+    unsigned char keys[3][32];
+    static const size_t key_lengths[3] = {16, 24, 32};
+    for (int k = 0; k < 3; k++)
+    {
+        fill(keys[k], sizeof(keys[k]), (uint32_t)(20 + k));
+    }
+    keycache cache;
+    if (keycache_init(&cache, 2) != EXIT_SUCCESS)
+    {
+        check(false, "aes_batch");
+        return;
+    }
+    unsigned char in[NUM_ITEMS][LENGTH];
+    unsigned char out[NUM_ITEMS][LENGTH];
+    unsigned char expected[LENGTH];
+    aes_batch_item items[NUM_ITEMS];
+    fill(&in[0][0], sizeof(in), 21);
+    bool ok = true;
+    for (int round = 0; round < 3 && ok; round++)
+    {
+        memset(items, 0, sizeof(items));
+        for (int i = 0; i < NUM_ITEMS; i++)
+        {
+            int k = (i + round) % 3;
+            items[i].key_id = (uint32_t)(k + 1);
+            // The first item of a key id carries the key, the others use the cached one.
+            items[i].key = i < 3 ? keys[k] : NULL;
+            items[i].key_length = i < 3 ? key_lengths[k] : 0;
+            items[i].job.mode = (stream_mode)(i % 4);
+            items[i].job.encrypt = i % 2 == 0;
+            fill(items[i].job.iv, BLOCK_SIZE, (uint32_t)i);
+            items[i].job.in = in[i];
+            items[i].job.out = out[i];
+            items[i].job.length = (size_t)(i % 8 + 1) * (LENGTH / 8);
+        }
+        ok = aes_batch(&cache, items, NUM_ITEMS) == EXIT_SUCCESS;
+        for (int i = 0; i < NUM_ITEMS && ok; i++)
+        {
+            int k = (i + round) % 3;
+            ok = items[i].job.status == EXIT_SUCCESS &&
+                 reference(mode_names[items[i].job.mode], items[i].job.encrypt, keys[k], key_lengths[k], items[i].job.iv, in[i], expected,
+                           items[i].job.length) == 0 &&
+                 memcmp(out[i], expected, items[i].job.length) == 0;
+        }
+    }
+    keycache_stats stats;
+    keycache_get_stats(&cache, &stats);
+    check(ok && stats.hits > 0 && stats.evictions > 0, "aes_batch with the key cache");
+
+    memset(items, 0, sizeof(items));
+    items[0].key_id = 99;
+    items[0].job.mode = STREAM_ECB;
+    items[0].job.encrypt = true;
+    items[0].job.in = in[0];
+    items[0].job.out = out[0];
+    items[0].job.length = BLOCK_SIZE;
+    check(aes_batch(&cache, items, 1) != EXIT_SUCCESS && items[0].job.status != EXIT_SUCCESS, "aes_batch rejects an unknown key id");
+
+    // Three items of one key id, the second with other key bytes: only that one fails.
+    memset(items, 0, sizeof(items));
+    for (int i = 0; i < 3; i++)
+    {
+        items[i].key_id = 50;
+        items[i].key = i == 0 ? keys[0] : i == 1 ? keys[1] : NULL;
+        items[i].key_length = i < 2 ? 16 : 0;
+        items[i].job.mode = STREAM_CTR;
+        items[i].job.encrypt = true;
+        items[i].job.in = in[i];
+        items[i].job.out = out[i];
+        items[i].job.length = LENGTH;
+    }
+    ok = aes_batch(&cache, items, 3) != EXIT_SUCCESS && items[1].job.status != EXIT_SUCCESS;
+    for (int i = 0; i < 3 && ok; i += 2)
+    {
+        ok = items[i].job.status == EXIT_SUCCESS && reference("CTR", true, keys[0], 16, items[i].job.iv, in[i], expected, LENGTH) == 0 &&
+             memcmp(out[i], expected, LENGTH) == 0;
+    }
+    check(ok, "aes_batch rejects other key bytes for a key id");
+    keycache_free(&cache);
+}
+
+/**
+ * @brief aes_encrypt_iov / aes_decrypt_iov with segments cut inside blocks,
+ * against the streaming API, then back in place.
+ */
+static void test_iov(void)
+{
+    enum
+    {
+        LENGTH = 4096
+    };
+    static const size_t in_cuts[] = {1, 15, 33, 100, 7, 1000, 2, 2938};
+    static const size_t out_cuts[] = {7, 250, 16, 3, 3000, 820};
+    unsigned char key[32];
+    unsigned char iv[BLOCK_SIZE];
+    unsigned char plain[LENGTH];
+    unsigned char cipher[LENGTH];
+    unsigned char expected[LENGTH];
+    fill(key, sizeof(key), 31);
+    fill(iv, sizeof(iv), 32);
+    fill(plain, sizeof(plain), 33);
+    unsigned char **round_keys;
+    size_t Nr;
+    if (key_setup_bytes(key, sizeof(key), &round_keys, &Nr) != 0)
+    {
+        check(false, "aes_encrypt_iov / aes_decrypt_iov");
+        return;
+    }
+    struct iovec in[8];
+    struct iovec out[6];
+    size_t at = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        in[i].iov_base = plain + at;
+        in[i].iov_len = in_cuts[i];
+        at += in_cuts[i];
+    }
+    at = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        out[i].iov_base = cipher + at;
+        out[i].iov_len = out_cuts[i];
+        at += out_cuts[i];
+    }
+    bool ok = true;
+    for (int m = 0; m < 4 && ok; m++)
+    {
+        stream_ctx ctx;
+        stream_init(&ctx, mode_names[m], true, round_keys, Nr, iv);
+        ok = aes_encrypt_iov(&ctx, in, 8, out, 6) == 0 && reference(mode_names[m], true, key, sizeof(key), iv, plain, expected, LENGTH) == 0 &&
+             memcmp(cipher, expected, LENGTH) == 0;
+        // Decrypt in place: the output segments are the input ones.
+        stream_init(&ctx, mode_names[m], false, round_keys, Nr, iv);
+        ok = ok && aes_decrypt_iov(&ctx, out, 6, out, 6) == 0 && memcmp(cipher, plain, LENGTH) == 0;
+    }
+    check(ok, "aes_encrypt_iov / aes_decrypt_iov");
+    free_blocks(round_keys, Nr);
+}
+
+/**
+ * @brief Encrypted logs: records appended one by one, most ending inside a
+ * block, read back in every mode. In CFB and CTR the log must be the one-shot
+ * encryption of the records, each append must leave the ciphertext already in
+ * the log untouched, and the old and new logs must not XOR to the new record,
+ * as they would if a keystream were used twice.
+ */
+static void test_append_log(void)
+{
+    static const size_t records[] = {20, 30, 5, 11, 100, 1};
+    enum
+    {
+        LENGTH = 167,
+        SIZE = 256 + APPENDLOG_TRAILER_SIZE
+    };
+    unsigned char key[16];
+    unsigned char iv[BLOCK_SIZE];
+    unsigned char plain[SIZE];
+    unsigned char expected[SIZE];
+    unsigned char old_log[SIZE];
+    unsigned char new_log[SIZE];
+    unsigned char **round_keys;
+    size_t Nr;
+    fill(key, sizeof(key), 30);
+    fill(iv, sizeof(iv), 31);
+    fill(plain, sizeof(plain), 32);
+    if (key_setup_bytes(key, sizeof(key), &round_keys, &Nr) != 0)
+    {
+        check(false, "encrypted log");
+        return;
+    }
+    for (int m = 0; m < 4; m++)
+    {
+        bool unpadded = m == STREAM_CFB || m == STREAM_CTR;
+        FILE *log = tmpfile();
+        FILE *out = tmpfile();
+        stream_ctx ctx;
+        bool ok = log != NULL && out != NULL && stream_init(&ctx, mode_names[m], true, round_keys, Nr, iv) == EXIT_SUCCESS;
+        bool untouched = true;
+        bool reused = false;
+        size_t offset = 0;
+        for (size_t r = 0; r < sizeof(records) / sizeof(records[0]) && ok; r++)
+        {
+            FILE *in = tmpfile();
+            unsigned long long bytes = 0;
+            ssize_t old_size = pread(fileno(log), old_log, sizeof(old_log), 0);
+            ok = in != NULL && fwrite(plain + offset, 1, records[r], in) == records[r] && fflush(in) == 0 &&
+                 lseek(fileno(in), 0, SEEK_SET) == 0 && append_log_write(&ctx, fileno(in), fileno(log), 64, &bytes) == EXIT_SUCCESS &&
+                 bytes == records[r] && pread(fileno(log), new_log, sizeof(new_log), 0) > 0;
+            if (in != NULL)
+            {
+                fclose(in);
+            }
+            // The bytes past the old data: its padding, or the old trailer.
+            size_t overlap = old_size > (ssize_t)(offset + records[r]) ? records[r] : old_size > (ssize_t)offset ? (size_t)old_size - offset : 0;
+            unsigned char xor[SIZE];
+            for (size_t i = 0; i < overlap; i++)
+            {
+                xor[i] = old_log[offset + i] ^ new_log[offset + i];
+            }
+            untouched = untouched && memcmp(old_log, new_log, offset) == 0;
+            reused = reused || (overlap > 0 && memcmp(xor, plain + offset, overlap) == 0);
+            offset += records[r];
+        }
+        unsigned long long bytes = 0;
+        stream_init(&ctx, mode_names[m], false, round_keys, Nr, iv);
+        ok = ok && offset == LENGTH && append_log_read(&ctx, fileno(log), fileno(out), 64, &bytes) == EXIT_SUCCESS && bytes == LENGTH &&
+             pread(fileno(out), new_log, sizeof(new_log), 0) == LENGTH && memcmp(new_log, plain, LENGTH) == 0;
+        if (unpadded)
+        {
+            ok = ok && untouched && !reused && pread(fileno(log), new_log, sizeof(new_log), 0) == LENGTH + APPENDLOG_TRAILER_SIZE &&
+                 reference(mode_names[m], true, key, sizeof(key), iv, plain, expected, 176) == 0 && memcmp(new_log, expected, LENGTH) == 0;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "encrypted log %s", mode_names[m]);
+        check(ok, name);
+        if (log != NULL)
+        {
+            fclose(log);
+        }
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+    }
+    free_blocks(round_keys, Nr);
+}
+
+
+/**
+ * @brief aes_pread at unaligned offsets in every mode, and aes_pwrite in ECB
+ * and CTR: a file written in unaligned pieces, then partly overwritten, must
+ * hold the streaming encryption of the same plaintext.
+ */
+static void test_aes_file(void)
+{
+    enum
+    {
+        LENGTH = 3000,
+        PADDED = 3008
+    };
+    static const size_t writes[][2] = {{0, 7}, {7, 93}, {100, 1134}, {1234, 1766}, {5, 45}, {1000, 1}, {2990, 10}, {15, 2}};
+    static const size_t reads[][2] = {{0, 1}, {1, 15}, {15, 2}, {17, 1000}, {1023, 977}, {2999, 1}, {2995, 100}, {3008, 5}};
+    unsigned char key[16];
+    unsigned char iv[BLOCK_SIZE];
+    unsigned char plain[PADDED];
+    unsigned char expected[PADDED];
+    unsigned char data[PADDED];
+    unsigned char **round_keys;
+    size_t Nr;
+    fill(key, sizeof(key), 40);
+    fill(iv, sizeof(iv), 41);
+    if (key_setup_bytes(key, sizeof(key), &round_keys, &Nr) != 0)
+    {
+        check(false, "aes_pread / aes_pwrite");
+        return;
+    }
+    for (int m = 0; m < 4; m++)
+    {
+        bool writable = m == STREAM_ECB || m == STREAM_CTR;
+        FILE *stream = tmpfile();
+        int fd = stream != NULL ? dup(fileno(stream)) : -1;
+        aes_file *file = fd >= 0 ? aes_file_fdopen(fd, mode_names[m], round_keys, Nr, iv) : NULL;
+        bool ok = file != NULL;
+        memset(plain, 0, sizeof(plain));
+        if (ok && writable)
+        {
+            for (size_t w = 0; w < sizeof(writes) / sizeof(writes[0]) && ok; w++)
+            {
+                fill(plain + writes[w][0], writes[w][1], (uint32_t)(42 + w));
+                ok = aes_pwrite(file, plain + writes[w][0], writes[w][1], (off_t)writes[w][0]) == (ssize_t)writes[w][1];
+            }
+            ok = ok && aes_pwrite(file, plain, 1, PADDED + BLOCK_SIZE) < 0;
+        }
+        else if (ok)
+        {
+            fill(plain, LENGTH, 42);
+            ok = reference(mode_names[m], true, key, sizeof(key), iv, plain, expected, PADDED) == 0 &&
+                 pwrite(fileno(stream), expected, PADDED, 0) == PADDED && aes_pwrite(file, plain, 1, 0) < 0;
+        }
+        ok = ok && reference(mode_names[m], true, key, sizeof(key), iv, plain, expected, PADDED) == 0 &&
+             pread(fileno(stream), data, sizeof(data), 0) == PADDED && memcmp(data, expected, PADDED) == 0;
+        for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]) && ok; r++)
+        {
+            size_t available = reads[r][0] < PADDED ? PADDED - reads[r][0] : 0;
+            size_t length = reads[r][1] < available ? reads[r][1] : available;
+            ok = aes_pread(file, data, reads[r][1], (off_t)reads[r][0]) == (ssize_t)length && memcmp(data, plain + reads[r][0], length) == 0;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), writable ? "aes_pread / aes_pwrite %s" : "aes_pread %s", mode_names[m]);
+        check(ok, name);
+        if (file != NULL)
+        {
+            aes_file_close(file);
+        }
+        else if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (stream != NULL)
+        {
+            fclose(stream);
+        }
+    }
+    free_blocks(round_keys, Nr);
+}
+
+
+/**
+ * @brief The shared memory service in a child process: a request in every
+ * mode, the later ones naming only the key id cached by the first, against
+ * the streaming API; then slot numbers out of range, and SIGTERM.
+ */
+static void test_shm(void)
+{
+    enum
+    {
+        LENGTH = 5000,
+        PADDED = 5008
+    };
+    char name[64];
+    char path[96];
+    snprintf(name, sizeof(name), "aes_check_%d", (int)getpid());
+    snprintf(path, sizeof(path), "/dev/shm/%s", name);
+    fflush(stdout);
+    pid_t service = fork();
+    if (service == 0)
+    {
+        freopen("/dev/null", "w", stdout);
+        _exit(shm_serve(name, 2, false));
+    }
+    shm_client client = {NULL, 0};
+    bool attached = false;
+    for (int tries = 0; service > 0 && !attached && tries < 500; tries++)
+    {
+        struct timespec pause = {0, 10000000};
+        nanosleep(&pause, NULL);
+        attached = access(path, F_OK) == 0 && shm_attach(name, &client) == EXIT_SUCCESS;
+    }
+    unsigned char plain[PADDED];
+    unsigned char expected[PADDED];
+    daemon_request request;
+    memset(&request, 0, sizeof(request));
+    fill(plain, LENGTH, 50);
+    memset(plain + LENGTH, 0, PADDED - LENGTH);
+    fill(request.key, 16, 51);
+    request.key_id = 3;
+    bool ok = attached;
+    for (int m = 0; m < 4 && ok; m++)
+    {
+        unsigned char *payload;
+        int slot = shm_acquire(&client, &payload);
+        size_t result_length = 0;
+        daemon_status status = DAEMON_FAILED;
+        request.encrypt = m % 2 == 0;
+        request.mode = (stream_mode)m;
+        request.key_length = m == 0 ? 16 : 0;
+        fill(request.iv, BLOCK_SIZE, (uint32_t)(52 + m));
+        ok = slot >= 0;
+        if (ok)
+        {
+            memcpy(payload, plain, LENGTH);
+            ok = shm_submit_wait(&client, slot, &request, LENGTH, &result_length, &status) == EXIT_SUCCESS && status == DAEMON_OK &&
+                 result_length == PADDED &&
+                 reference(mode_names[m], request.encrypt, request.key, 16, request.iv, plain, expected, PADDED) == 0 &&
+                 memcmp(payload, expected, PADDED) == 0;
+            shm_release(&client, slot);
+        }
+    }
+    check(ok, "shared memory service round trips");
+
+    size_t result_length = 1;
+    daemon_status status = DAEMON_OK;
+    ok = attached && shm_submit_wait(&client, SHM_SLOTS, &request, 16, &result_length, &status) == EXIT_FAILURE &&
+         status == DAEMON_BAD_REQUEST && result_length == 0;
+    status = DAEMON_OK;
+    ok = ok && shm_submit_wait(&client, -1, &request, 16, &result_length, &status) == EXIT_FAILURE && status == DAEMON_BAD_REQUEST;
+    shm_release(&client, SHM_SLOTS); // Ignored
+    // Every slot can still be taken once: none was lost or given back twice.
+    int slots[SHM_SLOTS];
+    int taken = 0;
+    unsigned char *payload;
+    while (ok && taken < SHM_SLOTS && (slots[taken] = shm_acquire(&client, &payload)) >= 0)
+    {
+        for (int i = 0; i < taken && ok; i++)
+        {
+            ok = slots[i] != slots[taken];
+        }
+        taken++;
+    }
+    for (int i = 0; i < taken; i++)
+    {
+        shm_release(&client, slots[i]);
+    }
+    check(ok && taken == SHM_SLOTS, "shared memory slot out of range");
+
+    int exit_status = -1;
+    if (service > 0)
+    {
+        kill(service, SIGTERM);
+        waitpid(service, &exit_status, 0);
+    }
+    shm_detach(&client);
+    check(service > 0 && WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == EXIT_SUCCESS && access(path, F_OK) != 0,
+          "shared memory service stops on SIGTERM");
+}
+
+
+/**
+ * @brief uring_process from the current positions of both files: input after
+ * a prefix it must not read, output after a prefix it must not overwrite,
+ * both left after the data, against the streaming API. Passes when io_uring
+ * is not available.
+ */
+static void test_uring(void)
+{
+    enum
+    {
+        SKIP = 100,
+        KEEP = 7,
+        LENGTH = 5000,
+        PADDED = 5008
+    };
+    unsigned char key[16];
+    unsigned char iv[BLOCK_SIZE];
+    unsigned char plain[SKIP + PADDED];
+    unsigned char expected[PADDED];
+    unsigned char data[KEEP + PADDED + 1];
+    unsigned char **round_keys;
+    size_t Nr;
+    fill(key, sizeof(key), 50);
+    fill(iv, sizeof(iv), 51);
+    fill(plain, SKIP + LENGTH, 52);
+    memset(plain + SKIP + LENGTH, 0, PADDED - LENGTH);
+    if (key_setup_bytes(key, sizeof(key), &round_keys, &Nr) != 0)
+    {
+        check(false, "uring_process from the file positions");
+        return;
+    }
+    for (int m = 0; m < 4; m++)
+    {
+        FILE *in = tmpfile();
+        FILE *out = tmpfile();
+        stream_ctx ctx;
+        unsigned long long written = 0;
+        bool ok = in != NULL && out != NULL && stream_init(&ctx, mode_names[m], true, round_keys, Nr, iv) == EXIT_SUCCESS &&
+                  write(fileno(in), plain, SKIP + LENGTH) == SKIP + LENGTH && lseek(fileno(in), SKIP, SEEK_SET) == SKIP &&
+                  write(fileno(out), "prefix!", KEEP) == KEEP;
+        int status = ok ? uring_process(&ctx, fileno(in), fileno(out), 1024, &written) : EXIT_FAILURE;
+        if (status != IO_UNSUPPORTED)
+        {
+            ok = ok && status == EXIT_SUCCESS && written == PADDED &&
+                 lseek(fileno(in), 0, SEEK_CUR) == SKIP + LENGTH && lseek(fileno(out), 0, SEEK_CUR) == KEEP + PADDED &&
+                 reference(mode_names[m], true, key, sizeof(key), iv, plain + SKIP, expected, PADDED) == 0 &&
+                 pread(fileno(out), data, sizeof(data), 0) == KEEP + PADDED && memcmp(data, "prefix!", KEEP) == 0 &&
+                 memcmp(data + KEEP, expected, PADDED) == 0;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "uring_process from the file positions %s", mode_names[m]);
+        check(ok, name);
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+    }
+    free_blocks(round_keys, Nr);
+}
+
+int main(void)
+{
+    test_cipher();
+    test_modes();
+    test_drbg();
+    test_lz();
+    test_crc32c();
+    test_async();
+    test_batch();
+    test_iov();
+    test_append_log();
+    test_aes_file();
+    test_shm();
+    test_uring();
+    if (failures > 0)
+    {
+        printf("%d test(s) failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed.\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+#!/bin/sh
+# Command line tests, run by "make check" from the top directory:
+# tests/alice.txt against the tests/alice_*_<MODE>.txt fixtures through the
+# engines, file formats and services of the program.
+# Usage: sh tests/check.sh [path to the AES binary]
+
+AES=${1:-./AES}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+check()
+{
+    name=$1
+    shift
+    if "$@"; then
+        printf '%-48s ok\n' "$name"
+    else
+        printf '%-48s FAILED\n' "$name"
+        failures=$((failures + 1))
+    fi
+}
+
+# run <output> <AES arguments>: the output is removed first, or AES writes <output>_new.
+run()
+{
+    out=$1
+    shift
+    rm -f "$out"
+    "$AES" "$@" -o "$out" >/dev/null 2>&1
+}
+
+fixture()
+{
+    mode=$1
+    shift
+    run "$dir/cipher" -i tests/alice.txt -m "$mode" -c "$@" && cmp -s "$dir/cipher" "tests/alice_cipher_$mode.txt" &&
+        run "$dir/decipher" -i "tests/alice_cipher_$mode.txt" -m "$mode" -d "$@" && cmp -s "$dir/decipher" "tests/alice_decipher_$mode.txt"
+}
+
+for mode in ECB CBC CFB CTR; do
+    check "fixtures $mode" fixture $mode
+    check "fixtures $mode, streamed (-s 1000)" fixture $mode -s 1000
+    check "fixtures $mode, mmap (-p)" fixture $mode -p
+    check "fixtures $mode, io_uring (-u)" fixture $mode -u
+    check "fixtures $mode, O_DIRECT (-D)" fixture $mode -D
+    check "fixtures $mode, pipeline (-s 4K -j 3)" fixture $mode -s 4K -j 3
+done
+
+drbg()
+{
+    run "$dir/random1" -r 100K -e 00112233445566778899aabbccddeeff &&
+        run "$dir/random2" -r 100K -e 00112233445566778899aabbccddeeff &&
+        run "$dir/random3" -r 100K -e ffeeddccbbaa99887766554433221100 &&
+        [ "$(wc -c <"$dir/random1")" -eq 102400 ] && cmp -s "$dir/random1" "$dir/random2" && ! cmp -s "$dir/random1" "$dir/random3"
+}
+check "seeded CTR_DRBG output (-r -e)" drbg
+
+# stdin to stdout through pipes, where the output goes through vmsplice.
+pipe_fixture()
+{
+    mode=$1
+    cat tests/alice.txt | "$AES" -i - -m "$mode" -c -o - 2>/dev/null | cmp -s - "tests/alice_cipher_$mode.txt" &&
+        cat "tests/alice_cipher_$mode.txt" | "$AES" -i - -m "$mode" -d -o - 2>/dev/null | cmp -s - "tests/alice_decipher_$mode.txt"
+}
+for mode in ECB CBC CFB CTR; do
+    check "fixtures $mode, stdin to a pipe (-i - -o -)" pipe_fixture $mode
+done
+
+container()
+{
+    mode=$1
+    shift
+    run "$dir/container" -i tests/alice.txt -m "$mode" -c -s 4K "$@" &&
+        run "$dir/plain" -i "$dir/container" -m "$mode" -d -C && cmp -s "$dir/plain" tests/alice.txt
+}
+for mode in ECB CBC CFB CTR; do
+    check "container $mode (-C)" container $mode -C
+done
+
+range()
+{
+    run "$dir/container" -i tests/alice.txt -m CBC -c -C -s 4K &&
+        run "$dir/range" -i "$dir/container" -m CBC -d -C -R 5000:20000 &&
+        dd if=tests/alice.txt of="$dir/slice" bs=1 skip=5000 count=20000 2>/dev/null && cmp -s "$dir/range" "$dir/slice"
+}
+check "container range (-R)" range
+
+for mode in ECB CBC CFB CTR; do
+    check "container $mode, compressed (-Z)" container $mode -Z
+done
+
+compressed_smaller()
+{
+    run "$dir/container" -i tests/alice.txt -m CTR -c -Z -s 16K && [ "$(wc -c <"$dir/container")" -lt "$(wc -c <tests/alice.txt)" ]
+}
+check "container compression shrinks text" compressed_smaller
+
+verify()
+{
+    run "$dir/container" -i tests/alice.txt -m CFB -c -C -s 4K && "$AES" -V -i "$dir/container" >/dev/null 2>&1 &&
+        printf 'XXXXXXXXXXXXXXXX' | dd of="$dir/container" bs=1 seek=70000 conv=notrunc 2>/dev/null && ! "$AES" -V -i "$dir/container" >/dev/null 2>&1
+}
+check "container checksums (-V) catch a corrupted chunk" verify
+
+incremental()
+{
+    rm -f "$dir/database" "$dir/database.update"
+    cp tests/alice.txt "$dir/v1" &&
+        "$AES" -i "$dir/v1" -m CBC -c -I -s 4K -o "$dir/database" >/dev/null 2>&1 &&
+        { head -c 60000 tests/alice.txt; printf 'An edit in the middle.'; tail -c +60001 tests/alice.txt; } >"$dir/v2" &&
+        "$AES" -i "$dir/v2" -m CBC -c -I -s 4K -o "$dir/database" >/dev/null 2>&1 &&
+        [ ! -e "$dir/database.update" ] &&
+        run "$dir/plain" -i "$dir/database" -m CBC -d -C && cmp -s "$dir/plain" "$dir/v2"
+}
+check "incremental container update (-I)" incremental
+
+# base_iv <container>: the base IV in the container header.
+base_iv()
+{
+    dd if="$1" bs=1 skip=24 count=16 2>/dev/null
+}
+
+# Without a matching manifest, an existing container is encrypted again under
+# a new base IV, even with -n, so no chunk IV or counter is used twice.
+incremental_new_iv()
+{
+    rm -f "$dir/database" "$dir/database.manifest" "$dir/database.update"
+    "$AES" -i tests/alice.txt -m CTR -c -I -s 4K -n 0123456789abcdef0123456789abcdef -o "$dir/database" >/dev/null 2>&1 &&
+        [ "$(base_iv "$dir/database")" = 0123456789abcdef ] && rm "$dir/database.manifest" &&
+        { head -c 60000 tests/alice.txt; printf 'An edit in the middle.'; tail -c +60001 tests/alice.txt; } >"$dir/v2" &&
+        "$AES" -i "$dir/v2" -m CTR -c -I -s 4K -n 0123456789abcdef0123456789abcdef -o "$dir/database" >/dev/null 2>&1 &&
+        [ "$(base_iv "$dir/database")" != 0123456789abcdef ] &&
+        run "$dir/plain" -i "$dir/database" -m CTR -d -C && cmp -s "$dir/plain" "$dir/v2"
+}
+check "incremental rewrite without manifest, new IV" incremental_new_iv
+
+# -R on a bare ciphertext decrypts just the range with aes_pread.
+bare_range()
+{
+    mode=$1
+    run "$dir/range" -i "tests/alice_cipher_$mode.txt" -m "$mode" -d -R 5001:20003 &&
+        dd if="tests/alice_decipher_$mode.txt" of="$dir/slice" bs=1 skip=5001 count=20003 2>/dev/null && cmp -s "$dir/range" "$dir/slice"
+}
+for mode in ECB CBC CFB CTR; do
+    check "range $mode of a bare file (-R)" bare_range $mode
+done
+
+# crash <interval>: a -K job killed by the file size limit (SIGXFSZ) part of the way through.
+crash()
+{
+    rm -f "$dir/resumed" "$dir/resumed.journal"
+    (ulimit -f 100; exec "$AES" -i "$dir/input" -m CBC -c -K "$1" -s 4K -o "$dir/resumed" >/dev/null 2>&1) 2>/dev/null
+    [ -s "$dir/resumed.journal" ] && ! cmp -s "$dir/resumed" tests/alice_cipher_CBC.txt
+}
+
+# The input offset recorded in the journal.
+journal_offset()
+{
+    od -An -tu8 -j 32 -N 8 "$dir/resumed.journal" | tr -d ' '
+}
+
+resume()
+{
+    "$AES" -i "$dir/input" -m CBC -c -S -s 4K -o "$dir/resumed" "$@" >/dev/null 2>&1
+}
+
+checkpoint()
+{
+    cp tests/alice.txt "$dir/input" && crash 16K && [ "$(journal_offset)" -gt 0 ] &&
+        resume && cmp -s "$dir/resumed" tests/alice_cipher_CBC.txt && [ ! -e "$dir/resumed.journal" ]
+}
+check "checkpoint resumed after a crash (-K -S)" checkpoint
+
+checkpoint_first()
+{
+    cp tests/alice.txt "$dir/input" && crash 1G && [ "$(journal_offset)" -eq 0 ] &&
+        resume && cmp -s "$dir/resumed" tests/alice_cipher_CBC.txt
+}
+check "checkpoint resumed before the first interval" checkpoint_first
+
+checkpoint_mismatch()
+{
+    cp tests/alice.txt "$dir/input" && crash 16K &&
+        ! resume -k 2b7e151628aed2a6abf7158809cf4f3c && ! "$AES" -i "$dir/input" -m CTR -c -S -s 4K -o "$dir/resumed" >/dev/null 2>&1 &&
+        touch -d '2001-01-01' "$dir/input" && ! resume && [ -s "$dir/resumed.journal" ]
+}
+check "checkpoint refuses another key, mode or input" checkpoint_mismatch
+
+# batch <mode> <-c | -d> <input> <expected output>: a list and a directory tree,
+# each with a file split into chunk tasks (over BATCH_SPLIT_CHUNKS chunks of 4K)
+# and a small one processed whole.
+batch()
+{
+    mode=$1
+    direction=$2
+    rm -rf "$dir/tree" "$dir/out" && mkdir -p "$dir/tree/a/b" "$dir/out" &&
+        cp "$3" "$dir/tree/big" && head -c 1024 "$3" >"$dir/tree/a/b/small" && head -c 1024 "$4" >"$dir/small" &&
+        printf '%s\t%s\n' "$dir/tree/big" "$dir/out/big" "$dir/tree/a/b/small" "$dir/out/small" >"$dir/list" &&
+        "$AES" -B "$dir/list" -m "$mode" "$direction" -s 4K -j 3 >/dev/null 2>&1 &&
+        cmp -s "$dir/out/big" "$4" && cmp -s "$dir/out/small" "$dir/small" &&
+        "$AES" -B "$dir/tree" -o "$dir/out/tree" -m "$mode" "$direction" -s 4K -j 3 >/dev/null 2>&1 &&
+        cmp -s "$dir/out/tree/big" "$4" && cmp -s "$dir/out/tree/a/b/small" "$dir/small"
+}
+for mode in ECB CBC CFB CTR; do
+    check "batch $mode encryption, list and tree (-B)" batch $mode -c tests/alice.txt "tests/alice_cipher_$mode.txt"
+    check "batch $mode decryption, list and tree (-B)" batch $mode -d "tests/alice_cipher_$mode.txt" "tests/alice_decipher_$mode.txt"
+done
+
+# The daemon (-L) in the background: requests with a key, then with only the
+# key id it cached (-Y), then with an unknown key id, stopped by SIGTERM.
+daemon_requests()
+{
+    run "$dir/reply" -Q "$socket" -i tests/alice.txt -m CBC -c && cmp -s "$dir/reply" tests/alice_cipher_CBC.txt &&
+        run "$dir/reply" -Q "$socket" -i tests/alice.txt -m CTR -c -k 000102030405060708090a0b0c0d0e0f -Y 7 &&
+        cmp -s "$dir/reply" tests/alice_cipher_CTR.txt &&
+        run "$dir/reply" -Q "$socket" -i tests/alice_cipher_CTR.txt -m CTR -d -Y 7 && cmp -s "$dir/reply" tests/alice_decipher_CTR.txt &&
+        "$AES" -Q "$socket" -i tests/alice.txt -m CTR -c -Y 8 -o "$dir/unknown" 2>&1 | grep -q '(status 2)' # DAEMON_UNKNOWN_KEY
+}
+daemon()
+{
+    socket="$dir/daemon.sock"
+    "$AES" -L "$socket" -j 2 >/dev/null 2>&1 &
+    pid=$!
+    tries=0
+    while [ ! -S "$socket" ] && [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    daemon_requests
+    status=$?
+    kill -TERM $pid && wait $pid && [ $status -eq 0 ] && [ ! -e "$socket" ]
+}
+check "daemon requests by key and key id (-L -Q -Y)" daemon
+
+# --stats-json of a run into a pipe (vmsplice): valid JSON with the bytes of the read, cipher and write stages.
+stats_json()
+{
+    rm -f "$dir/stats.json"
+    "$AES" -i tests/alice.txt -m CTR -c -s 64K -o - --stats-json "$dir/stats.json" 2>/dev/null | cmp -s - tests/alice_cipher_CTR.txt &&
+        python3 -c '
+import json, sys
+stages = json.load(open(sys.argv[1]))["stages"]
+sys.exit(not (stages["read"]["bytes"] == 147029 and stages["cipher"]["bytes"] == stages["write"]["bytes"] == 147040))
+' "$dir/stats.json" 2>/dev/null
+}
+if command -v python3 >/dev/null 2>&1; then
+    check "--stats-json of a run into a pipe" stats_json
+fi
+
+# The static tracepoints are ELF notes; skipped without readelf or when built with -DAES_NO_PROBES.
+probes()
+{
+    names=$(readelf -n "$AES" | sed -n 's/^ *Name: //p' | sort -u | tr '\n' ' ')
+    [ "$names" = "chunk_end chunk_start io_complete io_submit job_dequeue job_queue key_setup_end key_setup_start " ]
+}
+if command -v readelf >/dev/null 2>&1 && readelf -n "$AES" | grep -q 'Provider: aes'; then
+    check "USDT probes listed by readelf -n" probes
+fi
+
+if [ $failures -gt 0 ]; then
+    echo "$failures test(s) failed."
+    exit 1
+fi
+echo "All tests passed."